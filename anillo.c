@@ -0,0 +1,499 @@
+/**
+ * @file anillo.c
+ * @author Luis Fernandes 10-10239 <lfernandes@ldc.usb.ve>
+ * @author Rebeca Machado 10-10406 <rebeca@ldc.usb.ve>
+ *
+ * Funciones para usar io_uring (Linux 5.6 o más reciente) directamente con
+ * sus llamadas al sistema, sin liburing.
+ *
+ * Un anillo tiene dos colas compartidas con el núcleo: en la de envío se
+ * preparan operaciones (lecturas y escrituras sobre sockets) y en la de
+ * resultados el núcleo deja lo que devolvió cada una. Muchas operaciones se
+ * entregan y se esperan con una sola llamada a io_uring_enter.
+ *
+ * Si se compila con -DSIN_IO_URING, o si el núcleo no tiene io_uring o no
+ * soporta las operaciones que se usan, crear_anillo falla y el servidor usa
+ * las llamadas de siempre.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+
+#ifndef SIN_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#if !defined(SIN_IO_URING) && defined(__NR_io_uring_setup)
+
+
+/**
+ * \struct anillo
+ * \brief Struct que representa una instancia de io_uring.
+ */
+
+typedef struct {
+
+    /**
+     * @var fd
+     * @brief Descriptor del anillo.
+     */
+    int fd;
+
+    /**
+     * @var entradas
+     * @brief Cantidad de entradas de la cola de envío.
+     */
+    unsigned entradas;
+
+    /**
+     * @var cola_local
+     * @brief Siguiente posición libre de la cola de envío; se publica al
+     *        núcleo en completar_anillo.
+     */
+    unsigned cola_local;
+
+    /**
+     * @var preparadas
+     * @brief Operaciones preparadas que todavía no se entregan.
+     */
+    unsigned preparadas;
+
+    /**
+     * @var sq_cabeza
+     * @brief Cabeza de la cola de envío (la avanza el núcleo).
+     */
+    unsigned *sq_cabeza;
+
+    /**
+     * @var sq_cola
+     * @brief Cola de la cola de envío.
+     */
+    unsigned *sq_cola;
+
+    /**
+     * @var sq_mascara
+     * @brief Máscara de las posiciones de la cola de envío.
+     */
+    unsigned *sq_mascara;
+
+    /**
+     * @var sq_indices
+     * @brief Índices de las operaciones en sqes.
+     */
+    unsigned *sq_indices;
+
+    /**
+     * @var sqes
+     * @brief Operaciones de la cola de envío.
+     */
+    struct io_uring_sqe *sqes;
+
+    /**
+     * @var cabeceras
+     * @brief Un msghdr por cada entrada de la cola de envío, para los
+     *        sendmsg.
+     */
+    struct msghdr *cabeceras;
+
+    /**
+     * @var cq_cabeza
+     * @brief Cabeza de la cola de resultados.
+     */
+    unsigned *cq_cabeza;
+
+    /**
+     * @var cq_cola
+     * @brief Cola de la cola de resultados (la avanza el núcleo).
+     */
+    unsigned *cq_cola;
+
+    /**
+     * @var cq_mascara
+     * @brief Máscara de las posiciones de la cola de resultados.
+     */
+    unsigned *cq_mascara;
+
+    /**
+     * @var cqes
+     * @brief Resultados.
+     */
+    struct io_uring_cqe *cqes;
+
+    /**
+     * @var mapa_sq
+     * @brief Memoria compartida de la cola de envío.
+     */
+    void *mapa_sq;
+
+    /**
+     * @var largo_sq
+     * @brief Tamaño de mapa_sq.
+     */
+    size_t largo_sq;
+
+    /**
+     * @var mapa_cq
+     * @brief Memoria compartida de la cola de resultados (puede ser la misma
+     *        que mapa_sq).
+     */
+    void *mapa_cq;
+
+    /**
+     * @var largo_cq
+     * @brief Tamaño de mapa_cq.
+     */
+    size_t largo_cq;
+
+} anillo;
+
+
+/**
+ * operacion_soportada
+ *
+ * @brief Verifica si el núcleo soporta una operación de io_uring.
+ * @param sonda Resultado de IORING_REGISTER_PROBE.
+ * @param op Operación.
+ * @return 1 si la soporta, 0 si no.
+ */
+
+int operacion_soportada(struct io_uring_probe *sonda, int op) {
+    return op <= sonda->last_op &&
+           (sonda->ops[op].flags & IO_URING_OP_SUPPORTED);
+}
+
+
+/**
+ * destruir_anillo
+ *
+ * @brief Libera un anillo.
+ * @param a Anillo a destruir.
+ */
+
+void destruir_anillo(anillo *a) {
+    free(a->cabeceras);
+    if (a->sqes != NULL && a->sqes != MAP_FAILED)
+        munmap(a->sqes, a->entradas * sizeof(struct io_uring_sqe));
+    if (a->mapa_cq != NULL && a->mapa_cq != MAP_FAILED &&
+        a->mapa_cq != a->mapa_sq)
+        munmap(a->mapa_cq, a->largo_cq);
+    if (a->mapa_sq != NULL && a->mapa_sq != MAP_FAILED)
+        munmap(a->mapa_sq, a->largo_sq);
+    if (a->fd >= 0)
+        close(a->fd);
+    memset(a, 0, sizeof(anillo));
+    a->fd = -1;
+}
+
+
+/**
+ * crear_anillo
+ *
+ * @brief Crea un anillo.
+ * @param a Anillo a inicializar.
+ * @param entradas Cantidad de operaciones que se pueden preparar antes de
+ *                 entregarlas.
+ * @return 0 si se pudo crear, 1 si io_uring no está disponible.
+ */
+
+int crear_anillo(anillo *a, unsigned entradas) {
+    struct io_uring_params p;
+    struct io_uring_probe *sonda;
+    char *sq, *cq;
+    int soportado;
+
+    memset(a, 0, sizeof(anillo));
+    memset(&p, 0, sizeof(p));
+
+    a->fd = syscall(__NR_io_uring_setup, entradas, &p);
+    if (a->fd < 0) {
+        a->fd = -1;
+        return 1;
+    }
+
+    /* IORING_OP_RECV es de Linux 5.6; con uno anterior no se usa. */
+    sonda = calloc(1, sizeof(struct io_uring_probe) +
+                   256 * sizeof(struct io_uring_probe_op));
+    soportado = sonda != NULL &&
+                syscall(__NR_io_uring_register, a->fd, IORING_REGISTER_PROBE,
+                        sonda, 256) == 0 &&
+                operacion_soportada(sonda, IORING_OP_RECV) &&
+                operacion_soportada(sonda, IORING_OP_SENDMSG);
+    free(sonda);
+    if (!soportado) {
+        destruir_anillo(a);
+        return 1;
+    }
+
+    a->entradas = p.sq_entries;
+    a->cabeceras = calloc(p.sq_entries, sizeof(struct msghdr));
+    if (a->cabeceras == NULL) {
+        destruir_anillo(a);
+        return 1;
+    }
+    a->largo_sq = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    a->largo_cq = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (a->largo_cq > a->largo_sq)
+            a->largo_sq = a->largo_cq;
+        a->largo_cq = a->largo_sq;
+    }
+
+    a->mapa_sq = mmap(NULL, a->largo_sq, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, a->fd, IORING_OFF_SQ_RING);
+    if (a->mapa_sq == MAP_FAILED) {
+        destruir_anillo(a);
+        return 1;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        a->mapa_cq = a->mapa_sq;
+    else
+        a->mapa_cq = mmap(NULL, a->largo_cq, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, a->fd,
+                          IORING_OFF_CQ_RING);
+
+    a->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, a->fd,
+                   IORING_OFF_SQES);
+
+    if (a->mapa_cq == MAP_FAILED || a->sqes == MAP_FAILED) {
+        destruir_anillo(a);
+        return 1;
+    }
+
+    sq = a->mapa_sq;
+    cq = a->mapa_cq;
+    a->sq_cabeza = (unsigned *) (sq + p.sq_off.head);
+    a->sq_cola = (unsigned *) (sq + p.sq_off.tail);
+    a->sq_mascara = (unsigned *) (sq + p.sq_off.ring_mask);
+    a->sq_indices = (unsigned *) (sq + p.sq_off.array);
+    a->cq_cabeza = (unsigned *) (cq + p.cq_off.head);
+    a->cq_cola = (unsigned *) (cq + p.cq_off.tail);
+    a->cq_mascara = (unsigned *) (cq + p.cq_off.ring_mask);
+    a->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    a->cola_local = *a->sq_cola;
+    return 0;
+}
+
+
+/**
+ * pedir_operacion
+ *
+ * @brief Toma una entrada libre de la cola de envío.
+ * @param a Anillo.
+ * @return La entrada, en cero, o NULL si la cola está llena.
+ */
+
+struct io_uring_sqe *pedir_operacion(anillo *a) {
+    unsigned cabeza = __atomic_load_n(a->sq_cabeza, __ATOMIC_ACQUIRE);
+    unsigned pos;
+    struct io_uring_sqe *sqe;
+
+    if (a->cola_local - cabeza >= a->entradas)
+        return NULL;
+
+    pos = a->cola_local & *a->sq_mascara;
+    sqe = &a->sqes[pos];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    a->sq_indices[pos] = pos;
+    a->cola_local++;
+    a->preparadas++;
+    return sqe;
+}
+
+
+/**
+ * cabecera_operacion
+ *
+ * @brief Devuelve el msghdr que le corresponde a una entrada de la cola de
+ *        envío.
+ * @param a Anillo.
+ * @param sqe Entrada tomada con pedir_operacion.
+ * @return El msghdr, en cero.
+ */
+
+struct msghdr *cabecera_operacion(anillo *a, struct io_uring_sqe *sqe) {
+    struct msghdr *m = &a->cabeceras[sqe - a->sqes];
+
+    memset(m, 0, sizeof(struct msghdr));
+    return m;
+}
+
+
+/**
+ * preparar_lectura
+ *
+ * @brief Prepara un recv sobre un socket, sin esperar datos.
+ * @param a Anillo.
+ * @param fd Socket.
+ * @param datos Donde se lee.
+ * @param largo Cantidad máxima de bytes.
+ * @param dato Valor que acompaña al resultado.
+ * @return 0 si se preparó, 1 si la cola de envío está llena.
+ */
+
+int preparar_lectura(anillo *a, int fd, char *datos, int largo,
+                     unsigned long long dato) {
+    struct io_uring_sqe *sqe = pedir_operacion(a);
+
+    if (sqe == NULL)
+        return 1;
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long) datos;
+    sqe->len = largo;
+    sqe->msg_flags = MSG_DONTWAIT;
+    sqe->user_data = dato;
+    return 0;
+}
+
+
+/**
+ * preparar_escritura
+ *
+ * @brief Prepara la escritura de varios bloques en un socket (un sendmsg,
+ *        sin esperar a que haya espacio).
+ * @param a Anillo.
+ * @param fd Socket.
+ * @param iov Bloques a escribir; deben seguir existiendo hasta que llegue el
+ *            resultado.
+ * @param n Cantidad de bloques.
+ * @param dato Valor que acompaña al resultado.
+ * @return 0 si se preparó, 1 si la cola de envío está llena.
+ */
+
+int preparar_escritura(anillo *a, int fd, struct iovec *iov, int n,
+                       unsigned long long dato) {
+    struct io_uring_sqe *sqe = pedir_operacion(a);
+    struct msghdr *m;
+
+    if (sqe == NULL)
+        return 1;
+
+    m = cabecera_operacion(a, sqe);
+    m->msg_iov = iov;
+    m->msg_iovlen = n;
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long) m;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+    sqe->user_data = dato;
+    return 0;
+}
+
+
+/**
+ * completar_anillo
+ *
+ * @brief Entrega las operaciones preparadas y espera sus resultados.
+ * @param a Anillo.
+ * @return 0 si se completaron todas, 1 si io_uring_enter falló.
+ *
+ * Todas las operaciones llevan MSG_DONTWAIT, así que el núcleo no deja
+ * ninguna esperando a que el socket esté listo (como haría con un socket no
+ * bloqueante sin esa bandera): las que no pueden avanzar terminan con
+ * -EAGAIN.
+ */
+
+int completar_anillo(anillo *a) {
+    int n;
+
+    __atomic_store_n(a->sq_cola, a->cola_local, __ATOMIC_RELEASE);
+
+    while (a->preparadas > 0) {
+        n = syscall(__NR_io_uring_enter, a->fd, a->preparadas,
+                    a->preparadas, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+        a->preparadas -= n;
+    }
+    return 0;
+}
+
+
+/**
+ * tomar_resultado
+ *
+ * @brief Saca un resultado de la cola de resultados.
+ * @param a Anillo.
+ * @param dato Donde se guarda el valor que se le dio a la operación.
+ * @param res Donde se guarda lo que devolvió (negativo: -errno).
+ * @return 1 si había un resultado, 0 si no.
+ */
+
+int tomar_resultado(anillo *a, unsigned long long *dato, int *res) {
+    unsigned cabeza = *a->cq_cabeza;
+    struct io_uring_cqe *cqe;
+
+    if (cabeza == __atomic_load_n(a->cq_cola, __ATOMIC_ACQUIRE))
+        return 0;
+
+    cqe = &a->cqes[cabeza & *a->cq_mascara];
+    *dato = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(a->cq_cabeza, cabeza + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+
+#else
+
+
+/**
+ * \struct anillo
+ * \brief Anillo vacío, para cuando no se compila con io_uring.
+ */
+
+typedef struct {
+
+    /**
+     * @var fd
+     * @brief Siempre -1.
+     */
+    int fd;
+
+} anillo;
+
+
+int crear_anillo(anillo *a, unsigned entradas) {
+    a->fd = -1;
+    return 1;
+}
+
+void destruir_anillo(anillo *a) {
+}
+
+int preparar_lectura(anillo *a, int fd, char *datos, int largo,
+                     unsigned long long dato) {
+    return 1;
+}
+
+int preparar_escritura(anillo *a, int fd, struct iovec *iov, int n,
+                       unsigned long long dato) {
+    return 1;
+}
+
+int completar_anillo(anillo *a) {
+    return 1;
+}
+
+int tomar_resultado(anillo *a, unsigned long long *dato, int *res) {
+    return 0;
+}
+
+
+#endif
@@ -0,0 +1,649 @@
+/**
+ * @file bitacora.c
+ * @author Luis Fernandes 10-10239 <lfernandes@ldc.usb.ve>
+ * @author Rebeca Machado 10-10406 <rebeca@ldc.usb.ve>
+ *
+ * Bitácora en disco de los mensajes de sala.
+ *
+ * Los mensajes se agregan en orden al final de archivos de segmento
+ * (segmento-NNNNNNNN.log) dentro de un directorio. Quien envía un mensaje
+ * solo lo copia a un buffer en memoria; un hilo aparte escribe el buffer
+ * completo y llama a fdatasync cada intervalo_bitacora milisegundos, así que
+ * un solo fdatasync cubre todos los mensajes de ese intervalo.
+ *
+ * Cada segmento se cierra al llegar a TAMANO_SEGMENTO bytes. Se conservan a
+ * lo sumo MAX_SEGMENTOS segmentos, y los que tienen más de EDAD_SEGMENTO
+ * segundos se borran.
+ *
+ * Cada registro es una cabecera_registro seguida del nombre del usuario, el
+ * nombre de la sala y el texto (sin caracteres nulos), rellenado hasta un
+ * múltiplo de 8 bytes. Los enteros están en el orden de la máquina. Para
+ * leerlos, los segmentos se proyectan en memoria con mmap; la lectura de un
+ * segmento se detiene en el primer registro incompleto o cuya suma no
+ * coincide (lo que queda si el servidor se cae en medio de una escritura).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define TAMANO_SEGMENTO (8 * 1024 * 1024)
+#define MAX_SEGMENTOS 32
+#define EDAD_SEGMENTO (7 * 24 * 3600)
+#define INTERVALO_BITACORA 100
+#define LIMITE_BITACORA (64 * 1024 * 1024)
+#define LARGO_RUTA 4096
+
+
+/**
+ * \struct cabecera_registro
+ * \brief Struct con la cabecera de un registro de la bitácora.
+ */
+
+typedef struct {
+
+    /**
+     * @var largo
+     * @brief Bytes de todo el registro, incluidos la cabecera y el relleno.
+     */
+    uint32_t largo;
+
+    /**
+     * @var suma
+     * @brief Suma FNV-1a de lo que sigue a este campo (sin el relleno).
+     */
+    uint32_t suma;
+
+    /**
+     * @var tiempo
+     * @brief Momento en que se envió el mensaje, en segundos desde 1970.
+     */
+    int64_t tiempo;
+
+    /**
+     * @var largo_usuario
+     * @brief Bytes del nombre del usuario.
+     */
+    uint32_t largo_usuario;
+
+    /**
+     * @var largo_sala
+     * @brief Bytes del nombre de la sala.
+     */
+    uint32_t largo_sala;
+
+    /**
+     * @var largo_texto
+     * @brief Bytes del texto.
+     */
+    uint32_t largo_texto;
+
+    /**
+     * @var relleno
+     * @brief Sin uso; alinea la cabecera a 8 bytes.
+     */
+    uint32_t relleno;
+
+} cabecera_registro;
+
+
+/**
+ * \struct segmento
+ * \brief Struct que representa un archivo de segmento de la bitácora.
+ */
+
+typedef struct {
+
+    /**
+     * @var numero
+     * @brief Número del segmento (forma parte del nombre del archivo).
+     */
+    unsigned int numero;
+
+    /**
+     * @var creado
+     * @brief Momento en que se creó el segmento.
+     */
+    time_t creado;
+
+} segmento;
+
+
+/**
+ * \var directorio_bitacora
+ * \brief Directorio de los segmentos (NULL si no se usa la bitácora).
+ */
+char *directorio_bitacora = NULL;
+
+/**
+ * \var intervalo_bitacora
+ * \brief Milisegundos entre dos escrituras de la bitácora en disco.
+ */
+int intervalo_bitacora = INTERVALO_BITACORA;
+
+/**
+ * \var mutex_bitacora
+ * \brief Semáforo que bloquea el buffer de mensajes pendientes.
+ */
+pthread_mutex_t mutex_bitacora = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * \var mutex_disco
+ * \brief Semáforo que bloquea el segmento actual y la lista de segmentos.
+ */
+pthread_mutex_t mutex_disco = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * \var pendiente
+ * \brief Registros que todavía no se escriben en disco.
+ */
+char *pendiente = NULL;
+
+/**
+ * \var largo_pendiente
+ * \brief Bytes ocupados de pendiente.
+ */
+int largo_pendiente = 0;
+
+/**
+ * \var capacidad_pendiente
+ * \brief Tamaño de pendiente.
+ */
+int capacidad_pendiente = 0;
+
+/**
+ * \var perdidos_bitacora
+ * \brief Registros que no se guardaron por falta de memoria o porque el
+ *        disco no alcanzó a escribirlos.
+ */
+long long perdidos_bitacora = 0;
+
+/**
+ * \var segmentos
+ * \brief Segmentos existentes, del más antiguo al actual.
+ */
+segmento segmentos[MAX_SEGMENTOS + 1];
+
+/**
+ * \var num_segmentos
+ * \brief Cantidad de segmentos en el arreglo segmentos.
+ */
+int num_segmentos = 0;
+
+/**
+ * \var fd_segmento
+ * \brief Archivo del segmento actual (el último del arreglo).
+ */
+int fd_segmento = -1;
+
+/**
+ * \var largo_segmento
+ * \brief Bytes escritos en el segmento actual.
+ */
+long long largo_segmento = 0;
+
+
+/**
+ * suma_fnv
+ *
+ * @brief Calcula la suma FNV-1a de un bloque de bytes.
+ * @param datos Bytes a sumar.
+ * @param n Cantidad de bytes.
+ * @param suma Suma de los bloques anteriores (2166136261 para el primero).
+ * @return La suma.
+ */
+
+uint32_t suma_fnv(char *datos, int n, uint32_t suma) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        suma ^= (unsigned char) datos[i];
+        suma *= 16777619;
+    }
+    return suma;
+}
+
+
+/**
+ * ruta_segmento
+ *
+ * @brief Escribe la ruta del archivo de un segmento.
+ * @param ruta Donde se escribe la ruta (LARGO_RUTA bytes).
+ * @param numero Número del segmento.
+ */
+
+void ruta_segmento(char *ruta, unsigned int numero) {
+    snprintf(ruta, LARGO_RUTA, "%s/segmento-%08u.log", directorio_bitacora,
+             numero);
+}
+
+
+/**
+ * comparar_segmentos
+ *
+ * @brief Compara dos segmentos por su número (para qsort).
+ */
+
+int comparar_segmentos(const void *a, const void *b) {
+    unsigned int x = ((segmento *) a)->numero;
+    unsigned int y = ((segmento *) b)->numero;
+
+    return (x > y) - (x < y);
+}
+
+
+/**
+ * retirar_segmentos
+ *
+ * @brief Borra los segmentos que sobran o que son muy viejos.
+ *
+ * El segmento actual nunca se borra. Se llama con mutex_disco bloqueado (o
+ * antes de crear el hilo de la bitácora).
+ */
+
+void retirar_segmentos() {
+    char ruta[LARGO_RUTA];
+    time_t ahora = time(NULL);
+
+    while (num_segmentos > 1 &&
+           (num_segmentos > MAX_SEGMENTOS ||
+            ahora - segmentos[0].creado > EDAD_SEGMENTO)) {
+        ruta_segmento(ruta, segmentos[0].numero);
+        unlink(ruta);
+        num_segmentos--;
+        memmove(segmentos, segmentos + 1, num_segmentos * sizeof(segmento));
+    }
+}
+
+
+/**
+ * abrir_segmento
+ *
+ * @brief Crea un segmento nuevo y lo convierte en el actual.
+ * @return 0 si se pudo crear, 1 si no.
+ *
+ * Se llama con mutex_disco bloqueado (o antes de crear el hilo de la
+ * bitácora).
+ */
+
+int abrir_segmento() {
+    char ruta[LARGO_RUTA];
+    unsigned int numero = 1;
+
+    if (num_segmentos > 0)
+        numero = segmentos[num_segmentos - 1].numero + 1;
+
+    ruta_segmento(ruta, numero);
+    fd_segmento = open(ruta, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd_segmento < 0)
+        return 1;
+
+    segmentos[num_segmentos].numero = numero;
+    segmentos[num_segmentos].creado = time(NULL);
+    num_segmentos++;
+    largo_segmento = 0;
+
+    retirar_segmentos();
+    return 0;
+}
+
+
+/**
+ * abrir_bitacora
+ *
+ * @brief Busca los segmentos que ya existen en directorio_bitacora y crea
+ *        un segmento nuevo para escribir.
+ * @return 0 si se pudo abrir la bitácora, 1 si no.
+ *
+ * Los segmentos anteriores no se modifican más (el último puede haber
+ * quedado con un registro a medias). Los que sobran se borran de una vez.
+ */
+
+int abrir_bitacora() {
+    DIR *dir;
+    struct dirent *entrada;
+    struct stat info;
+    char ruta[LARGO_RUTA];
+    segmento *encontrados = NULL, *aux;
+    int n = 0, capacidad = 0, i;
+    unsigned int numero;
+    char resto;
+
+    dir = opendir(directorio_bitacora);
+    if (dir == NULL)
+        return 1;
+
+    while ((entrada = readdir(dir)) != NULL) {
+        if (sscanf(entrada->d_name, "segmento-%u.lo%c", &numero,
+                   &resto) != 2 || resto != 'g')
+            continue;
+
+        if (n == capacidad) {
+            capacidad = capacidad > 0 ? capacidad * 2 : MAX_SEGMENTOS;
+            aux = realloc(encontrados, capacidad * sizeof(segmento));
+            if (aux == NULL) {
+                free(encontrados);
+                closedir(dir);
+                return 1;
+            }
+            encontrados = aux;
+        }
+
+        ruta_segmento(ruta, numero);
+        encontrados[n].numero = numero;
+        encontrados[n].creado = (stat(ruta, &info) == 0) ? info.st_mtime
+                                                          : time(NULL);
+        n++;
+    }
+    closedir(dir);
+
+    // Se conservan los MAX_SEGMENTOS de número más alto
+    qsort(encontrados, n, sizeof(segmento), comparar_segmentos);
+    for (i = 0; i < n - MAX_SEGMENTOS; i++) {
+        ruta_segmento(ruta, encontrados[i].numero);
+        unlink(ruta);
+    }
+    num_segmentos = n - i;
+    memcpy(segmentos, encontrados + i, num_segmentos * sizeof(segmento));
+    free(encontrados);
+
+    return abrir_segmento();
+}
+
+
+/**
+ * agregar_bitacora
+ *
+ * @brief Agrega un mensaje de sala al buffer de la bitácora.
+ * @param usuario Nombre de quien envía el mensaje.
+ * @param sala Nombre de la sala.
+ * @param texto Texto del mensaje.
+ *
+ * Solo copia el registro en memoria; el hilo de la bitácora lo escribe en
+ * disco. Si el buffer ya tiene LIMITE_BITACORA bytes (el disco no da abasto)
+ * o no hay memoria, el mensaje no se guarda y se cuenta como perdido.
+ */
+
+void agregar_bitacora(char *usuario, char *sala, char *texto) {
+    cabecera_registro c;
+    int largo, capacidad;
+    char *aux, *fin;
+
+    c.largo_usuario = strlen(usuario);
+    c.largo_sala = strlen(sala);
+    c.largo_texto = strlen(texto);
+    c.tiempo = time(NULL);
+    c.relleno = 0;
+    largo = sizeof(c) + c.largo_usuario + c.largo_sala + c.largo_texto;
+    c.largo = (largo + 7) & ~7;
+
+    pthread_mutex_lock(&mutex_bitacora);
+
+    if (largo_pendiente + c.largo > capacidad_pendiente) {
+        capacidad = capacidad_pendiente > 0 ? capacidad_pendiente * 2 : 65536;
+        while (capacidad < largo_pendiente + (int) c.largo)
+            capacidad *= 2;
+        aux = (capacidad <= LIMITE_BITACORA) ? realloc(pendiente, capacidad)
+                                             : NULL;
+        if (aux == NULL) {
+            perdidos_bitacora++;
+            pthread_mutex_unlock(&mutex_bitacora);
+            return;
+        }
+        pendiente = aux;
+        capacidad_pendiente = capacidad;
+    }
+
+    fin = pendiente + largo_pendiente + sizeof(c);
+    memcpy(fin, usuario, c.largo_usuario);
+    fin += c.largo_usuario;
+    memcpy(fin, sala, c.largo_sala);
+    fin += c.largo_sala;
+    memcpy(fin, texto, c.largo_texto);
+    fin += c.largo_texto;
+    memset(fin, 0, c.largo - largo);
+
+    c.suma = suma_fnv((char *) &c.tiempo, sizeof(c) - 8, 2166136261U);
+    c.suma = suma_fnv(pendiente + largo_pendiente + sizeof(c),
+                      largo - sizeof(c), c.suma);
+    memcpy(pendiente + largo_pendiente, &c, sizeof(c));
+    largo_pendiente += c.largo;
+
+    pthread_mutex_unlock(&mutex_bitacora);
+}
+
+
+/**
+ * descartar_escritura
+ *
+ * @brief Deshace una escritura del segmento actual que falló.
+ * @param datos Registros que se intentaron escribir.
+ * @param largo Cantidad de bytes de los registros.
+ *
+ * El segmento se recorta a largo_segmento, para que los registros que
+ * siguen no queden detrás de uno a medias (que cortaría la lectura del
+ * segmento ahí). Si no se puede recortar, se empieza un segmento nuevo. Los
+ * registros se cuentan como perdidos. Se llama con mutex_disco bloqueado.
+ */
+
+void descartar_escritura(char *datos, int largo) {
+    cabecera_registro c;
+    int pos, perdidos = 0;
+
+    for (pos = 0; pos < largo; pos += c.largo) {
+        memcpy(&c, datos + pos, sizeof(c));
+        perdidos++;
+    }
+
+    pthread_mutex_lock(&mutex_bitacora);
+    perdidos_bitacora += perdidos;
+    pthread_mutex_unlock(&mutex_bitacora);
+
+    if (ftruncate(fd_segmento, largo_segmento) != 0) {
+        close(fd_segmento);
+        if (abrir_segmento())
+            fprintf(stderr, "No se pudo crear un segmento nuevo.\n");
+    }
+}
+
+
+/**
+ * vaciar_bitacora
+ *
+ * @brief Escribe en disco todo el buffer de la bitácora y espera a que el
+ *        disco lo confirme.
+ *
+ * El buffer se intercambia por uno vacío con mutex_bitacora bloqueado, así
+ * que quienes envían mensajes no esperan por el disco. Si la escritura
+ * falla, queda a medias o el disco no la confirma, se deshace con
+ * descartar_escritura. Si el segmento actual pasó de TAMANO_SEGMENTO bytes,
+ * se empieza uno nuevo.
+ */
+
+void vaciar_bitacora() {
+    static char *escribiendo = NULL;
+    static int capacidad_escribiendo = 0;
+    char *aux;
+    int largo, capacidad, escrito, n;
+
+    pthread_mutex_lock(&mutex_disco);
+
+    pthread_mutex_lock(&mutex_bitacora);
+    aux = pendiente;
+    capacidad = capacidad_pendiente;
+    largo = largo_pendiente;
+    pendiente = escribiendo;
+    capacidad_pendiente = capacidad_escribiendo;
+    largo_pendiente = 0;
+    pthread_mutex_unlock(&mutex_bitacora);
+
+    escribiendo = aux;
+    capacidad_escribiendo = capacidad;
+
+    if (largo > 0 && fd_segmento >= 0) {
+        for (escrito = 0; escrito < largo; escrito += n) {
+            n = write(fd_segmento, escribiendo + escrito, largo - escrito);
+            if (n < 0 && errno == EINTR) {
+                n = 0;
+            } else if (n <= 0) {
+                fprintf(stderr, "No se pudo escribir la bitácora.\n");
+                break;
+            }
+        }
+
+        if (escrito < largo) {
+            descartar_escritura(escribiendo, largo);
+        } else if (fdatasync(fd_segmento) != 0) {
+            fprintf(stderr, "El disco no confirmó la bitácora.\n");
+            descartar_escritura(escribiendo, largo);
+        } else {
+            largo_segmento += escrito;
+        }
+
+        if (fd_segmento >= 0 && largo_segmento >= TAMANO_SEGMENTO) {
+            close(fd_segmento);
+            if (abrir_segmento())
+                fprintf(stderr, "No se pudo crear un segmento nuevo.\n");
+        }
+    }
+
+    if (num_segmentos > 1 &&
+        time(NULL) - segmentos[0].creado > EDAD_SEGMENTO)
+        retirar_segmentos();
+
+    pthread_mutex_unlock(&mutex_disco);
+}
+
+
+/**
+ * rutina_hilo_bitacora
+ *
+ * @brief Función que ejecuta el hilo de la bitácora.
+ * @param args No se usa.
+ *
+ * Vacía el buffer de la bitácora cada intervalo_bitacora milisegundos.
+ */
+
+void *rutina_hilo_bitacora(void *args) {
+    struct timespec espera;
+
+    espera.tv_sec = intervalo_bitacora / 1000;
+    espera.tv_nsec = (intervalo_bitacora % 1000) * 1000000L;
+
+    while (1) {
+        nanosleep(&espera, NULL);
+        vaciar_bitacora();
+    }
+}
+
+
+/**
+ * leer_bitacora
+ *
+ * @brief Recorre todos los registros guardados en la bitácora, del más
+ *        antiguo al más reciente.
+ * @param procesar Función que se llama con cada registro: recibe contexto,
+ *                 la cabecera y los datos (usuario, sala y texto seguidos).
+ * @param contexto Primer parámetro que se le pasa a procesar.
+ * @return Cantidad de registros leídos.
+ *
+ * Cada segmento se proyecta en memoria con mmap y se recorre sin copiarlo.
+ * Solo se leen los registros que ya están en disco.
+ */
+
+long leer_bitacora(void (*procesar)(void *, cabecera_registro *, char *),
+                   void *contexto) {
+    char ruta[LARGO_RUTA];
+    struct stat info;
+    cabecera_registro *c;
+    char *mapa, *pos, *fin;
+    uint32_t suma;
+    long leidos = 0;
+    int i, fd;
+
+    pthread_mutex_lock(&mutex_disco);
+
+    for (i = 0; i < num_segmentos; i++) {
+        ruta_segmento(ruta, segmentos[i].numero);
+        fd = open(ruta, O_RDONLY);
+        if (fd < 0)
+            continue;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            close(fd);
+            continue;
+        }
+
+        mapa = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapa == MAP_FAILED)
+            continue;
+
+        pos = mapa;
+        fin = mapa + info.st_size;
+        while (fin - pos >= (long) sizeof(cabecera_registro)) {
+            c = (cabecera_registro *) pos;
+            if (c->largo < sizeof(cabecera_registro) || c->largo > fin - pos ||
+                (uint64_t) c->largo_usuario + c->largo_sala + c->largo_texto >
+                c->largo - sizeof(cabecera_registro))
+                break;
+
+            suma = suma_fnv((char *) &c->tiempo, sizeof(*c) - 8, 2166136261U);
+            suma = suma_fnv(pos + sizeof(*c), c->largo_usuario +
+                            c->largo_sala + c->largo_texto, suma);
+            if (suma != c->suma)
+                break;
+
+            procesar(contexto, c, pos + sizeof(*c));
+            leidos++;
+            pos += c->largo;
+        }
+
+        munmap(mapa, info.st_size);
+    }
+
+    pthread_mutex_unlock(&mutex_disco);
+    return leidos;
+}
+
+
+/**
+ * crear_hilo_bitacora
+ *
+ * @brief Crea el hilo que escribe la bitácora en disco.
+ * @return 0 si se pudo crear, 1 si no.
+ */
+
+int crear_hilo_bitacora() {
+    pthread_t hilo;
+
+    return pthread_create(&hilo, NULL, rutina_hilo_bitacora, NULL) != 0;
+}
+
+
+/**
+ * cerrar_bitacora
+ *
+ * @brief Escribe lo que quede pendiente y cierra el segmento actual.
+ */
+
+void cerrar_bitacora() {
+    vaciar_bitacora();
+    pthread_mutex_lock(&mutex_disco);
+    if (fd_segmento >= 0)
+        close(fd_segmento);
+    fd_segmento = -1;
+    pthread_mutex_unlock(&mutex_disco);
+
+    if (perdidos_bitacora > 0)
+        fprintf(stderr, "Bitácora: %lld mensajes no se guardaron.\n",
+                perdidos_bitacora);
+}
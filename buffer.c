@@ -0,0 +1,189 @@
+/**
+ * @file buffer.c
+ * @author Luis Fernandes 10-10239 <lfernandes@ldc.usb.ve>
+ * @author Rebeca Machado 10-10406 <rebeca@ldc.usb.ve>
+ *
+ * Funciones para separar en líneas lo que se lee de un socket.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/**
+ * \struct buffer_entrada
+ * \brief Struct que guarda la línea incompleta de una conexión.
+ *
+ * Lo que se lee del socket se procesa directamente desde el bloque leído;
+ * solo el pedazo final que no termina en salto de línea se copia aquí hasta
+ * que llegue el resto.
+ */
+
+typedef struct {
+
+    /**
+     * @var datos
+     * @brief Caracteres de la línea incompleta (NULL si nunca hizo falta).
+     */
+    char *datos;
+
+    /**
+     * @var largo
+     * @brief Cantidad de caracteres guardados.
+     */
+    int largo;
+
+    /**
+     * @var capacidad
+     * @brief Tamaño de datos.
+     */
+    int capacidad;
+
+    /**
+     * @var descartando
+     * @brief Indica si se está descartando el resto de una línea muy larga.
+     */
+    int descartando;
+
+} buffer_entrada;
+
+
+/**
+ * crear_buffer
+ *
+ * @brief Inicializa un buffer de entrada vacío.
+ * @param b Buffer a inicializar.
+ *
+ * La memoria se pide la primera vez que queda una línea incompleta.
+ */
+
+void crear_buffer(buffer_entrada *b) {
+    b->datos = NULL;
+    b->largo = 0;
+    b->capacidad = 0;
+    b->descartando = 0;
+}
+
+
+/**
+ * agregar_buffer
+ *
+ * @brief Agrega caracteres a la línea incompleta de un buffer.
+ * @param b Buffer al que se agregan los caracteres.
+ * @param datos Caracteres a agregar.
+ * @param n Cantidad de caracteres.
+ * @param max_linea Largo máximo de una línea.
+ * @return 0 si se pudo agregar, 1 si no se pudo asignar memoria.
+ *
+ * Lo que pase de max_linea caracteres se descarta.
+ */
+
+int agregar_buffer(buffer_entrada *b, char *datos, int n, int max_linea) {
+    int nueva;
+    char *aux;
+
+    if (b->largo + n > max_linea) {
+        n = max_linea - b->largo;
+        b->descartando = 1;
+    }
+
+    if (n <= 0)
+        return 0;
+
+    if (b->largo + n + 1 > b->capacidad) {
+        nueva = b->capacidad == 0 ? 64 : b->capacidad;
+        while (nueva < b->largo + n + 1)
+            nueva *= 2;
+        if (nueva > max_linea + 1)
+            nueva = max_linea + 1;
+        aux = realloc(b->datos, nueva);
+        if (aux == NULL)
+            return 1;
+        b->datos = aux;
+        b->capacidad = nueva;
+    }
+
+    memcpy(b->datos + b->largo, datos, n);
+    b->largo += n;
+    return 0;
+}
+
+
+/**
+ * separar_lineas
+ *
+ * @brief Separa en líneas un bloque leído de un socket.
+ * @param b Buffer con la línea incompleta de la conexión.
+ * @param datos Bloque leído. Se modifica: cada salto de línea se cambia por
+ *              un caracter nulo.
+ * @param n Cantidad de caracteres del bloque.
+ * @param max_linea Largo máximo de una línea; el resto de la línea se ignora.
+ * @param procesar Función que se llama con cada línea completa. Si devuelve
+ *                 algo distinto de 0, se deja de procesar el bloque.
+ * @param contexto Primer parámetro que se le pasa a procesar.
+ * @return 1 si procesar pidió detenerse, 0 en caso contrario.
+ *
+ * Un mismo bloque puede traer muchas líneas (comandos encadenados); las que
+ * están completas dentro del bloque se procesan sin copiarlas. Si había una
+ * línea incompleta de una lectura anterior, se completa en el buffer. Lo que
+ * sobra al final del bloque se guarda en el buffer.
+ */
+
+int separar_lineas(buffer_entrada *b, char *datos, int n, int max_linea,
+                   int (*procesar)(void *, char *), void *contexto) {
+    char *fin = datos + n;
+    char *salto;
+    char *linea;
+    int largo;
+
+    while (datos < fin) {
+        salto = memchr(datos, '\n', fin - datos);
+
+        if (salto == NULL) {
+            if (!b->descartando && agregar_buffer(b, datos, fin - datos,
+                                                   max_linea))
+                fprintf(stderr, "No se puede asignar memoria.\n");
+            return 0;
+        }
+
+        *salto = '\0';
+        largo = salto - datos;
+
+        if (b->largo > 0 || b->descartando) {
+            if (!b->descartando && agregar_buffer(b, datos, largo, max_linea))
+                fprintf(stderr, "No se puede asignar memoria.\n");
+            if (b->datos == NULL) {
+                linea = "";
+            } else {
+                b->datos[b->largo] = '\0';
+                linea = b->datos;
+            }
+            b->largo = 0;
+            b->descartando = 0;
+        } else {
+            if (largo > max_linea)
+                datos[max_linea] = '\0';
+            linea = datos;
+        }
+
+        datos = salto + 1;
+
+        if (procesar(contexto, linea))
+            return 1;
+    }
+    return 0;
+}
+
+
+/**
+ * destruir_buffer
+ *
+ * @brief Libera la memoria de un buffer de entrada.
+ * @param b Buffer a destruir.
+ */
+
+void destruir_buffer(buffer_entrada *b) {
+    free(b->datos);
+    crear_buffer(b);
+}
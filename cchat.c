@@ -17,11 +17,20 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <sys/un.h>
 #include <string.h>
 #include "errors.h"
 #include <getopt.h>
 #include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
 #include "htip.c"
+#include "compresion.c"
+
+#define TAMANO_BLOQUE 65536
 
 //------------------------------------------------------- Variables globales -//
 
@@ -37,6 +46,13 @@ int puerto;
  */
 char *server;
 
+/**
+ * \var ruta_local
+ * \brief Ruta del socket local del servidor introducida con la opción -x, o
+ *        NULL si la conexión es por TCP.
+ */
+char *ruta_local = NULL;
+
 /**
  * \var usuario
  * \brief Nombre del usuario introducido con la opción -n.
@@ -57,6 +73,41 @@ char *archivo;
  */
 int aflag = 0; 
 
+/**
+ * \var silencioso
+ * \brief Indica si se usó la opción -q.
+ *
+ * En modo silencioso no se imprime lo que envía el servidor; solo se cuentan
+ * los mensajes y los bytes recibidos, y se muestran al salir.
+ */
+int silencioso = 0;
+
+/**
+ * \var comprimir
+ * \brief Indica si se usó la opción -z (pedirle al servidor que comprima lo
+ *        que envía).
+ */
+int comprimir = 0;
+
+/**
+ * \var descompresion
+ * \brief Estado para descomprimir lo que envía el servidor, si aceptó la
+ *        compresión.
+ */
+descompresor descompresion;
+
+/**
+ * \var mensajes_recibidos
+ * \brief Cantidad de mensajes de sala recibidos (modo silencioso).
+ */
+long long mensajes_recibidos = 0;
+
+/**
+ * \var bytes_recibidos
+ * \brief Cantidad de bytes recibidos del servidor (modo silencioso).
+ */
+long long bytes_recibidos = 0;
+
 /**
  * \var sockfd
  * \brief Socket con el cual se establece la counicación con el servidor.
@@ -66,6 +117,19 @@ int sockfd;
 
 //------------------------------------------------------------------ Métodos -//
 
+/**
+ * imprimir_resumen
+ *
+ * @brief Muestra lo que se recibió del servidor, si se usó la opción -q.
+ */
+
+void imprimir_resumen() {
+    if (silencioso)
+        printf("Se recibieron %lld mensajes (%lld bytes).\n",
+               mensajes_recibidos, bytes_recibidos);
+}
+
+
 /**
  * salir
  * 
@@ -76,6 +140,7 @@ int sockfd;
  */
 
 void salir() {
+    imprimir_resumen();
     printf("\n\n¡Hasta luego!\n");
     write(sockfd, "fue\n", 4);
     close(sockfd);
@@ -83,50 +148,193 @@ void salir() {
 }
 
 
+/**
+ * escribir_todo
+ *
+ * @brief Escribe un bloque completo en el socket.
+ *
+ * @param datos Bloque a escribir.
+ * @param largo Cantidad de bytes del bloque.
+ *
+ * Repite el write mientras el socket acepte solo una parte del bloque.
+ */
+
+void escribir_todo(char *datos, int largo) {
+    int escrito;
+
+    while (largo > 0) {
+        escrito = write(sockfd, datos, largo);
+        if (escrito < 0) {
+            if (errno == EINTR)
+                continue;
+            fatalerror("No se pudo escribir al socket\n");
+        }
+        datos += escrito;
+        largo -= escrito;
+    }
+}
+
+
+/**
+ * copiar_descriptor
+ *
+ * @brief Copia en el socket todo lo que se lea de un descriptor.
+ *
+ * @param fd Descriptor del que se lee (un archivo o la entrada estándar).
+ *
+ * Si fd es un archivo regular, se envía con sendfile, sin pasar los datos
+ * por el programa. Si no (o si sendfile no se puede usar), se lee en bloques
+ * de hasta TAMANO_BLOQUE bytes y cada bloque se escribe con un solo write:
+ * en una terminal, read devuelve una línea completa cada vez; en una tubería,
+ * devuelve todo lo que esté disponible.
+ */
+
+void copiar_descriptor(int fd) {
+    char bloque[TAMANO_BLOQUE];
+    struct stat info;
+    ssize_t n;
+
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+        while ((n = sendfile(sockfd, fd, NULL, TAMANO_BLOQUE * 16)) > 0)
+            ;
+        if (n == 0)
+            return;
+        if (errno != EINVAL && errno != ENOSYS)
+            fatalerror("No se pudo escribir al socket\n");
+    }
+
+    while ((n = read(fd, bloque, TAMANO_BLOQUE)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            fatalerror("Error en el archivo de entrada.\n");
+        }
+        escribir_todo(bloque, n);
+    }
+}
+
+
 /**
  * escribir_socket
  * 
  * @brief Función que escribe en el socket lo leído de entrada estándar.
  * 
- * Esta función se encarga de escribir en el socket lo que el archivo de
- * entrada indique, línea por línea. Así mismo, escribe en el socket todo
- * aquello que esté ingresando el usuario por entrada estandar, caracter por
- * caracter.
+ * Esta función se encarga de escribir en el socket el nombre del usuario
+ * (precedido por PEDIR_COMPRESION, con la opción -z), el contenido del
+ * archivo de entrada (si se indicó uno) y todo aquello que ingrese el
+ * usuario por entrada estándar, en bloques con copiar_descriptor.
+ * Al terminar la entrada se envía fue y el hilo lector termina el programa
+ * cuando el servidor se despide.
  */
  
 void escribir_socket() {
-  int c;
-  char outbuffer;
-  
-  strcat(usuario, "\n");
-  write(sockfd, usuario, strlen(usuario));
-  
-  //en este if se escribe si se ha introducido algún archivo
-  if (aflag) {
-    FILE *file;
-    char *line = NULL;
-    size_t len;
-    ssize_t read;
+    char nombre[TAMANO_BLOQUE];
+    int fd;
+
+    if (comprimir) {
+        nombre[0] = PEDIR_COMPRESION;
+        escribir_todo(nombre, 1);
+    }
+
+    snprintf(nombre, sizeof(nombre), "%s\n", usuario);
+    escribir_todo(nombre, strlen(nombre));
 
-    file = fopen(archivo, "r");
+    //en este if se escribe si se ha introducido algún archivo
+    if (aflag) {
+        fd = open(archivo, O_RDONLY);
 
-    if (file == NULL)
-        fatalerror("Error en el archivo de entrada.\n");
+        if (fd < 0)
+            fatalerror("Error en el archivo de entrada.\n");
 
-    while((read = getline(&line, &len, file)) != -1){
-        write(sockfd, line, strlen(line));
+        copiar_descriptor(fd);
+        close(fd);
     }
 
-    fclose(file);
-  }
+    copiar_descriptor(STDIN_FILENO);
 
-  while ((c = getchar()) != EOF) {
-    /*Se escriben los caracteres en el socket*/
-    outbuffer = c;
-    if (write(sockfd, &outbuffer, 1) != 1)
-      fatalerror("No se pudo escribir al socket\n");
-  }
-  salir();
+    // Se espera a que el servidor procese todo y cierre la conexión: si se
+    // cerrara el socket con respuestas sin leer, se perderían los comandos
+    // que el servidor todavía no ha leído.
+    escribir_todo("fue\n", 4);
+    shutdown(sockfd, SHUT_WR);
+    while (1)
+        pause();
+}
+
+
+/**
+ * contar_mensajes
+ *
+ * @brief Cuenta los mensajes de sala que empiezan en un bloque recibido.
+ *
+ * @param bloque Bloque recibido.
+ * @param largo Cantidad de bytes del bloque.
+ *
+ * Cada mensaje de sala empieza con "\n>> ". Como un mensaje puede quedar
+ * partido entre dos bloques, se recuerda cuántos caracteres del comienzo ya
+ * habían llegado al final del bloque anterior.
+ */
+
+void contar_mensajes(char *bloque, int largo) {
+    static const char inicio[] = "\n>> ";
+    static int parcial = 0;
+    char *fin = bloque + largo;
+
+    while (bloque < fin) {
+        if (parcial == 0) {
+            bloque = memchr(bloque, '\n', fin - bloque);
+            if (bloque == NULL)
+                return;
+            bloque++;
+            parcial = 1;
+        } else if (*bloque == inicio[parcial]) {
+            bloque++;
+            if (++parcial == sizeof(inicio) - 1) {
+                mensajes_recibidos++;
+                parcial = 0;
+            }
+        } else {
+            parcial = 0;
+        }
+    }
+}
+
+
+/**
+ * mostrar_recibido
+ *
+ * @brief Imprime (o cuenta, en modo silencioso) un bloque de lo que envió el
+ *        servidor, ya descomprimido.
+ *
+ * @param bloque Bloque recibido.
+ * @param n Cantidad de bytes del bloque.
+ *
+ * Si el bloque trae el caracter con el que se despide el servidor, se
+ * imprime lo anterior a él y se termina.
+ */
+
+void mostrar_recibido(char *bloque, int n) {
+
+    char *despedida;
+
+    despedida = memchr(bloque, (char) EOF, n);
+    if (despedida != NULL)
+        n = despedida - bloque;
+
+    if (silencioso) {
+        bytes_recibidos += n;
+        contar_mensajes(bloque, n);
+    } else {
+        fwrite(bloque, 1, n, stdout);
+        fflush(stdout);
+    }
+
+    if (despedida != NULL) {
+        imprimir_resumen();
+        printf("\n\n¡Hasta luego!\n");
+        close(sockfd);
+        exit(0);
+    }
 }
 
 
@@ -135,23 +343,43 @@ void escribir_socket() {
  * 
  * @brief Lee e imprime lo recibido del socket de comunición con el servidor.
  * 
- * Rutina que ejecuta el hilo lector.
+ * Rutina que ejecuta el hilo lector. Se lee en bloques de hasta
+ * TAMANO_BLOQUE bytes y cada bloque se pasa completo a mostrar_recibido.
+ * Con la opción -z, el primer byte dice si el servidor aceptó la
+ * compresión; si la aceptó, lo que sigue se descomprime antes de
+ * mostrarlo.
  */
 
 void *escuchar_socket() {
    
-    char inbuffer;
+    char bloque[TAMANO_BLOQUE];
+    char *datos;
+    int n, primero = comprimir;
     
     while (1) {
-        if (read(sockfd, &inbuffer, 1) == 0)
+        n = read(sockfd, bloque, TAMANO_BLOQUE);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
             fatalerror("No se pudo leer del socket.\n");
-        
-        if (inbuffer == EOF) {
-            printf("\n\n¡Hasta luego!\n");
-            close(sockfd);
-            exit(0);
+
+        datos = bloque;
+
+        if (primero) {
+            primero = 0;
+            if (bloque[0] == PEDIR_COMPRESION) {
+                datos++;
+                n--;
+            } else {
+                comprimir = 0;
+                fprintf(stderr, "El servidor no aceptó la compresión.\n");
+            }
         }
-        printf("%c", inbuffer);
+
+        if (!comprimir)
+            mostrar_recibido(datos, n);
+        else if (descomprimir(&descompresion, datos, n, mostrar_recibido))
+            fatalerror("Se recibió un bloque comprimido inválido.\n");
     }
 }
 
@@ -167,8 +395,9 @@ void *escuchar_socket() {
  * 
  * Evalúa argumentos y los asocia a variables globales, también evalúa que
  * se estén usando las opciones -n -h y -p que son obligatorios para el uso del
- * programa. De no usarse alguno de los parámetros cierra el programa e indica
- * la correcta invocación del programa.
+ * programa (-h y -p no hacen falta si se usa -x, que conecta por el socket
+ * local del servidor). De no usarse alguno de los parámetros cierra el
+ * programa e indica la correcta invocación del programa.
  */
 
 void check_invocation(int argc, char *argv[]) {
@@ -180,7 +409,7 @@ void check_invocation(int argc, char *argv[]) {
     int nflag = 0; //variable que indica si se usó el flag -n
     opterr = 0; 
     
-    while ((opt = getopt (argc, argv, "h:p:a:n:")) != -1) {
+    while ((opt = getopt (argc, argv, "h:p:a:n:qx:z")) != -1) {
         
         switch (opt) {
             case 'p':
@@ -208,6 +437,24 @@ void check_invocation(int argc, char *argv[]) {
                 archivo = optarg;
                 break;
 
+            case 'q':
+                silencioso = 1;
+                break;
+
+            case 'z':
+                comprimir = 1;
+                break;
+
+            case 'x':
+                ruta_local = optarg;
+                if (strlen(ruta_local) >=
+                    sizeof(((struct sockaddr_un *) NULL)->sun_path)) {
+                    fprintf(stderr, "La ruta del socket local es muy \
+larga.\n");
+                    exit(1);
+                }
+                break;
+
             case ':':
                 fprintf(stderr, "Opción -%c requiere un argumento.\n", optopt);
                 exit(1);
@@ -217,9 +464,9 @@ void check_invocation(int argc, char *argv[]) {
                 exit(1);
             }
     }
-    if (!(pflag) || !(hflag) || !(nflag)) {
-        fprintf(stderr, "Modo de uso: %s -h <host> -p <puerto> -n <nombre> \
-[-a <archivo>]\n", argv[0]);
+    if ((ruta_local == NULL && (!(pflag) || !(hflag))) || !(nflag)) {
+        fprintf(stderr, "Modo de uso: %s {-h <host> -p <puerto> | -x <ruta>} \
+-n <nombre> [-a <archivo>] [-q] [-z]\n", argv[0]);
         exit(0);
     }
 }
@@ -249,6 +496,7 @@ void ctrlc_handler() {
 main(int argc, char *argv[]) {
   
     struct sockaddr_in serveraddr;
+    struct sockaddr_un localaddr;
     signal(SIGINT, ctrlc_handler);
 
     /*Para recordar el nombre del programa en caso de errores*/
@@ -256,24 +504,42 @@ main(int argc, char *argv[]) {
     pthread_t hilo_escucha;
     char ip[100];
     check_invocation(argc, argv);
+
+    if (comprimir && crear_descompresor(&descompresion))
+        fatalerror("No se pudo preparar la compresión.\n");
     
-    hostname_to_ip(server, ip);
-
-    /* Para obtener la dirección del servidor*/
-    bzero(&serveraddr, sizeof(serveraddr));
-    serveraddr.sin_family = AF_INET;
-    serveraddr.sin_addr.s_addr = inet_addr(ip);
-    serveraddr.sin_port = htons(puerto);
-
-    /* Abrir el socket*/
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0)
-        fatalerror("No se pudo abrir el socket.\n");
-
-    /* Conectarse al servidor*/
-    if (connect(sockfd, (struct sockaddr *) &serveraddr,
-                sizeof(serveraddr)) < 0)
-        fatalerror("No se pudo conectar al servidor.\n");
+    if (ruta_local != NULL) {
+        /* Conectarse por el socket local del servidor (misma máquina)*/
+        bzero(&localaddr, sizeof(localaddr));
+        localaddr.sun_family = AF_UNIX;
+        strcpy(localaddr.sun_path, ruta_local);
+
+        sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (sockfd < 0)
+            fatalerror("No se pudo abrir el socket.\n");
+
+        if (connect(sockfd, (struct sockaddr *) &localaddr,
+                    sizeof(localaddr)) < 0)
+            fatalerror("No se pudo conectar al servidor.\n");
+    } else {
+        hostname_to_ip(server, ip);
+
+        /* Para obtener la dirección del servidor*/
+        bzero(&serveraddr, sizeof(serveraddr));
+        serveraddr.sin_family = AF_INET;
+        serveraddr.sin_addr.s_addr = inet_addr(ip);
+        serveraddr.sin_port = htons(puerto);
+
+        /* Abrir el socket*/
+        sockfd = socket(AF_INET, SOCK_STREAM, 0);
+        if (sockfd < 0)
+            fatalerror("No se pudo abrir el socket.\n");
+
+        /* Conectarse al servidor*/
+        if (connect(sockfd, (struct sockaddr *) &serveraddr,
+                    sizeof(serveraddr)) < 0)
+            fatalerror("No se pudo conectar al servidor.\n");
+    }
 
     printf("Hola %s, bienvenido al chat :).\n", usuario);
     printf("El largo máximo de los mensajes es 500 caracteres.\n");
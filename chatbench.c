@@ -0,0 +1,890 @@
+/**
+ * @file chatbench.c
+ * @author Luis Fernandes 10-10239 <lfernandes@ldc.usb.ve>
+ * @author Rebeca Machado 10-10406 <rebeca@ldc.usb.ve>
+ *
+ * Generador de carga para el servidor. Abre muchas conexiones simuladas
+ * contra un schat, las suscribe a un conjunto de salas y envía mensajes a
+ * una tasa fija. Al terminar muestra cuántos mensajes se entregaron por
+ * segundo y los percentiles de la latencia entre el envío de un mensaje y
+ * su recepción en cada miembro de la sala.
+ *
+ * Los clientes usan el protocolo binario, que responde cada comando con
+ * RES_OK o RES_ERROR; así se sabe cuándo terminó cada paso de la conexión
+ * (nombre, desuscribirse de la sala por defecto y suscribirse a sus salas).
+ * Cada mensaje lleva en su texto el instante en que se envió.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "errors.h"
+#include "htip.c"
+#include "buffer.c"
+#include "protocolo.c"
+
+#define MAXEVENTOS 256
+#define TAMANO_LECTURA 65536
+#define TAMANO_SALIDA 65536
+#define MAX_CARGA 1048576
+#define LARGO_MARCA 16
+#define SUBCUBETAS 64
+#define NUM_CUBETAS (2 * SUBCUBETAS + 40 * SUBCUBETAS)
+#define ESPERA_FINAL 2000000000LL
+#define MAX_CONEXIONES_PENDIENTES 4
+
+#define ESTADO_NOMBRE 0
+#define ESTADO_CREAR 1
+#define ESTADO_DES 2
+#define ESTADO_SUS 3
+#define ESTADO_LISTO 4
+
+
+//------------------------------------------------ Definición de estructuras -//
+
+/**
+ * \struct cliente
+ * \brief Struct que representa una conexión simulada.
+ */
+
+typedef struct {
+
+    /**
+     * \var fd
+     * \brief Socket no bloqueante de la conexión.
+     */
+    int fd;
+
+    /**
+     * \var estado
+     * \brief Paso de la conexión en el que está el cliente (ESTADO_*).
+     */
+    int estado;
+
+    /**
+     * \var respuestas
+     * \brief Respuestas que faltan para pasar al siguiente estado.
+     */
+    int respuestas;
+
+    /**
+     * \var salas
+     * \brief Índices de las salas a las que se suscribe el cliente.
+     */
+    int *salas;
+
+    /**
+     * \var ids
+     * \brief Identificadores en el servidor de esas mismas salas.
+     */
+    unsigned int *ids;
+
+    /**
+     * \var siguiente
+     * \brief Cantidad de mensajes enviados; indica a cuál sala va el próximo.
+     */
+    int siguiente;
+
+    /**
+     * \var entrada
+     * \brief Trama incompleta recibida del servidor.
+     */
+    buffer_entrada entrada;
+
+    /**
+     * \var salida
+     * \brief Bytes que el socket todavía no aceptó.
+     */
+    char *salida;
+
+    /**
+     * \var inicio
+     * \brief Posición del primer byte pendiente de salida.
+     */
+    int inicio;
+
+    /**
+     * \var largo
+     * \brief Posición siguiente al último byte pendiente de salida.
+     */
+    int largo;
+
+} cliente;
+
+
+//------------------------------------------------------- Variables globales -//
+
+/**
+ * \var server
+ * \brief Servidor contra el que se hace la prueba (opción -h).
+ */
+char *server = "127.0.0.1";
+
+/**
+ * \var puerto
+ * \brief Puerto del servidor (opción -p).
+ */
+int puerto = 0;
+
+/**
+ * \var num_clientes
+ * \brief Cantidad de conexiones simuladas (opción -c).
+ */
+int num_clientes = 100;
+
+/**
+ * \var num_salas
+ * \brief Cantidad de salas de la prueba (opción -s).
+ */
+int num_salas = 10;
+
+/**
+ * \var salas_por_cliente
+ * \brief Cantidad de salas a las que se suscribe cada cliente (opción -k).
+ */
+int salas_por_cliente = 1;
+
+/**
+ * \var zipf
+ * \brief Exponente de la distribución de las suscripciones (opción -z).
+ *
+ * Con 0 todas las salas son igual de probables; con valores mayores, las
+ * primeras salas concentran más miembros.
+ */
+double zipf = 0;
+
+/**
+ * \var tasa
+ * \brief Mensajes por segundo que envía cada cliente (opción -m).
+ */
+double tasa = 10;
+
+/**
+ * \var largo_mensaje
+ * \brief Largo del texto de cada mensaje (opción -l).
+ */
+int largo_mensaje = 64;
+
+/**
+ * \var duracion
+ * \brief Segundos durante los que se envían mensajes (opción -t).
+ */
+int duracion = 10;
+
+/**
+ * \var json
+ * \brief Indica si el resultado se muestra en JSON (opción -j).
+ */
+int json = 0;
+
+/**
+ * \var clientes
+ * \brief Arreglo con las num_clientes conexiones simuladas.
+ */
+cliente *clientes;
+
+/**
+ * \var control
+ * \brief Conexión que crea las salas antes de la prueba.
+ */
+cliente control;
+
+/**
+ * \var miembros
+ * \brief Cantidad de clientes suscritos a cada sala.
+ */
+int *miembros;
+
+/**
+ * \var epfd
+ * \brief Descriptor de epoll con todas las conexiones.
+ */
+int epfd;
+
+/**
+ * \var listos
+ * \brief Cantidad de clientes que ya terminaron de conectarse.
+ */
+int listos = 0;
+
+/**
+ * \var sin_nombre
+ * \brief Cantidad de clientes conectados cuyo nombre no se ha confirmado.
+ */
+int sin_nombre = 0;
+
+/**
+ * \var midiendo
+ * \brief Indica si las latencias recibidas se cuentan en el histograma.
+ */
+int midiendo = 0;
+
+/**
+ * \var enviados
+ * \brief Cantidad de mensajes enviados.
+ */
+long long enviados = 0;
+
+/**
+ * \var omitidos
+ * \brief Mensajes que no se enviaron porque el socket no aceptaba más.
+ */
+long long omitidos = 0;
+
+/**
+ * \var esperados
+ * \brief Cantidad de entregas esperadas (un mensaje por cada miembro).
+ */
+long long esperados = 0;
+
+/**
+ * \var entregados
+ * \brief Cantidad de mensajes recibidos durante la medición.
+ */
+long long entregados = 0;
+
+/**
+ * \var histograma
+ * \brief Cantidad de latencias (en microsegundos) por cubeta.
+ *
+ * Las cubetas son log-lineales: los valores menores que 2 * SUBCUBETAS
+ * tienen una cubeta cada uno, y cada potencia de dos posterior se divide en
+ * SUBCUBETAS cubetas, de manera que el error es menor que 1/SUBCUBETAS.
+ */
+long long histograma[NUM_CUBETAS];
+
+/**
+ * \var latencia_maxima
+ * \brief Mayor latencia medida, en microsegundos.
+ */
+long long latencia_maxima = 0;
+
+
+//------------------------------------------------------------------ Métodos -//
+
+/**
+ * ahora
+ *
+ * @brief Devuelve el tiempo del reloj monótono.
+ * @return Nanosegundos.
+ */
+
+long long ahora() {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long) t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+
+/**
+ * cubeta
+ *
+ * @brief Calcula la cubeta del histograma de una latencia.
+ * @param v Latencia en microsegundos.
+ * @return Índice de la cubeta.
+ */
+
+int cubeta(unsigned long long v) {
+    int bits, desplazamiento, i;
+
+    if (v < 2 * SUBCUBETAS)
+        return v;
+
+    bits = 63 - __builtin_clzll(v);
+    desplazamiento = bits - 6;
+    i = 2 * SUBCUBETAS + (desplazamiento - 1) * SUBCUBETAS +
+        (int) (v >> desplazamiento) - SUBCUBETAS;
+    return i < NUM_CUBETAS ? i : NUM_CUBETAS - 1;
+}
+
+
+/**
+ * limite_cubeta
+ *
+ * @brief Calcula el mayor valor que cae en una cubeta del histograma.
+ * @param i Índice de la cubeta.
+ * @return Latencia en microsegundos.
+ */
+
+long long limite_cubeta(int i) {
+    int desplazamiento;
+
+    if (i < 2 * SUBCUBETAS)
+        return i;
+
+    desplazamiento = (i - 2 * SUBCUBETAS) / SUBCUBETAS + 1;
+    return ((long long) ((i - 2 * SUBCUBETAS) % SUBCUBETAS + SUBCUBETAS + 1)
+            << desplazamiento) - 1;
+}
+
+
+/**
+ * percentil
+ *
+ * @brief Calcula un percentil de las latencias medidas.
+ * @param p Fracción del percentil (por ejemplo 0.99).
+ * @return Latencia en microsegundos.
+ */
+
+long long percentil(double p) {
+    long long total = 0, objetivo, acumulado = 0;
+    int i;
+
+    for (i = 0; i < NUM_CUBETAS; i++)
+        total += histograma[i];
+    if (total == 0)
+        return 0;
+
+    objetivo = (long long) ceil(p * total);
+    for (i = 0; i < NUM_CUBETAS; i++) {
+        acumulado += histograma[i];
+        if (acumulado >= objetivo)
+            break;
+    }
+    if (limite_cubeta(i) > latencia_maxima)
+        return latencia_maxima;
+    return limite_cubeta(i);
+}
+
+
+/**
+ * vaciar_salida
+ *
+ * @brief Escribe lo que acepte el socket de la salida pendiente de un cliente.
+ * @param c Cliente cuya salida se escribe.
+ */
+
+void vaciar_salida(cliente *c) {
+    int n;
+
+    while (c->inicio < c->largo) {
+        n = send(c->fd, c->salida + c->inicio, c->largo - c->inicio,
+                 MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            fatalerror("No se pudo escribir al socket.\n");
+        }
+        c->inicio += n;
+    }
+    c->inicio = 0;
+    c->largo = 0;
+}
+
+
+/**
+ * reservar_trama
+ *
+ * @brief Agrega la cabecera de una trama a la salida de un cliente.
+ * @param c Cliente que envía la trama.
+ * @param op Código de operación.
+ * @param id Identificador de la sala (0 si no aplica).
+ * @param largo_carga Cantidad de bytes de la carga.
+ * @return Posición de la carga en la salida, o NULL si no cabía.
+ *
+ * Quien llama escribe la carga en la posición devuelta antes de llamar a
+ * vaciar_salida.
+ */
+
+char *reservar_trama(cliente *c, int op, unsigned int id, int largo_carga) {
+    char *destino;
+
+    if (c->largo == 0)
+        c->inicio = 0;
+    if (c->largo + TAMANO_CABECERA + largo_carga > TAMANO_SALIDA)
+        return NULL;
+
+    destino = c->salida + c->largo;
+    escribir_cabecera(destino, op, id, largo_carga);
+    c->largo += TAMANO_CABECERA + largo_carga;
+    return destino + TAMANO_CABECERA;
+}
+
+
+/**
+ * enviar_trama
+ *
+ * @brief Envía una trama con un texto como carga.
+ * @param c Cliente que envía la trama.
+ * @param op Código de operación.
+ * @param texto Carga de la trama.
+ */
+
+void enviar_trama(cliente *c, int op, char *texto) {
+    char *carga = reservar_trama(c, op, 0, strlen(texto));
+
+    if (carga == NULL)
+        fatalerror("No cabe la trama en la salida del cliente.\n");
+    memcpy(carga, texto, strlen(texto));
+    vaciar_salida(c);
+}
+
+
+/**
+ * enviar_mensaje
+ *
+ * @brief Envía un mensaje de prueba a la siguiente sala de un cliente.
+ * @param c Cliente que envía el mensaje.
+ *
+ * El texto empieza con el instante del envío en hexadecimal y se completa
+ * hasta largo_mensaje caracteres. Si el socket tiene demasiado pendiente, el
+ * mensaje se omite.
+ */
+
+void enviar_mensaje(cliente *c) {
+    int j = c->siguiente % salas_por_cliente;
+    char *carga;
+    char marca[LARGO_MARCA + 1];
+
+    carga = reservar_trama(c, OP_MENSAJE, c->ids[j], largo_mensaje);
+    if (carga == NULL) {
+        omitidos++;
+        return;
+    }
+
+    c->siguiente++;
+    snprintf(marca, sizeof(marca), "%016llx", ahora());
+    memcpy(carga, marca, LARGO_MARCA);
+    memset(carga + LARGO_MARCA, 'x', largo_mensaje - LARGO_MARCA);
+
+    enviados++;
+    esperados += miembros[c->salas[j]];
+    vaciar_salida(c);
+}
+
+
+/**
+ * avanzar
+ *
+ * @brief Pasa un cliente al siguiente paso de la conexión.
+ * @param c Cliente que recibió todas las respuestas del paso actual.
+ */
+
+void avanzar(cliente *c) {
+    char nombre[32];
+    int j;
+
+    switch (c->estado) {
+        case ESTADO_NOMBRE:
+            sin_nombre--;
+            if (c == &control) {
+                c->estado = ESTADO_CREAR;
+                c->respuestas = num_salas;
+                for (j = 0; j < num_salas; j++) {
+                    snprintf(nombre, sizeof(nombre), "banco%d", j);
+                    enviar_trama(c, OP_CREAR, nombre);
+                }
+            } else {
+                c->estado = ESTADO_DES;
+                c->respuestas = 1;
+                enviar_trama(c, OP_DESUSCRIBIR, "");
+            }
+            break;
+        case ESTADO_DES:
+            c->estado = ESTADO_SUS;
+            c->respuestas = salas_por_cliente;
+            for (j = 0; j < salas_por_cliente; j++) {
+                snprintf(nombre, sizeof(nombre), "banco%d", c->salas[j]);
+                enviar_trama(c, OP_SUSCRIBIR, nombre);
+            }
+            break;
+        default:
+            c->estado = ESTADO_LISTO;
+            listos++;
+            break;
+    }
+}
+
+
+/**
+ * procesar_respuesta
+ *
+ * @brief Procesa una trama recibida por un cliente.
+ *
+ * @param contexto Cliente que recibe la trama.
+ * @param op Código de operación de la trama.
+ * @param id Identificador que trae la trama.
+ * @param carga Carga de la trama, terminada en un caracter nulo.
+ * @param largo Cantidad de bytes de la carga.
+ * @return Siempre 0.
+ *
+ * Los mensajes de sala se cuentan y se mide su latencia; las demás
+ * respuestas hacen avanzar la conexión del cliente.
+ */
+
+int procesar_respuesta(void *contexto, int op, unsigned int id, char *carga,
+                       int largo) {
+    cliente *c = (cliente *) contexto;
+    char *texto, *fin = carga + largo;
+    long long latencia;
+    int j, sala;
+
+    if (op == RES_MENSAJE) {
+        texto = memchr(carga, '\0', largo);
+        if (texto != NULL)
+            texto = memchr(texto + 1, '\0', fin - texto - 1);
+        if (texto == NULL || fin - texto - 1 < LARGO_MARCA || !midiendo)
+            return 0;
+
+        latencia = (ahora() - (long long) strtoull(texto + 1, NULL, 16))
+                   / 1000;
+        if (latencia < 0)
+            latencia = 0;
+        if (latencia > latencia_maxima)
+            latencia_maxima = latencia;
+        histograma[cubeta(latencia)]++;
+        entregados++;
+        return 0;
+    }
+
+    if (op != RES_OK && op != RES_ERROR)
+        return 0;
+
+    if (c->estado == ESTADO_SUS) {
+        if (op == RES_ERROR || sscanf(carga, "banco%d", &sala) != 1)
+            fatalerror("No se pudo suscribir un cliente a su sala.\n");
+        for (j = 0; j < salas_por_cliente; j++)
+            if (c->salas[j] == sala)
+                c->ids[j] = id;
+    }
+
+    if (--c->respuestas == 0)
+        avanzar(c);
+    return 0;
+}
+
+
+/**
+ * atender_eventos
+ *
+ * @brief Atiende los eventos de las conexiones durante un tiempo.
+ * @param espera Milisegundos que se espera como máximo por un evento.
+ */
+
+void atender_eventos(int espera) {
+    static char lectura[TAMANO_LECTURA + 1];
+    struct epoll_event eventos[MAXEVENTOS];
+    cliente *c;
+    int n, i, leido;
+
+    n = epoll_wait(epfd, eventos, MAXEVENTOS, espera);
+
+    for (i = 0; i < n; i++) {
+        c = (cliente *) eventos[i].data.ptr;
+
+        if (eventos[i].events & EPOLLOUT)
+            vaciar_salida(c);
+
+        if (eventos[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+            leido = recv(c->fd, lectura, TAMANO_LECTURA, 0);
+            if (leido < 0 && (errno == EAGAIN || errno == EINTR))
+                continue;
+            if (leido <= 0)
+                fatalerror("El servidor cerró una conexión.\n");
+            if (separar_tramas(&c->entrada, lectura, leido, MAX_CARGA,
+                               procesar_respuesta, c) < 0)
+                fatalerror("El servidor envió una trama inválida.\n");
+        }
+    }
+}
+
+
+/**
+ * conectar
+ *
+ * @brief Abre la conexión de un cliente y le envía su nombre.
+ * @param c Cliente que se conecta.
+ * @param direccion Dirección del servidor.
+ * @param nombre Nombre del cliente.
+ */
+
+void conectar(cliente *c, struct sockaddr_in *direccion, char *nombre) {
+    struct epoll_event ev;
+    int uno = 1;
+
+    c->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (c->fd < 0)
+        fatalerror("No se pudo abrir el socket.\n");
+
+    if (connect(c->fd, (struct sockaddr *) direccion,
+                sizeof(*direccion)) < 0)
+        fatalerror("No se pudo conectar al servidor.\n");
+
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &uno, sizeof(uno));
+    fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL, 0) | O_NONBLOCK);
+
+    c->estado = ESTADO_NOMBRE;
+    c->respuestas = 2; // el nombre y la sala por defecto
+    c->siguiente = 0;
+    c->inicio = 0;
+    c->largo = 0;
+    crear_buffer(&c->entrada);
+    c->salida = malloc(TAMANO_SALIDA);
+    if (c->salida == NULL)
+        fatalerror("No se puede asignar memoria.\n");
+
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.ptr = c;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0)
+        fatalerror("No se pudo agregar el socket a epoll.\n");
+
+    c->salida[0] = PROTOCOLO_BINARIO;
+    c->largo = 1;
+    enviar_trama(c, OP_NOMBRE, nombre);
+    sin_nombre++;
+}
+
+
+/**
+ * elegir_salas
+ *
+ * @brief Elige las salas de cada cliente según la distribución pedida.
+ *
+ * Cada cliente se suscribe a salas_por_cliente salas distintas. La sala i
+ * tiene un peso 1 / (i + 1)^zipf. La semilla es fija, así que dos corridas
+ * con las mismas opciones reparten igual.
+ */
+
+void elegir_salas() {
+    double *acumulado, total = 0, r;
+    int i, j, m, sala;
+
+    acumulado = malloc(num_salas * sizeof(double));
+    miembros = calloc(num_salas, sizeof(int));
+    if (acumulado == NULL || miembros == NULL)
+        fatalerror("No se puede asignar memoria.\n");
+
+    for (i = 0; i < num_salas; i++) {
+        total += 1 / pow(i + 1, zipf);
+        acumulado[i] = total;
+    }
+
+    srand(1);
+    for (i = 0; i < num_clientes; i++) {
+        clientes[i].salas = malloc(salas_por_cliente * sizeof(int));
+        clientes[i].ids = malloc(salas_por_cliente * sizeof(unsigned int));
+        if (clientes[i].salas == NULL || clientes[i].ids == NULL)
+            fatalerror("No se puede asignar memoria.\n");
+
+        for (j = 0; j < salas_por_cliente; ) {
+            r = total * rand() / ((double) RAND_MAX + 1);
+            for (sala = 0; sala < num_salas - 1 && acumulado[sala] <= r;
+                 sala++)
+                ;
+            for (m = 0; m < j && clientes[i].salas[m] != sala; m++)
+                ;
+            if (m < j)
+                continue;
+            clientes[i].salas[j++] = sala;
+            miembros[sala]++;
+        }
+    }
+    free(acumulado);
+}
+
+
+/**
+ * mostrar_resultado
+ *
+ * @brief Muestra el resultado de la prueba.
+ * @param segundos Duración de la medición, incluida la espera final.
+ */
+
+void mostrar_resultado(double segundos) {
+    long long p50 = percentil(0.5), p99 = percentil(0.99),
+              p999 = percentil(0.999);
+
+    if (json) {
+        printf("{\"clientes\": %d, \"salas\": %d, \"salas_por_cliente\": %d, "
+               "\"zipf\": %g, \"tasa\": %g, \"largo\": %d, \"duracion\": %d, "
+               "\"enviados\": %lld, \"omitidos\": %lld, \"esperados\": %lld, "
+               "\"entregados\": %lld, \"entregados_por_segundo\": %.1f, "
+               "\"p50_us\": %lld, \"p99_us\": %lld, \"p999_us\": %lld, "
+               "\"max_us\": %lld}\n", num_clientes, num_salas,
+               salas_por_cliente, zipf, tasa, largo_mensaje, duracion,
+               enviados, omitidos, esperados, entregados,
+               entregados / segundos, p50, p99, p999, latencia_maxima);
+        return;
+    }
+
+    printf("Clientes: %d, salas: %d (%d por cliente, zipf %g)\n",
+           num_clientes, num_salas, salas_por_cliente, zipf);
+    printf("Enviados: %lld (%lld omitidos), a %g por cliente por segundo\n",
+           enviados, omitidos, tasa);
+    printf("Entregados: %lld de %lld esperados, %.1f por segundo\n",
+           entregados, esperados, entregados / segundos);
+    printf("Latencia (us): p50 %lld, p99 %lld, p999 %lld, máxima %lld\n",
+           p50, p99, p999, latencia_maxima);
+}
+
+
+/**
+ * check_invocation
+ *
+ * @brief Evalúa los parámetros introducidos por la invocación del programa.
+ *
+ * @param argc Cantidad de argumentos introducidos.
+ * @param *argv Apuntador a cadena de caracteres que contiene los argumentos
+ *              introducidos.
+ */
+
+void check_invocation(int argc, char *argv[]) {
+
+    int opt;
+    opterr = 0;
+
+    while ((opt = getopt(argc, argv, "h:p:c:s:k:z:m:l:t:j")) != -1) {
+
+        switch (opt) {
+            case 'h':
+                server = optarg;
+                break;
+            case 'p':
+                puerto = atoi(optarg);
+                break;
+            case 'c':
+                num_clientes = atoi(optarg);
+                break;
+            case 's':
+                num_salas = atoi(optarg);
+                break;
+            case 'k':
+                salas_por_cliente = atoi(optarg);
+                break;
+            case 'z':
+                zipf = atof(optarg);
+                break;
+            case 'm':
+                tasa = atof(optarg);
+                break;
+            case 'l':
+                largo_mensaje = atoi(optarg);
+                break;
+            case 't':
+                duracion = atoi(optarg);
+                break;
+            case 'j':
+                json = 1;
+                break;
+            default:
+                fprintf(stderr, "Opción desconocida '-%c'.\n", optopt);
+                exit(1);
+        }
+    }
+
+    if (puerto < 1024 || puerto > 65535 || num_clientes < 1 ||
+        num_salas < 1 || salas_por_cliente < 1 ||
+        salas_por_cliente > num_salas || zipf < 0 || tasa <= 0 ||
+        largo_mensaje < LARGO_MARCA || largo_mensaje > TAMANO_SALIDA / 2 ||
+        duracion < 1) {
+        fprintf(stderr, "Modo de uso: %s -p <puerto> [-h <host>] \
+[-c <clientes>] [-s <salas>]\n       [-k <salas por cliente>] [-z <zipf>] \
+[-m <mensajes por segundo>]\n       [-l <largo>] [-t <segundos>] [-j]\n",
+                argv[0]);
+        exit(1);
+    }
+}
+
+
+//------------------------------------------------------- Programa principal -//
+
+/**
+ * main
+ *
+ * @brief Programa principal.
+ *
+ * Crea las salas, conecta a todos los clientes y espera a que terminen de
+ * suscribirse. Luego envía mensajes durante duracion segundos, repartidos
+ * entre los clientes para mantener la tasa pedida, y espera a que se
+ * entreguen los que faltan (o a que pasen dos segundos sin entregas).
+ */
+
+int main(int argc, char *argv[]) {
+
+    struct sockaddr_in direccion;
+    struct rlimit limite;
+    char ip[100], nombre[32];
+    long long inicio, fin, deberian, ultima_entrega, previos;
+    int i, turno = 0;
+
+    programname = argv[0];
+    check_invocation(argc, argv);
+
+    // Cada cliente necesita un descriptor
+    if (getrlimit(RLIMIT_NOFILE, &limite) == 0 &&
+        limite.rlim_cur < limite.rlim_max) {
+        limite.rlim_cur = limite.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limite);
+    }
+
+    if (hostname_to_ip(server, ip))
+        fatalerror("No se pudo resolver el servidor.\n");
+
+    bzero(&direccion, sizeof(direccion));
+    direccion.sin_family = AF_INET;
+    direccion.sin_addr.s_addr = inet_addr(ip);
+    direccion.sin_port = htons(puerto);
+
+    epfd = epoll_create1(0);
+    clientes = calloc(num_clientes, sizeof(cliente));
+    if (epfd < 0 || clientes == NULL)
+        fatalerror("No se pudo preparar la prueba.\n");
+
+    elegir_salas();
+
+    snprintf(nombre, sizeof(nombre), "banco%d", (int) getpid());
+    conectar(&control, &direccion, nombre);
+    while (control.estado != ESTADO_LISTO)
+        atender_eventos(100);
+    listos = 0;
+
+    // Las conexiones se abren de a pocas: connect termina antes de que el
+    // servidor haga accept, y si se llena su cola de conexiones pendientes
+    // el sistema descarta las siguientes y el cliente tarda en reintentar.
+    for (i = 0; i < num_clientes; i++) {
+        while (sin_nombre >= MAX_CONEXIONES_PENDIENTES)
+            atender_eventos(1);
+        snprintf(nombre, sizeof(nombre), "b%d-%d", (int) getpid(), i);
+        conectar(&clientes[i], &direccion, nombre);
+    }
+    while (listos < num_clientes)
+        atender_eventos(100);
+
+    midiendo = 1;
+    inicio = ahora();
+    fin = inicio + duracion * 1000000000LL;
+
+    while (ahora() < fin) {
+        deberian = (long long) ((ahora() - inicio) / 1e9 * tasa *
+                                num_clientes);
+        while (enviados + omitidos < deberian)
+            enviar_mensaje(&clientes[turno++ % num_clientes]);
+        atender_eventos(1);
+    }
+
+    ultima_entrega = ahora();
+    while (entregados < esperados && ahora() - ultima_entrega < ESPERA_FINAL) {
+        previos = entregados;
+        atender_eventos(10);
+        if (entregados > previos)
+            ultima_entrega = ahora();
+    }
+
+    mostrar_resultado((ahora() - inicio) / 1e9);
+    return 0;
+}
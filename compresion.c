@@ -0,0 +1,268 @@
+/**
+ * @file compresion.c
+ * @author Luis Fernandes 10-10239 <lfernandes@ldc.usb.ve>
+ * @author Rebeca Machado 10-10406 <rebeca@ldc.usb.ve>
+ *
+ * Funciones para comprimir la salida del servidor (con zlib).
+ *
+ * Un cliente pide la compresión enviando el byte PEDIR_COMPRESION antes que
+ * nada: antes de su nombre o, si usa el protocolo binario, antes de
+ * PROTOCOLO_BINARIO. El servidor la acepta respondiendo con ese mismo byte,
+ * y desde ahí todo lo que escribe en la conexión son bloques con este
+ * formato:
+ *
+ *   largo   4 bytes      bytes comprimidos que siguen (en orden de red)
+ *   datos   largo bytes  deflate sin cabecera, con DICCIONARIO_COMPRESION
+ *                        como diccionario inicial
+ *
+ * Cada bloque se comprime por separado, sin depender de los anteriores, así
+ * que el mismo bloque sirve para todas las conexiones comprimidas: un mensaje
+ * de sala se comprime una sola vez aunque lo reciban muchos miembros. El
+ * diccionario tiene el formato que más se repite en la salida, de manera que
+ * aún los mensajes cortos se compriman. Lo que envía el cliente no se
+ * comprime.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+#include <zlib.h>
+
+#define PEDIR_COMPRESION 0x01
+#define TAMANO_CABECERA_BLOQUE 4
+#define TAMANO_DESCOMPRESION 65536
+
+/**
+ * \var DICCIONARIO_COMPRESION
+ * \brief Diccionario inicial de cada bloque comprimido.
+ *
+ * deflate encuentra con menos bytes lo que está al final del diccionario, así
+ * que lo más frecuente (el comienzo de un mensaje de sala) va de último.
+ */
+static const char DICCIONARIO_COMPRESION[] =
+    "\nLISTA DE SALAS SUSCRITAS\n========================\n"
+    "\nLISTA DE USUARIOS DEL SISTEMA\n=============================\n"
+    "\nLISTA DE SALAS DEL SISTEMA\n==========================\n"
+    "\"actual\"\n\n\n>> @actual: \n\n>> ";
+
+
+/**
+ * \struct descompresor
+ * \brief Struct con el estado para descomprimir lo que llega de una conexión
+ *        comprimida.
+ */
+
+typedef struct {
+
+    /**
+     * @var flujo
+     * @brief Estado de zlib, que se reinicia en cada bloque.
+     */
+    z_stream flujo;
+
+    /**
+     * @var datos
+     * @brief Bytes recibidos que todavía no forman un bloque completo.
+     */
+    char *datos;
+
+    /**
+     * @var largo
+     * @brief Cantidad de bytes en datos.
+     */
+    int largo;
+
+    /**
+     * @var capacidad
+     * @brief Tamaño de datos.
+     */
+    int capacidad;
+
+} descompresor;
+
+
+/**
+ * \var compresor_local
+ * \brief Estado de zlib del hilo actual para comprimir (NULL hasta que lo
+ *        use).
+ *
+ * Crear el estado de deflate cuesta bastante más que comprimir un mensaje
+ * corto, así que cada hilo crea el suyo una sola vez y lo reinicia en cada
+ * bloque.
+ */
+__thread z_stream *compresor_local = NULL;
+
+
+/**
+ * cota_bloque
+ *
+ * @brief Calcula cuántos bytes puede ocupar, como máximo, un bloque
+ *        comprimido.
+ * @param largo Cantidad de bytes sin comprimir.
+ * @return Cantidad máxima de bytes del bloque, incluida su cabecera.
+ */
+
+int cota_bloque(int largo) {
+    return TAMANO_CABECERA_BLOQUE + compressBound(largo);
+}
+
+
+/**
+ * comprimir_bloque
+ *
+ * @brief Comprime un texto en un bloque independiente.
+ * @param datos Texto a comprimir.
+ * @param largo Cantidad de bytes del texto.
+ * @param destino Donde se escribe el bloque, con espacio para al menos
+ *                cota_bloque(largo) bytes.
+ * @return Cantidad de bytes del bloque, incluida su cabecera, o -1 si no se
+ *         pudo comprimir.
+ */
+
+int comprimir_bloque(char *datos, int largo, char *destino) {
+    z_stream *z = compresor_local;
+    uint32_t cabecera;
+    int comprimido;
+
+    if (z == NULL) {
+        z = calloc(1, sizeof(z_stream));
+        if (z == NULL)
+            return -1;
+        if (deflateInit2(z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+                         Z_DEFAULT_STRATEGY) != Z_OK) {
+            free(z);
+            return -1;
+        }
+        compresor_local = z;
+    } else if (deflateReset(z) != Z_OK) {
+        return -1;
+    }
+
+    if (deflateSetDictionary(z, (const Bytef *) DICCIONARIO_COMPRESION,
+                             sizeof(DICCIONARIO_COMPRESION) - 1) != Z_OK)
+        return -1;
+
+    z->next_in = (Bytef *) datos;
+    z->avail_in = largo;
+    z->next_out = (Bytef *) destino + TAMANO_CABECERA_BLOQUE;
+    z->avail_out = cota_bloque(largo) - TAMANO_CABECERA_BLOQUE;
+
+    if (deflate(z, Z_FINISH) != Z_STREAM_END)
+        return -1;
+
+    comprimido = cota_bloque(largo) - TAMANO_CABECERA_BLOQUE - z->avail_out;
+    cabecera = htonl(comprimido);
+    memcpy(destino, &cabecera, TAMANO_CABECERA_BLOQUE);
+    return TAMANO_CABECERA_BLOQUE + comprimido;
+}
+
+
+/**
+ * crear_descompresor
+ *
+ * @brief Inicializa un descompresor sin datos pendientes.
+ * @param d Descompresor a inicializar.
+ * @return 0 si se pudo inicializar, 1 si no.
+ */
+
+int crear_descompresor(descompresor *d) {
+    memset(d, 0, sizeof(descompresor));
+    return inflateInit2(&d->flujo, -MAX_WBITS) != Z_OK;
+}
+
+
+/**
+ * descomprimir_bloque
+ *
+ * @brief Descomprime un bloque completo.
+ * @param d Descompresor.
+ * @param datos Datos comprimidos del bloque (sin su cabecera).
+ * @param largo Cantidad de bytes comprimidos.
+ * @param salida Función a la que se le pasa el texto descomprimido, en
+ *               pedazos de hasta TAMANO_DESCOMPRESION bytes.
+ * @return 0 si se pudo descomprimir, -1 si el bloque no es válido.
+ */
+
+int descomprimir_bloque(descompresor *d, char *datos, int largo,
+                        void (*salida)(char *, int)) {
+    char texto[TAMANO_DESCOMPRESION];
+    z_stream *z = &d->flujo;
+    int estado;
+
+    if (inflateReset(z) != Z_OK ||
+        inflateSetDictionary(z, (const Bytef *) DICCIONARIO_COMPRESION,
+                             sizeof(DICCIONARIO_COMPRESION) - 1) != Z_OK)
+        return -1;
+
+    z->next_in = (Bytef *) datos;
+    z->avail_in = largo;
+
+    do {
+        z->next_out = (Bytef *) texto;
+        z->avail_out = sizeof(texto);
+        estado = inflate(z, Z_NO_FLUSH);
+        if (estado != Z_OK && estado != Z_STREAM_END)
+            return -1;
+        if (sizeof(texto) - z->avail_out > 0)
+            salida(texto, sizeof(texto) - z->avail_out);
+    } while (estado != Z_STREAM_END && (z->avail_in > 0 ||
+                                        z->avail_out == 0));
+
+    return (estado == Z_STREAM_END) ? 0 : -1;
+}
+
+
+/**
+ * descomprimir
+ *
+ * @brief Descomprime los bloques completos que haya entre lo recibido.
+ * @param d Descompresor de la conexión.
+ * @param datos Bytes recibidos.
+ * @param largo Cantidad de bytes recibidos.
+ * @param salida Función a la que se le pasa el texto descomprimido.
+ * @return 0 si todo se pudo descomprimir, -1 si llegó un bloque inválido o
+ *         no hubo memoria.
+ *
+ * Un bloque puede llegar partido en varias lecturas: lo que no alcanza a
+ * formar un bloque completo se guarda hasta la próxima.
+ */
+
+int descomprimir(descompresor *d, char *datos, int largo,
+                 void (*salida)(char *, int)) {
+    uint32_t cabecera;
+    char *aux;
+    int pos = 0, bloque, capacidad;
+
+    if (d->largo + largo > d->capacidad) {
+        capacidad = d->capacidad > 0 ? d->capacidad * 2 : 4096;
+        while (capacidad < d->largo + largo)
+            capacidad *= 2;
+        aux = realloc(d->datos, capacidad);
+        if (aux == NULL)
+            return -1;
+        d->datos = aux;
+        d->capacidad = capacidad;
+    }
+
+    memcpy(d->datos + d->largo, datos, largo);
+    d->largo += largo;
+
+    while (d->largo - pos >= TAMANO_CABECERA_BLOQUE) {
+        memcpy(&cabecera, d->datos + pos, TAMANO_CABECERA_BLOQUE);
+        bloque = ntohl(cabecera);
+        if (bloque < 0)
+            return -1;
+        if (d->largo - pos - TAMANO_CABECERA_BLOQUE < bloque)
+            break;
+        if (descomprimir_bloque(d, d->datos + pos + TAMANO_CABECERA_BLOQUE,
+                                bloque, salida))
+            return -1;
+        pos += TAMANO_CABECERA_BLOQUE + bloque;
+    }
+
+    memmove(d->datos, d->datos + pos, d->largo - pos);
+    d->largo -= pos;
+    return 0;
+}
@@ -0,0 +1,466 @@
+/**
+ * @file envio.c
+ * @author Luis Fernandes 10-10239 <lfernandes@ldc.usb.ve>
+ * @author Rebeca Machado 10-10406 <rebeca@ldc.usb.ve>
+ *
+ * Funciones para el manejo de la cola de salida de una conexión y de los
+ * mensajes que se comparten entre varias colas. Los bytes escritos se
+ * cuentan en las métricas del hilo (metricas.c). Las conexiones comprimidas
+ * reciben la versión comprimida de cada mensaje (compresion.c), que también
+ * se comparte.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+#define MAX_BLOQUES_ESCRITURA 1024
+
+
+/**
+ * \struct mensaje
+ * \brief Struct que representa un texto ya formateado e inmutable.
+ *
+ * Un mismo mensaje puede estar en las colas de salida de muchas conexiones
+ * (por ejemplo, todos los miembros de una sala). Se libera cuando se suelta
+ * su última referencia, es decir, cuando la última cola termina de escribirlo
+ * o lo descarta.
+ */
+
+typedef struct mensaje {
+
+    /**
+     * @var referencias
+     * @brief Cantidad de colas (o hilos) que usan el mensaje.
+     */
+    int referencias;
+
+    /**
+     * @var largo
+     * @brief Cantidad de bytes del texto.
+     */
+    int largo;
+
+    /**
+     * @var datos
+     * @brief Texto del mensaje (reservado junto con el struct).
+     */
+    char *datos;
+
+    /**
+     * @var comprimido
+     * @brief Bloque comprimido con el mismo texto (NULL hasta que alguna
+     *        conexión comprimida lo necesite). Se libera con el mensaje.
+     */
+    struct mensaje *comprimido;
+
+} mensaje;
+
+
+/**
+ * \struct bloque
+ * \brief Struct que representa un mensaje pendiente por escribir en un socket.
+ */
+
+typedef struct bloque {
+
+    /**
+     * @var men
+     * @brief Mensaje a escribir (la cola tiene una referencia).
+     */
+    mensaje *men;
+
+    /**
+     * @var sig
+     * @brief Siguiente bloque de la cola.
+     */
+    struct bloque *sig;
+
+} bloque;
+
+
+/**
+ * \struct cola_envio
+ * \brief Struct que representa la cola de salida de una conexión.
+ */
+
+typedef struct {
+
+    /**
+     * @var primero
+     * @brief Bloque más antiguo (el que se está escribiendo).
+     */
+    bloque *primero;
+
+    /**
+     * @var ultimo
+     * @brief Bloque más reciente.
+     */
+    bloque *ultimo;
+
+    /**
+     * @var enviado
+     * @brief Bytes del primer bloque que ya se escribieron.
+     */
+    int enviado;
+
+    /**
+     * @var bytes
+     * @brief Bytes pendientes en toda la cola.
+     */
+    int bytes;
+
+} cola_envio;
+
+
+/**
+ * crear_mensaje
+ *
+ * @brief Crea un mensaje con una referencia.
+ * @param largo Cantidad de bytes del texto.
+ * @return El mensaje, o NULL si no se pudo asignar memoria.
+ *
+ * El texto queda sin inicializar: quien crea el mensaje lo escribe en datos
+ * antes de compartirlo. A partir de ese momento no se modifica más.
+ */
+
+mensaje *crear_mensaje(int largo) {
+    mensaje *nuevo = malloc(sizeof(mensaje) + largo);
+
+    if (nuevo == NULL)
+        return NULL;
+
+    nuevo->referencias = 1;
+    nuevo->largo = largo;
+    nuevo->datos = (char *) (nuevo + 1);
+    nuevo->comprimido = NULL;
+    return nuevo;
+}
+
+
+/**
+ * retener_mensaje
+ *
+ * @brief Agrega una referencia a un mensaje.
+ * @param m Mensaje a retener.
+ */
+
+void retener_mensaje(mensaje *m) {
+    __sync_fetch_and_add(&m->referencias, 1);
+}
+
+
+/**
+ * soltar_mensaje
+ *
+ * @brief Suelta una referencia a un mensaje y lo libera si era la última.
+ * @param m Mensaje a soltar.
+ */
+
+void soltar_mensaje(mensaje *m) {
+    if (__sync_sub_and_fetch(&m->referencias, 1) == 0) {
+        if (m->comprimido != NULL)
+            soltar_mensaje(m->comprimido);
+        free(m);
+    }
+}
+
+
+/**
+ * mensaje_comprimido
+ *
+ * @brief Devuelve la versión comprimida de un mensaje, y la crea si todavía
+ *        no existe.
+ * @param m Mensaje.
+ * @return El bloque comprimido (que pertenece al mensaje: quien lo encola
+ *         toma su propia referencia), o NULL si no se pudo comprimir.
+ *
+ * Un mensaje se comprime una sola vez, la primera vez que se encola para una
+ * conexión comprimida. Si dos hilos lo comprimen a la vez, se queda el
+ * primero que termina y el otro descarta el suyo.
+ */
+
+mensaje *mensaje_comprimido(mensaje *m) {
+    mensaje *c = m->comprimido, *aux;
+    int largo;
+
+    if (c != NULL)
+        return c;
+
+    c = crear_mensaje(cota_bloque(m->largo));
+    if (c == NULL)
+        return NULL;
+
+    largo = comprimir_bloque(m->datos, m->largo, c->datos);
+    if (largo < 0) {
+        free(c);
+        return NULL;
+    }
+
+    // El bloque se reservó para el peor caso; se achica a lo que ocupó
+    aux = realloc(c, sizeof(mensaje) + largo);
+    if (aux != NULL) {
+        c = aux;
+        c->datos = (char *) (c + 1);
+    }
+    c->largo = largo;
+    mis_metricas()->compresiones++;
+
+    if (!__sync_bool_compare_and_swap(&m->comprimido, NULL, c)) {
+        free(c);
+        c = m->comprimido;
+    }
+    return c;
+}
+
+
+/**
+ * liberar_bloque
+ *
+ * @brief Libera un bloque de una cola y suelta su mensaje.
+ * @param b Bloque a liberar.
+ */
+
+void liberar_bloque(bloque *b) {
+    soltar_mensaje(b->men);
+    free(b);
+}
+
+
+/**
+ * crear_cola_envio
+ *
+ * @brief Inicializa una cola de salida vacía.
+ * @param c Cola a inicializar.
+ */
+
+void crear_cola_envio(cola_envio *c) {
+    c->primero = NULL;
+    c->ultimo = NULL;
+    c->enviado = 0;
+    c->bytes = 0;
+}
+
+
+/**
+ * cola_envio_vacia
+ *
+ * @brief Verifica si una cola de salida no tiene nada pendiente.
+ * @param c Cola a verificar.
+ * @return 1 si está vacía, 0 si no lo está.
+ */
+
+int cola_envio_vacia(cola_envio *c) {
+    return (c->primero == NULL);
+}
+
+
+/**
+ * encolar_mensaje
+ *
+ * @brief Agrega un mensaje compartido al final de la cola de salida.
+ * @param c Cola a la que se agrega el mensaje.
+ * @param m Mensaje a agregar; la cola toma una referencia propia.
+ * @return 0 si se agregó, 1 si no se pudo asignar memoria.
+ */
+
+int encolar_mensaje(cola_envio *c, mensaje *m) {
+    bloque *nuevo = malloc(sizeof(bloque));
+
+    if (nuevo == NULL)
+        return 1;
+
+    retener_mensaje(m);
+    nuevo->men = m;
+    nuevo->sig = NULL;
+
+    if (c->ultimo == NULL)
+        c->primero = nuevo;
+    else
+        c->ultimo->sig = nuevo;
+    c->ultimo = nuevo;
+    c->bytes += m->largo;
+    return 0;
+}
+
+
+/**
+ * agregar_cola_envio
+ *
+ * @brief Agrega una copia de un texto al final de la cola de salida.
+ * @param c Cola a la que se agrega el texto.
+ * @param datos Texto a agregar.
+ * @param largo Cantidad de bytes del texto.
+ * @return 0 si se agregó, 1 si no se pudo asignar memoria.
+ */
+
+int agregar_cola_envio(cola_envio *c, char *datos, int largo) {
+    mensaje *m = crear_mensaje(largo);
+    int error;
+
+    if (m == NULL)
+        return 1;
+
+    memcpy(m->datos, datos, largo);
+    error = encolar_mensaje(c, m);
+    soltar_mensaje(m);
+    return error;
+}
+
+
+/**
+ * descartar_antiguos
+ *
+ * @brief Descarta los bloques más antiguos de una cola de salida.
+ * @param c Cola de la que se descartan bloques.
+ * @param limite Cantidad de bytes que debe quedar, como máximo, en la cola.
+ * @return Cantidad de bloques descartados.
+ *
+ * El primer bloque nunca se descarta si ya se escribió una parte de él, para
+ * no cortar un mensaje a la mitad.
+ */
+
+int descartar_antiguos(cola_envio *c, int limite) {
+    bloque **ref = &c->primero;
+    bloque *aux;
+    int descartados = 0;
+
+    if (c->enviado > 0 && *ref != NULL)
+        ref = &(*ref)->sig;
+
+    while (c->bytes > limite && *ref != NULL) {
+        aux = *ref;
+        *ref = aux->sig;
+        if (c->ultimo == aux)
+            c->ultimo = (ref == &c->primero) ? NULL : c->primero;
+        c->bytes -= aux->men->largo;
+        liberar_bloque(aux);
+        descartados++;
+    }
+    return descartados;
+}
+
+
+/**
+ * preparar_envio
+ *
+ * @brief Arma los bloques de una escritura con lo pendiente de una cola.
+ * @param c Cola a escribir.
+ * @param iov Arreglo donde se arman los bloques.
+ * @param max Cantidad máxima de bloques.
+ * @return Cantidad de bloques armados (0 si la cola está vacía).
+ *
+ * El primer bloque empieza en lo que falta por escribir del mensaje más
+ * antiguo. Nada se saca de la cola hasta llamar a avanzar_cola_envio.
+ */
+
+int preparar_envio(cola_envio *c, struct iovec *iov, int max) {
+    bloque *aux = c->primero;
+    int n;
+
+    if (aux == NULL)
+        return 0;
+
+    iov[0].iov_base = aux->men->datos + c->enviado;
+    iov[0].iov_len = aux->men->largo - c->enviado;
+    for (n = 1, aux = aux->sig; aux != NULL && n < max; n++, aux = aux->sig) {
+        iov[n].iov_base = aux->men->datos;
+        iov[n].iov_len = aux->men->largo;
+    }
+    return n;
+}
+
+
+/**
+ * avanzar_cola_envio
+ *
+ * @brief Saca de una cola de salida los bytes que ya se escribieron.
+ * @param c Cola escrita.
+ * @param escrito Cantidad de bytes escritos de lo que armó preparar_envio.
+ * @return 1 si un mensaje quedó escrito a medias, 0 si no.
+ *
+ * Los bloques escritos por completo se liberan y sueltan su mensaje.
+ */
+
+int avanzar_cola_envio(cola_envio *c, int escrito) {
+    bloque *aux;
+    int resto;
+
+    c->bytes -= escrito;
+    mis_metricas()->bytes_enviados += escrito;
+
+    while (escrito > 0) {
+        aux = c->primero;
+        resto = aux->men->largo - c->enviado;
+        if (escrito < resto) {
+            c->enviado += escrito;
+            return 1;
+        }
+        escrito -= resto;
+        c->primero = aux->sig;
+        c->enviado = 0;
+        liberar_bloque(aux);
+    }
+
+    if (c->primero == NULL)
+        c->ultimo = NULL;
+    return 0;
+}
+
+
+/**
+ * vaciar_cola_envio
+ *
+ * @brief Escribe en un socket todo lo que se pueda de una cola de salida.
+ * @param c Cola a escribir.
+ * @param fd Socket no bloqueante en el que se escribe.
+ * @return 0 si la cola quedó vacía, 1 si el socket no aceptó todo, -1 si hubo
+ *         un error en el socket.
+ *
+ * Todos los bloques pendientes (hasta MAX_BLOQUES_ESCRITURA) se escriben con
+ * una sola llamada a writev.
+ */
+
+int vaciar_cola_envio(cola_envio *c, int fd) {
+    struct iovec iov[MAX_BLOQUES_ESCRITURA];
+    int n, escrito;
+
+    while (c->primero != NULL) {
+        n = preparar_envio(c, iov, MAX_BLOQUES_ESCRITURA);
+
+        escrito = writev(fd, iov, n);
+        mis_metricas()->escrituras++;
+
+        if (escrito < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 1;
+            return -1;
+        }
+
+        if (avanzar_cola_envio(c, escrito))
+            return 1;
+    }
+    return 0;
+}
+
+
+/**
+ * destruir_cola_envio
+ *
+ * @brief Libera todos los bloques pendientes de una cola de salida.
+ * @param c Cola a destruir.
+ */
+
+void destruir_cola_envio(cola_envio *c) {
+    bloque *aux;
+    while (c->primero != NULL) {
+        aux = c->primero;
+        c->primero = aux->sig;
+        liberar_bloque(aux);
+    }
+    crear_cola_envio(c);
+}
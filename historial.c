@@ -0,0 +1,185 @@
+/**
+ * @file historial.c
+ * @author Luis Fernandes 10-10239 <lfernandes@ldc.usb.ve>
+ * @author Rebeca Machado 10-10406 <rebeca@ldc.usb.ve>
+ *
+ * Funciones para el historial de una sala: un anillo de tamaño fijo con sus
+ * últimos mensajes, que se le reenvían a quien se suscribe.
+ *
+ * El anillo no copia los textos: guarda una referencia a los mismos mensajes
+ * compartidos (envio.c) que se encolaron a los miembros, en los dos formatos
+ * (texto y trama binaria), así que reenviarlos solo es encolar referencias.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+
+/**
+ * \struct entrada_historial
+ * \brief Struct que representa un mensaje del historial en ambos protocolos.
+ */
+
+typedef struct {
+
+    /**
+     * @var texto
+     * @brief Mensaje para los clientes de texto.
+     */
+    mensaje *texto;
+
+    /**
+     * @var trama
+     * @brief Trama RES_MENSAJE para los clientes binarios.
+     */
+    mensaje *trama;
+
+} entrada_historial;
+
+
+/**
+ * \struct historial
+ * \brief Struct que representa el anillo de los últimos mensajes de una
+ *        sala.
+ *
+ * Las entradas son un solo arreglo contiguo de la capacidad del historial,
+ * que se pide con el primer mensaje de la sala. Cuando el anillo está lleno,
+ * cada mensaje nuevo reemplaza al más antiguo.
+ */
+
+typedef struct {
+
+    /**
+     * @var entradas
+     * @brief Arreglo de entradas (NULL mientras la sala no tenga mensajes).
+     */
+    entrada_historial *entradas;
+
+    /**
+     * @var inicio
+     * @brief Posición de la entrada más antigua.
+     */
+    int inicio;
+
+    /**
+     * @var cantidad
+     * @brief Cantidad de entradas ocupadas.
+     */
+    int cantidad;
+
+    /**
+     * @var mutex
+     * @brief Semáforo que bloquea el anillo.
+     *
+     * Varios hilos pueden enviar mensajes a la misma sala a la vez, así que
+     * agregar al historial necesita su propio semáforo.
+     */
+    pthread_mutex_t mutex;
+
+} historial;
+
+
+/**
+ * crear_historial
+ *
+ * @brief Inicializa un historial vacío.
+ * @param h Historial a inicializar.
+ */
+
+void crear_historial(historial *h) {
+    h->entradas = NULL;
+    h->inicio = 0;
+    h->cantidad = 0;
+    pthread_mutex_init(&h->mutex, NULL);
+}
+
+
+/**
+ * agregar_historial
+ *
+ * @brief Agrega un mensaje al final de un historial.
+ * @param h Historial al que se agrega.
+ * @param capacidad Cantidad máxima de mensajes del historial.
+ * @param texto Mensaje en formato de texto; el historial toma una referencia.
+ * @param trama Mensaje en formato binario; el historial toma una referencia.
+ * @return 0 si se agregó, 1 si no se pudo asignar memoria.
+ *
+ * Si el historial está lleno, se sueltan los mensajes más antiguos.
+ */
+
+int agregar_historial(historial *h, int capacidad, mensaje *texto,
+                      mensaje *trama) {
+    entrada_historial *e;
+
+    pthread_mutex_lock(&h->mutex);
+
+    if (h->entradas == NULL) {
+        h->entradas = calloc(capacidad, sizeof(entrada_historial));
+        if (h->entradas == NULL) {
+            pthread_mutex_unlock(&h->mutex);
+            return 1;
+        }
+    }
+
+    if (h->cantidad == capacidad) {
+        e = &h->entradas[h->inicio];
+        soltar_mensaje(e->texto);
+        soltar_mensaje(e->trama);
+        h->inicio = (h->inicio + 1) % capacidad;
+    } else {
+        h->cantidad++;
+    }
+
+    e = &h->entradas[(h->inicio + h->cantidad - 1) % capacidad];
+    retener_mensaje(texto);
+    retener_mensaje(trama);
+    e->texto = texto;
+    e->trama = trama;
+
+    pthread_mutex_unlock(&h->mutex);
+    return 0;
+}
+
+
+/**
+ * entrada_historial_en
+ *
+ * @brief Devuelve una entrada de un historial.
+ * @param h Historial.
+ * @param capacidad Cantidad máxima de mensajes del historial.
+ * @param i Posición de la entrada, desde 0 (la más antigua) hasta
+ *          h->cantidad - 1 (la más reciente).
+ * @return La entrada.
+ *
+ * Quien llama debe asegurarse de que nadie agregue mensajes mientras tanto.
+ */
+
+entrada_historial *entrada_historial_en(historial *h, int capacidad, int i) {
+    return &h->entradas[(h->inicio + i) % capacidad];
+}
+
+
+/**
+ * destruir_historial
+ *
+ * @brief Suelta todos los mensajes de un historial y libera su memoria.
+ * @param h Historial a destruir.
+ * @param capacidad Cantidad máxima de mensajes del historial.
+ */
+
+void destruir_historial(historial *h, int capacidad) {
+    entrada_historial *e;
+    int i;
+
+    for (i = 0; i < h->cantidad; i++) {
+        e = entrada_historial_en(h, capacidad, i);
+        soltar_mensaje(e->texto);
+        soltar_mensaje(e->trama);
+    }
+    free(h->entradas);
+    h->entradas = NULL;
+    h->cantidad = 0;
+    pthread_mutex_destroy(&h->mutex);
+}
@@ -0,0 +1,471 @@
+/**
+ * @file instantanea.c
+ * @author Luis Fernandes 10-10239 <lfernandes@ldc.usb.ve>
+ * @author Rebeca Machado 10-10406 <rebeca@ldc.usb.ve>
+ *
+ * Funciones para guardar y leer la instantánea del servidor: un archivo
+ * binario con las salas y las suscripciones de los usuarios.
+ *
+ * El archivo empieza con MARCA_INSTANTANEA y sigue con:
+ *
+ *   cantidad de salas                     4 bytes
+ *   por cada sala: largo y nombre         4 bytes + largo
+ *   cantidad de suscripciones             4 bytes
+ *   por cada suscripción: largo y nombre  4 bytes + largo
+ *     del usuario, e índice de la sala    4 bytes
+ *
+ * Los enteros están en orden de red. El archivo se escribe completo en uno
+ * temporal que después se renombra, así que nunca queda una instantánea a
+ * medias.
+ *
+ * Las suscripciones leídas se guardan, por nombre de usuario, hasta que ese
+ * usuario se vuelva a conectar.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+
+#define MARCA_INSTANTANEA "SCHAT-I1"
+#define INTERVALO_INSTANTANEA 60
+
+
+/**
+ * \struct escritor
+ * \brief Struct que acumula en memoria el contenido de un archivo binario.
+ */
+
+typedef struct {
+
+    /**
+     * @var datos
+     * @brief Bytes escritos.
+     */
+    char *datos;
+
+    /**
+     * @var largo
+     * @brief Cantidad de bytes escritos.
+     */
+    int largo;
+
+    /**
+     * @var capacidad
+     * @brief Tamaño de datos.
+     */
+    int capacidad;
+
+    /**
+     * @var error
+     * @brief Indica si alguna escritura no se pudo hacer por falta de
+     *        memoria.
+     */
+    int error;
+
+} escritor;
+
+
+/**
+ * \struct lector
+ * \brief Struct que recorre el contenido de un archivo binario.
+ */
+
+typedef struct {
+
+    /**
+     * @var pos
+     * @brief Siguiente byte por leer.
+     */
+    char *pos;
+
+    /**
+     * @var fin
+     * @brief Final del contenido.
+     */
+    char *fin;
+
+    /**
+     * @var error
+     * @brief Indica si alguna lectura pasó del final o no tuvo memoria.
+     */
+    int error;
+
+} lector;
+
+
+/**
+ * \struct suscripciones_guardadas
+ * \brief Struct con las salas a las que estaba suscrito un usuario.
+ */
+
+typedef struct {
+
+    /**
+     * @var nombre
+     * @brief Nombre del usuario (clave en tabla_guardadas).
+     */
+    char *nombre;
+
+    /**
+     * @var salas
+     * @brief Nombres de las salas.
+     */
+    char **salas;
+
+    /**
+     * @var cantidad
+     * @brief Cantidad de salas.
+     */
+    int cantidad;
+
+    /**
+     * @var capacidad
+     * @brief Tamaño del arreglo salas.
+     */
+    int capacidad;
+
+} suscripciones_guardadas;
+
+
+/**
+ * \var archivo_instantanea
+ * \brief Ruta de la instantánea (NULL si no se usa).
+ */
+char *archivo_instantanea = NULL;
+
+/**
+ * \var intervalo_instantanea
+ * \brief Segundos entre dos instantáneas mientras el servidor funciona.
+ */
+int intervalo_instantanea = INTERVALO_INSTANTANEA;
+
+/**
+ * \var tabla_guardadas
+ * \brief Suscripciones leídas de la instantánea cuyos usuarios todavía no se
+ *        conectan, indexadas por nombre de usuario.
+ */
+tabla tabla_guardadas;
+
+/**
+ * \var mutex_guardadas
+ * \brief Semáforo que bloquea tabla_guardadas.
+ */
+pthread_mutex_t mutex_guardadas = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * \var mutex_instantanea
+ * \brief Semáforo que serializa la escritura de las instantáneas: todas usan
+ *        el mismo archivo temporal.
+ */
+pthread_mutex_t mutex_instantanea = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ * agregar_bytes
+ *
+ * @brief Agrega bytes al final de un escritor.
+ * @param e Escritor.
+ * @param datos Bytes a agregar.
+ * @param n Cantidad de bytes.
+ */
+
+void agregar_bytes(escritor *e, void *datos, int n) {
+    char *aux;
+    int capacidad;
+
+    if (e->largo + n > e->capacidad) {
+        capacidad = e->capacidad > 0 ? e->capacidad * 2 : 4096;
+        while (capacidad < e->largo + n)
+            capacidad *= 2;
+        aux = realloc(e->datos, capacidad);
+        if (aux == NULL) {
+            e->error = 1;
+            return;
+        }
+        e->datos = aux;
+        e->capacidad = capacidad;
+    }
+
+    memcpy(e->datos + e->largo, datos, n);
+    e->largo += n;
+}
+
+
+/**
+ * agregar_entero
+ *
+ * @brief Agrega un entero de 4 bytes, en orden de red, a un escritor.
+ * @param e Escritor.
+ * @param valor Entero a agregar.
+ */
+
+void agregar_entero(escritor *e, unsigned int valor) {
+    uint32_t aux = htonl(valor);
+
+    agregar_bytes(e, &aux, 4);
+}
+
+
+/**
+ * agregar_cadena
+ *
+ * @brief Agrega a un escritor el largo de una cadena y sus caracteres.
+ * @param e Escritor.
+ * @param cadena Cadena a agregar.
+ */
+
+void agregar_cadena(escritor *e, char *cadena) {
+    int largo = strlen(cadena);
+
+    agregar_entero(e, largo);
+    agregar_bytes(e, cadena, largo);
+}
+
+
+/**
+ * cambiar_entero
+ *
+ * @brief Reemplaza un entero ya escrito en un escritor.
+ * @param e Escritor.
+ * @param posicion Posición del entero (el largo del escritor antes de
+ *                 agregarlo).
+ * @param valor Valor nuevo.
+ */
+
+void cambiar_entero(escritor *e, int posicion, unsigned int valor) {
+    uint32_t aux = htonl(valor);
+
+    if (!e->error)
+        memcpy(e->datos + posicion, &aux, 4);
+}
+
+
+/**
+ * guardar_archivo
+ *
+ * @brief Escribe el contenido de un escritor en un archivo.
+ * @param ruta Ruta del archivo.
+ * @param e Escritor con el contenido.
+ * @return 0 si se pudo escribir, 1 si no.
+ *
+ * Se escribe en ruta.tmp, se espera a que llegue al disco y se renombra.
+ * Quien la llama no debe escribir otro archivo con la misma ruta al mismo
+ * tiempo.
+ */
+
+int guardar_archivo(char *ruta, escritor *e) {
+    char *temporal;
+    int fd, escrito, n;
+
+    if (e->error)
+        return 1;
+
+    temporal = malloc(strlen(ruta) + 5);
+    if (temporal == NULL)
+        return 1;
+    sprintf(temporal, "%s.tmp", ruta);
+
+    fd = open(temporal, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        free(temporal);
+        return 1;
+    }
+
+    for (escrito = 0; escrito < e->largo; escrito += n) {
+        n = write(fd, e->datos + escrito, e->largo - escrito);
+        if (n <= 0)
+            break;
+    }
+
+    if (escrito < e->largo || fsync(fd) != 0) {
+        close(fd);
+        unlink(temporal);
+        free(temporal);
+        return 1;
+    }
+
+    if (close(fd) != 0 || rename(temporal, ruta) != 0) {
+        unlink(temporal);
+        free(temporal);
+        return 1;
+    }
+
+    free(temporal);
+    return 0;
+}
+
+
+/**
+ * leer_archivo
+ *
+ * @brief Lee un archivo completo.
+ * @param ruta Ruta del archivo.
+ * @param largo Donde se guarda la cantidad de bytes leídos.
+ * @return El contenido (que se libera con free), o NULL si no se pudo leer.
+ */
+
+char *leer_archivo(char *ruta, int *largo) {
+    struct stat info;
+    char *datos;
+    int fd, n;
+
+    fd = open(ruta, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &info) != 0 || info.st_size > 0x7fffffff ||
+        (datos = malloc(info.st_size + 1)) == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    for (*largo = 0; *largo < info.st_size; *largo += n) {
+        n = read(fd, datos + *largo, info.st_size - *largo);
+        if (n <= 0)
+            break;
+    }
+
+    close(fd);
+    return datos;
+}
+
+
+/**
+ * leer_entero
+ *
+ * @brief Lee un entero de 4 bytes, en orden de red.
+ * @param l Lector.
+ * @return El entero, o 0 si no quedaban 4 bytes (y se marca el error).
+ */
+
+unsigned int leer_entero(lector *l) {
+    uint32_t aux;
+
+    if (l->error || l->fin - l->pos < 4) {
+        l->error = 1;
+        return 0;
+    }
+
+    memcpy(&aux, l->pos, 4);
+    l->pos += 4;
+    return ntohl(aux);
+}
+
+
+/**
+ * leer_cadena
+ *
+ * @brief Lee una cadena escrita con agregar_cadena.
+ * @param l Lector.
+ * @return Una copia de la cadena terminada en un caracter nulo (que se
+ *         libera con free), o NULL si hubo un error.
+ */
+
+char *leer_cadena(lector *l) {
+    unsigned int largo = leer_entero(l);
+    char *cadena;
+
+    if (l->error || largo > (unsigned int) (l->fin - l->pos) ||
+        memchr(l->pos, '\0', largo) != NULL ||
+        (cadena = malloc(largo + 1)) == NULL) {
+        l->error = 1;
+        return NULL;
+    }
+
+    memcpy(cadena, l->pos, largo);
+    cadena[largo] = '\0';
+    l->pos += largo;
+    return cadena;
+}
+
+
+/**
+ * liberar_guardadas
+ *
+ * @brief Libera las suscripciones guardadas de un usuario.
+ * @param g Suscripciones a liberar.
+ */
+
+void liberar_guardadas(suscripciones_guardadas *g) {
+    int i;
+
+    for (i = 0; i < g->cantidad; i++)
+        free(g->salas[i]);
+    free(g->salas);
+    free(g->nombre);
+    free(g);
+}
+
+
+/**
+ * guardar_suscripcion
+ *
+ * @brief Anota que un usuario que todavía no se conecta estaba suscrito a
+ *        una sala.
+ * @param nombre Nombre del usuario (se copia).
+ * @param nombre_sala Nombre de la sala (se copia).
+ * @return 0 si se anotó, 1 si no se pudo asignar memoria.
+ */
+
+int guardar_suscripcion(char *nombre, char *nombre_sala) {
+    suscripciones_guardadas *g;
+    char **aux;
+    int error = 1;
+
+    pthread_mutex_lock(&mutex_guardadas);
+
+    g = buscar_tabla(&tabla_guardadas, nombre);
+    if (g == NULL) {
+        g = calloc(1, sizeof(suscripciones_guardadas));
+        if (g == NULL || (g->nombre = strdup(nombre)) == NULL ||
+            insertar_tabla(&tabla_guardadas, g->nombre, g) != 0) {
+            if (g != NULL)
+                free(g->nombre);
+            free(g);
+            pthread_mutex_unlock(&mutex_guardadas);
+            return 1;
+        }
+    }
+
+    if (g->cantidad == g->capacidad) {
+        aux = realloc(g->salas, (g->capacidad * 2 + 4) * sizeof(char *));
+        if (aux != NULL) {
+            g->salas = aux;
+            g->capacidad = g->capacidad * 2 + 4;
+        }
+    }
+
+    if (g->cantidad < g->capacidad &&
+        (g->salas[g->cantidad] = strdup(nombre_sala)) != NULL) {
+        g->cantidad++;
+        error = 0;
+    }
+
+    pthread_mutex_unlock(&mutex_guardadas);
+    return error;
+}
+
+
+/**
+ * tomar_guardadas
+ *
+ * @brief Saca las suscripciones guardadas de un usuario.
+ * @param nombre Nombre del usuario.
+ * @return Sus suscripciones (quien llama las libera con liberar_guardadas),
+ *         o NULL si no tenía.
+ */
+
+suscripciones_guardadas *tomar_guardadas(char *nombre) {
+    suscripciones_guardadas *g;
+
+    pthread_mutex_lock(&mutex_guardadas);
+    g = eliminar_tabla(&tabla_guardadas, nombre);
+    pthread_mutex_unlock(&mutex_guardadas);
+    return g;
+}
@@ -4,10 +4,24 @@
  * @author Rebeca Machado 10-10406 <rebeca@ldc.usb.ve>
  * 
  * Funciones para el manejo de listas.
+ *
+ * Los nodos no se piden uno por uno a malloc: salen de un pool compartido,
+ * que reserva NODOS_POR_BLOQUE nodos a la vez, y cada hilo guarda una caché
+ * propia de nodos libres para no tener que bloquear el pool en cada
+ * inserción o eliminación.
+ *
+ * También se ofrece una lista doble intrusiva (lista_doble), en la que el
+ * enlace vive dentro del elemento: agregar al final, conocer el largo y
+ * quitar un elemento del que se tiene el enlace cuestan O(1).
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define NODOS_POR_BLOQUE 1024
+#define NODOS_CACHE 128
 
 
 /**
@@ -48,6 +62,236 @@ typedef struct {
 } lista;
 
 
+/**
+ * \struct bloque_nodos
+ * \brief Struct que representa un bloque de nodos reservado de una vez.
+ */
+
+typedef struct bloque_nodos {
+
+    /**
+     * @var sig
+     * @brief Siguiente bloque del pool.
+     */
+    struct bloque_nodos *sig;
+
+    /**
+     * @var nodos
+     * @brief Nodos del bloque.
+     */
+    nodo nodos[NODOS_POR_BLOQUE];
+
+} bloque_nodos;
+
+
+/**
+ * \struct estadisticas_nodos
+ * \brief Struct con el estado del pool de nodos.
+ */
+
+typedef struct {
+
+    /**
+     * @var bloques
+     * @brief Cantidad de bloques reservados.
+     */
+    long bloques;
+
+    /**
+     * @var reservados
+     * @brief Cantidad total de nodos reservados (libres o no).
+     */
+    long reservados;
+
+    /**
+     * @var libres
+     * @brief Nodos libres en el pool compartido.
+     */
+    long libres;
+
+    /**
+     * @var en_hilos
+     * @brief Nodos en uso o en la caché de algún hilo.
+     */
+    long en_hilos;
+
+    /**
+     * @var traspasos
+     * @brief Cantidad de veces que un hilo tomó o devolvió un lote de nodos
+     *        al pool compartido.
+     */
+    long traspasos;
+
+} estadisticas_nodos;
+
+
+/**
+ * \var pool_nodos
+ * \brief Nodos libres del pool compartido.
+ */
+nodo *pool_nodos = NULL;
+
+/**
+ * \var bloques_nodos
+ * \brief Bloques reservados por el pool.
+ */
+bloque_nodos *bloques_nodos = NULL;
+
+/**
+ * \var estado_nodos
+ * \brief Estadísticas del pool (se modifican con mutex_nodos bloqueado).
+ */
+estadisticas_nodos estado_nodos;
+
+/**
+ * \var mutex_nodos
+ * \brief Semáforo que bloquea el pool compartido.
+ */
+pthread_mutex_t mutex_nodos = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * \var cache_nodos
+ * \brief Nodos libres de la caché del hilo.
+ */
+__thread nodo *cache_nodos = NULL;
+
+/**
+ * \var en_cache
+ * \brief Cantidad de nodos en la caché del hilo.
+ */
+__thread int en_cache = 0;
+
+
+/**
+ * llenar_cache
+ *
+ * @brief Pasa un lote de nodos del pool compartido a la caché del hilo.
+ * @return 0 si la caché quedó con nodos, 1 si no se pudo asignar memoria.
+ *
+ * Si el pool no tiene nodos libres, se reserva un bloque nuevo.
+ */
+
+int llenar_cache() {
+    bloque_nodos *b;
+    nodo *aux;
+    int i;
+
+    pthread_mutex_lock(&mutex_nodos);
+
+    if (pool_nodos == NULL) {
+        b = malloc(sizeof(bloque_nodos));
+        if (b == NULL) {
+            pthread_mutex_unlock(&mutex_nodos);
+            return 1;
+        }
+        b->sig = bloques_nodos;
+        bloques_nodos = b;
+        for (i = 0; i < NODOS_POR_BLOQUE; i++) {
+            b->nodos[i].sig = pool_nodos;
+            pool_nodos = &b->nodos[i];
+        }
+        estado_nodos.bloques++;
+        estado_nodos.reservados += NODOS_POR_BLOQUE;
+        estado_nodos.libres += NODOS_POR_BLOQUE;
+    }
+
+    while (pool_nodos != NULL && en_cache < NODOS_CACHE / 2) {
+        aux = pool_nodos;
+        pool_nodos = aux->sig;
+        aux->sig = cache_nodos;
+        cache_nodos = aux;
+        en_cache++;
+        estado_nodos.libres--;
+        estado_nodos.en_hilos++;
+    }
+    estado_nodos.traspasos++;
+
+    pthread_mutex_unlock(&mutex_nodos);
+    return 0;
+}
+
+
+/**
+ * vaciar_cache
+ *
+ * @brief Devuelve la mitad de la caché del hilo al pool compartido.
+ *
+ * Los nodos se devuelven como un solo lote: se enlazan fuera del semáforo y
+ * se agregan al pool con una sola operación.
+ */
+
+void vaciar_cache() {
+    nodo *primero, *ultimo;
+    int n = 0;
+
+    primero = cache_nodos;
+    ultimo = primero;
+    while (++n < NODOS_CACHE / 2)
+        ultimo = ultimo->sig;
+    cache_nodos = ultimo->sig;
+    en_cache -= n;
+
+    pthread_mutex_lock(&mutex_nodos);
+    ultimo->sig = pool_nodos;
+    pool_nodos = primero;
+    estado_nodos.libres += n;
+    estado_nodos.en_hilos -= n;
+    estado_nodos.traspasos++;
+    pthread_mutex_unlock(&mutex_nodos);
+}
+
+
+/**
+ * pedir_nodo
+ *
+ * @brief Toma un nodo libre de la caché del hilo.
+ * @return El nodo, o NULL si no se pudo asignar memoria.
+ */
+
+nodo *pedir_nodo() {
+    nodo *aux;
+
+    if (cache_nodos == NULL && llenar_cache())
+        return NULL;
+
+    aux = cache_nodos;
+    cache_nodos = aux->sig;
+    en_cache--;
+    return aux;
+}
+
+
+/**
+ * liberar_nodo
+ *
+ * @brief Devuelve un nodo a la caché del hilo.
+ * @param n Nodo a liberar. Puede haber sido pedido por otro hilo.
+ *
+ * Si la caché se llena, la mitad vuelve al pool compartido.
+ */
+
+void liberar_nodo(nodo *n) {
+    n->sig = cache_nodos;
+    cache_nodos = n;
+    if (++en_cache > NODOS_CACHE)
+        vaciar_cache();
+}
+
+
+/**
+ * consultar_nodos
+ *
+ * @brief Copia las estadísticas del pool de nodos.
+ * @param e Struct en el que se copian las estadísticas.
+ */
+
+void consultar_nodos(estadisticas_nodos *e) {
+    pthread_mutex_lock(&mutex_nodos);
+    *e = estado_nodos;
+    pthread_mutex_unlock(&mutex_nodos);
+}
+
+
 /**
  * lista_vacia
  * 
@@ -85,7 +329,11 @@ void crear_lista(lista *l) {
  */
 
 void agregar_principio(lista *l, void *elem) {
-    nodo *nuevo = malloc(sizeof(nodo));
+    nodo *nuevo = pedir_nodo();
+    if (nuevo == NULL) {
+        fprintf(stderr, "No se puede asignar memoria.\n");
+        return;
+    }
     nuevo->elemento = elem;
     nuevo->sig = NULL;
     if (!lista_vacia(*l)) {
@@ -105,7 +353,11 @@ void agregar_principio(lista *l, void *elem) {
  */
 
 void agregar_final(lista *l, void *elem) {
-    nodo *nuevo = malloc(sizeof(nodo));
+    nodo *nuevo = pedir_nodo();
+    if (nuevo == NULL) {
+        fprintf(stderr, "No se puede asignar memoria.\n");
+        return;
+    }
     nuevo->elemento = elem;
     nuevo->sig = NULL;
     if (lista_vacia(*l)) {
@@ -159,8 +411,9 @@ void *encontrar_elemento(lista l, void *elem, int (*compare)(void *,void*)) {
  * @param destruir Indica si se libera memoria o no.
  *
  * Se elimina un elemento de la lista recorriendo los elementos con la función
- * compare y se extrae de la misma si se encuentra. En caso de que destruir sea
- * 1, se libera la memoria. Si es 0, simplemente se elimina de la lista.
+ * compare y se extrae de la misma si se encuentra. El nodo siempre vuelve al
+ * pool. En caso de que destruir sea 1, también se libera la memoria del
+ * elemento. Si es 0, simplemente se elimina de la lista.
  */
 
 void eliminar_elemento(lista *l, void *elem, int (*compare)(void *,void*), 
@@ -174,7 +427,8 @@ void eliminar_elemento(lista *l, void *elem, int (*compare)(void *,void*),
         if (compare(elem, aux->elemento)) {
             l->cabeza = aux->sig;
             if (destruir)
-                free(aux);
+                free(aux->elemento);
+            liberar_nodo(aux);
             return;
         }
         
@@ -191,7 +445,7 @@ void eliminar_elemento(lista *l, void *elem, int (*compare)(void *,void*),
             aux2->sig = aux->sig;
             if (destruir)
                 free(aux->elemento);
-                free(aux);
+            liberar_nodo(aux);
             return;
         }
     }
@@ -236,9 +490,12 @@ void *extraer_primero(lista *l) {
     if (lista_vacia(*l)) 
         return NULL;
     nodo *aux;
+    void *elem;
     aux = l->cabeza;
     l->cabeza = aux->sig;
-    return aux->elemento;
+    elem = aux->elemento;
+    liberar_nodo(aux);
+    return elem;
 }
 
 
@@ -277,8 +534,154 @@ void destruir_lista(lista *l) {
     while (aux != NULL) {
         aux2 = aux->sig;
         free(aux->elemento);
-        free(aux);
+        liberar_nodo(aux);
         aux = aux2;
     }
     l->cabeza = NULL;
-}
\ No newline at end of file
+}
+
+/**
+ * \struct enlace
+ * \brief Struct que se incluye dentro de un elemento para enlazarlo en una
+ *        lista_doble.
+ *
+ * A diferencia de nodo, el enlace es parte del elemento (lista intrusiva):
+ * agregar o quitar un elemento no pide ni libera memoria, y un mismo
+ * elemento puede estar en varias listas si tiene un enlace para cada una.
+ */
+
+typedef struct enlace {
+
+    /**
+     * @var anterior
+     * @brief Enlace anterior en la lista.
+     */
+    struct enlace *anterior;
+
+    /**
+     * @var siguiente
+     * @brief Enlace siguiente en la lista.
+     */
+    struct enlace *siguiente;
+
+} enlace;
+
+
+/**
+ * \struct lista_doble
+ * \brief Struct que representa una lista doblemente enlazada intrusiva.
+ */
+
+typedef struct {
+
+    /**
+     * @var primero
+     * @brief Primer enlace de la lista.
+     */
+    enlace *primero;
+
+    /**
+     * @var ultimo
+     * @brief Último enlace de la lista.
+     */
+    enlace *ultimo;
+
+    /**
+     * @var largo
+     * @brief Cantidad de elementos de la lista.
+     */
+    int largo;
+
+} lista_doble;
+
+
+/**
+ * contenedor
+ *
+ * @brief Obtiene el elemento que contiene un enlace.
+ * @param e Enlace.
+ * @param tipo Tipo del elemento.
+ * @param campo Nombre del campo del elemento en el que está el enlace.
+ */
+
+#define contenedor(e, tipo, campo) \
+    ((tipo *) ((char *) (e) - offsetof(tipo, campo)))
+
+
+/**
+ * crear_lista_doble
+ *
+ * @brief Inicializa una lista doble vacía.
+ * @param l Lista a inicializar.
+ */
+
+void crear_lista_doble(lista_doble *l) {
+    l->primero = NULL;
+    l->ultimo = NULL;
+    l->largo = 0;
+}
+
+
+/**
+ * agregar_inicio_doble
+ *
+ * @brief Agrega un elemento al principio de una lista doble.
+ * @param l Lista a la que se agrega el elemento.
+ * @param e Enlace del elemento a agregar.
+ */
+
+void agregar_inicio_doble(lista_doble *l, enlace *e) {
+    e->anterior = NULL;
+    e->siguiente = l->primero;
+    if (l->primero != NULL)
+        l->primero->anterior = e;
+    else
+        l->ultimo = e;
+    l->primero = e;
+    l->largo++;
+}
+
+
+/**
+ * agregar_final_doble
+ *
+ * @brief Agrega un elemento al final de una lista doble.
+ * @param l Lista a la que se agrega el elemento.
+ * @param e Enlace del elemento a agregar.
+ */
+
+void agregar_final_doble(lista_doble *l, enlace *e) {
+    e->siguiente = NULL;
+    e->anterior = l->ultimo;
+    if (l->ultimo != NULL)
+        l->ultimo->siguiente = e;
+    else
+        l->primero = e;
+    l->ultimo = e;
+    l->largo++;
+}
+
+
+/**
+ * quitar_doble
+ *
+ * @brief Quita un elemento de una lista doble.
+ * @param l Lista que contiene el elemento.
+ * @param e Enlace del elemento a quitar.
+ *
+ * No hace falta buscar el elemento: basta con su enlace.
+ */
+
+void quitar_doble(lista_doble *l, enlace *e) {
+    if (e->anterior != NULL)
+        e->anterior->siguiente = e->siguiente;
+    else
+        l->primero = e->siguiente;
+    if (e->siguiente != NULL)
+        e->siguiente->anterior = e->anterior;
+    else
+        l->ultimo = e->anterior;
+    e->anterior = NULL;
+    e->siguiente = NULL;
+    l->largo--;
+}
@@ -0,0 +1,342 @@
+/**
+ * @file metricas.c
+ * @author Luis Fernandes 10-10239 <lfernandes@ldc.usb.ve>
+ * @author Rebeca Machado 10-10406 <rebeca@ldc.usb.ve>
+ *
+ * Contadores e histogramas de tiempos del servidor.
+ *
+ * Cada hilo escribe en su propio bloque de métricas, sin semáforos ni
+ * operaciones atómicas. Los bloques se enlazan en una lista global la
+ * primera vez que el hilo los usa y solo se suman cuando alguien consulta
+ * las métricas. Cada contador lo escribe un único hilo y es un entero de 64
+ * bits alineado, así que quien los suma puede ver un valor algo atrasado
+ * pero nunca uno escrito a medias.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define CUBETAS_METRICAS 24
+#define MAX_OPERACIONES 32
+
+
+/**
+ * \struct histograma
+ * \brief Struct que cuenta tiempos en cubetas de potencias de dos.
+ *
+ * La cubeta i cuenta los tiempos menores que 2^i microsegundos (y mayores
+ * o iguales que los de la cubeta anterior); la última cuenta el resto.
+ */
+
+typedef struct {
+
+    /**
+     * @var cubetas
+     * @brief Cantidad de tiempos en cada cubeta.
+     */
+    long long cubetas[CUBETAS_METRICAS];
+
+    /**
+     * @var cantidad
+     * @brief Cantidad total de tiempos.
+     */
+    long long cantidad;
+
+    /**
+     * @var suma
+     * @brief Suma de todos los tiempos, en nanosegundos.
+     */
+    long long suma;
+
+} histograma;
+
+
+/**
+ * \struct metricas
+ * \brief Struct con los contadores de un hilo (o la suma de todos).
+ */
+
+typedef struct metricas {
+
+    /**
+     * @var conexiones_abiertas
+     * @brief Conexiones aceptadas.
+     */
+    long long conexiones_abiertas;
+
+    /**
+     * @var conexiones_cerradas
+     * @brief Conexiones cerradas.
+     */
+    long long conexiones_cerradas;
+
+    /**
+     * @var bytes_recibidos
+     * @brief Bytes leídos de los sockets de los clientes.
+     */
+    long long bytes_recibidos;
+
+    /**
+     * @var bytes_enviados
+     * @brief Bytes escritos en los sockets de los clientes.
+     */
+    long long bytes_enviados;
+
+    /**
+     * @var lecturas
+     * @brief Llamadas al sistema para leer de los sockets de los clientes.
+     */
+    long long lecturas;
+
+    /**
+     * @var escrituras
+     * @brief Llamadas al sistema para escribir en los sockets de los
+     *        clientes.
+     */
+    long long escrituras;
+
+    /**
+     * @var entregas
+     * @brief Mensajes de sala puestos en la cola de salida de un miembro.
+     */
+    long long entregas;
+
+    /**
+     * @var reenvios
+     * @brief Mensajes de sala reenviados a un servidor par.
+     */
+    long long reenvios;
+
+    /**
+     * @var reenvios_perdidos
+     * @brief Mensajes para un servidor par que no cupieron en la cola del
+     *        enlace.
+     */
+    long long reenvios_perdidos;
+
+    /**
+     * @var compresiones
+     * @brief Mensajes comprimidos para las conexiones comprimidas (cada
+     *        mensaje se comprime una sola vez).
+     */
+    long long compresiones;
+
+    /**
+     * @var omitidos
+     * @brief Mensajes que no se le enviaron a un cliente lento.
+     */
+    long long omitidos;
+
+    /**
+     * @var comandos
+     * @brief Tiempo de cada comando, por código de operación.
+     */
+    histograma comandos[MAX_OPERACIONES];
+
+    /**
+     * @var difusion
+     * @brief Tiempo de repartir un mensaje entre los miembros de una sala.
+     */
+    histograma difusion;
+
+    /**
+     * @var sig
+     * @brief Siguiente bloque de la lista de hilos.
+     */
+    struct metricas *sig;
+
+} metricas;
+
+
+/**
+ * \var metricas_hilos
+ * \brief Lista con el bloque de métricas de cada hilo.
+ */
+metricas *metricas_hilos = NULL;
+
+/**
+ * \var mutex_metricas
+ * \brief Semáforo que protege la lista metricas_hilos.
+ */
+pthread_mutex_t mutex_metricas = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * \var metricas_locales
+ * \brief Bloque de métricas del hilo actual (NULL hasta que lo use).
+ */
+__thread metricas *metricas_locales = NULL;
+
+
+/**
+ * reloj
+ *
+ * @brief Devuelve el tiempo del reloj monótono.
+ * @return Nanosegundos.
+ */
+
+long long reloj() {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long) t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+
+/**
+ * mis_metricas
+ *
+ * @brief Devuelve el bloque de métricas del hilo actual.
+ * @return El bloque, creado y registrado la primera vez que se pide.
+ *
+ * Si no hay memoria se devuelve un bloque compartido que no se registra, de
+ * manera que quien llama nunca recibe NULL; sus cuentas se pierden.
+ */
+
+metricas *mis_metricas() {
+    static metricas descarte;
+    metricas *m = metricas_locales;
+
+    if (m != NULL)
+        return m;
+
+    m = calloc(1, sizeof(metricas));
+    if (m == NULL)
+        return &descarte;
+
+    pthread_mutex_lock(&mutex_metricas);
+    m->sig = metricas_hilos;
+    metricas_hilos = m;
+    pthread_mutex_unlock(&mutex_metricas);
+
+    metricas_locales = m;
+    return m;
+}
+
+
+/**
+ * observar
+ *
+ * @brief Agrega un tiempo a un histograma.
+ * @param h Histograma.
+ * @param nanos Tiempo en nanosegundos.
+ */
+
+void observar(histograma *h, long long nanos) {
+    unsigned long long micros = nanos > 0 ? nanos / 1000 : 0;
+    int i = micros == 0 ? 0 : 64 - __builtin_clzll(micros);
+
+    if (i >= CUBETAS_METRICAS)
+        i = CUBETAS_METRICAS - 1;
+    h->cubetas[i]++;
+    h->cantidad++;
+    h->suma += nanos;
+}
+
+
+/**
+ * sumar_histograma
+ *
+ * @brief Suma un histograma a otro.
+ * @param total Histograma al que se suma.
+ * @param h Histograma que se suma.
+ */
+
+void sumar_histograma(histograma *total, histograma *h) {
+    int i;
+
+    for (i = 0; i < CUBETAS_METRICAS; i++)
+        total->cubetas[i] += h->cubetas[i];
+    total->cantidad += h->cantidad;
+    total->suma += h->suma;
+}
+
+
+/**
+ * sumar_metricas
+ *
+ * @brief Suma las métricas de todos los hilos.
+ * @param total Donde se guarda la suma.
+ */
+
+void sumar_metricas(metricas *total) {
+    metricas *m;
+    int i;
+
+    memset(total, 0, sizeof(metricas));
+
+    pthread_mutex_lock(&mutex_metricas);
+    for (m = metricas_hilos; m != NULL; m = m->sig) {
+        total->conexiones_abiertas += m->conexiones_abiertas;
+        total->conexiones_cerradas += m->conexiones_cerradas;
+        total->bytes_recibidos += m->bytes_recibidos;
+        total->bytes_enviados += m->bytes_enviados;
+        total->lecturas += m->lecturas;
+        total->escrituras += m->escrituras;
+        total->entregas += m->entregas;
+        total->reenvios += m->reenvios;
+        total->reenvios_perdidos += m->reenvios_perdidos;
+        total->compresiones += m->compresiones;
+        total->omitidos += m->omitidos;
+        for (i = 0; i < MAX_OPERACIONES; i++)
+            sumar_histograma(&total->comandos[i], &m->comandos[i]);
+        sumar_histograma(&total->difusion, &m->difusion);
+    }
+    pthread_mutex_unlock(&mutex_metricas);
+}
+
+
+/**
+ * escribir_contador
+ *
+ * @brief Escribe una métrica de un solo valor en el formato de Prometheus.
+ * @param f Archivo en el que se escribe.
+ * @param nombre Nombre de la métrica.
+ * @param tipo Tipo de la métrica (counter o gauge).
+ * @param ayuda Descripción de la métrica.
+ * @param valor Valor de la métrica.
+ */
+
+void escribir_contador(FILE *f, char *nombre, char *tipo, char *ayuda,
+                       long long valor) {
+    fprintf(f, "# HELP %s %s\n# TYPE %s %s\n%s %lld\n", nombre, ayuda,
+            nombre, tipo, nombre, valor);
+}
+
+
+/**
+ * escribir_histograma
+ *
+ * @brief Escribe las series de un histograma en el formato de Prometheus.
+ * @param f Archivo en el que se escribe.
+ * @param nombre Nombre de la métrica.
+ * @param etiquetas Etiquetas de la serie, como "comando=\"men\"", o "".
+ * @param h Histograma.
+ *
+ * Los límites de las cubetas y la suma se escriben en segundos. Las líneas
+ * HELP y TYPE las escribe quien llama, una sola vez por métrica.
+ */
+
+void escribir_histograma(FILE *f, char *nombre, char *etiquetas,
+                         histograma *h) {
+    char *coma = etiquetas[0] == '\0' ? "" : ",";
+    long long acumulado = 0;
+    int i;
+
+    for (i = 0; i < CUBETAS_METRICAS - 1; i++) {
+        acumulado += h->cubetas[i];
+        fprintf(f, "%s_bucket{%s%sle=\"%g\"} %lld\n", nombre, etiquetas, coma,
+                (double) (1LL << i) / 1e6, acumulado);
+    }
+    fprintf(f, "%s_bucket{%s%sle=\"+Inf\"} %lld\n", nombre, etiquetas, coma,
+            h->cantidad);
+    if (etiquetas[0] == '\0') {
+        fprintf(f, "%s_sum %.9f\n", nombre, h->suma / 1e9);
+        fprintf(f, "%s_count %lld\n", nombre, h->cantidad);
+    } else {
+        fprintf(f, "%s_sum{%s} %.9f\n", nombre, etiquetas, h->suma / 1e9);
+        fprintf(f, "%s_count{%s} %lld\n", nombre, etiquetas, h->cantidad);
+    }
+}
@@ -0,0 +1,238 @@
+/**
+ * @file protocolo.c
+ * @author Luis Fernandes 10-10239 <lfernandes@ldc.usb.ve>
+ * @author Rebeca Machado 10-10406 <rebeca@ldc.usb.ve>
+ *
+ * Funciones para el protocolo binario del servidor.
+ *
+ * Un cliente pide el protocolo binario enviando el byte PROTOCOLO_BINARIO
+ * como primer byte de la conexión (un cliente de texto siempre empieza por su
+ * nombre). A partir de ahí, todo lo que se envía en ambos sentidos son tramas
+ * con este formato (los enteros en orden de red):
+ *
+ *   largo   4 bytes  bytes que siguen a este campo (5 + largo de la carga)
+ *   op      1 byte   código de operación (OP_* o RES_*)
+ *   id      4 bytes  identificador de la sala o del usuario (0 si no aplica)
+ *   carga   largo - 5 bytes
+ *
+ * Los nombres y textos de la carga no llevan caracter nulo al final; en las
+ * listas y en los mensajes de sala, cada campo se termina con un nulo.
+ *
+ * Los servidores federados usan el mismo formato en sus enlaces: el que abre
+ * el enlace envía OP_PAR con la clave de la federación, y desde ahí cada
+ * lado le avisa al otro con OP_INTERES y OP_SIN_INTERES en qué salas tiene
+ * miembros, y le reenvía los mensajes de esas salas como RES_MENSAJE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+
+#define PROTOCOLO_BINARIO 0x00
+#define TAMANO_CABECERA 9
+
+// Operaciones que envía el cliente
+#define OP_NOMBRE 1
+#define OP_MENSAJE 2
+#define OP_CREAR 3
+#define OP_ELIMINAR 4
+#define OP_SUSCRIBIR 5
+#define OP_SALAS 6
+#define OP_DESUSCRIBIR 7
+#define OP_MIS_SALAS 8
+#define OP_USUARIOS 9
+#define OP_FUERA 10
+
+// Operaciones entre servidores federados
+#define OP_PAR 11
+#define OP_INTERES 12
+#define OP_SIN_INTERES 13
+
+// Respuestas que envía el servidor
+#define RES_OK 128
+#define RES_ERROR 129
+#define RES_MENSAJE 130
+#define RES_LISTA 131
+#define RES_FIN 132
+
+
+/**
+ * escribir_cabecera
+ *
+ * @brief Escribe la cabecera de una trama.
+ * @param destino Donde se escriben los TAMANO_CABECERA bytes.
+ * @param op Código de operación.
+ * @param id Identificador de la sala o del usuario.
+ * @param largo_carga Cantidad de bytes de la carga que sigue a la cabecera.
+ */
+
+void escribir_cabecera(char *destino, int op, unsigned int id,
+                       int largo_carga) {
+    uint32_t aux;
+
+    aux = htonl(largo_carga + TAMANO_CABECERA - 4);
+    memcpy(destino, &aux, 4);
+    destino[4] = (char) op;
+    aux = htonl(id);
+    memcpy(destino + 5, &aux, 4);
+}
+
+
+/**
+ * leer_cabecera
+ *
+ * @brief Lee la cabecera de una trama.
+ * @param origen Los TAMANO_CABECERA bytes de la cabecera.
+ * @param op Donde se guarda el código de operación.
+ * @param id Donde se guarda el identificador.
+ * @return Largo de la carga, o -1 si la cabecera no es válida.
+ */
+
+int leer_cabecera(char *origen, int *op, unsigned int *id) {
+    uint32_t aux;
+
+    memcpy(&aux, origen, 4);
+    aux = ntohl(aux);
+    if (aux < TAMANO_CABECERA - 4 || aux > 0x7fffffff)
+        return -1;
+
+    *op = (unsigned char) origen[4];
+    memcpy(id, origen + 5, 4);
+    *id = ntohl(*id);
+    return aux - (TAMANO_CABECERA - 4);
+}
+
+
+/**
+ * agregar_campo
+ *
+ * @brief Copia un texto seguido de un caracter nulo al final de una carga.
+ * @param fin Posición de la carga donde se copia el texto.
+ * @param texto Texto a copiar.
+ * @return Nueva posición del final de la carga.
+ */
+
+char *agregar_campo(char *fin, char *texto) {
+    int largo = strlen(texto);
+
+    memcpy(fin, texto, largo);
+    fin += largo;
+    *fin++ = '\0';
+    return fin;
+}
+
+
+/**
+ * separar_tramas
+ *
+ * @brief Separa en tramas un bloque leído de un socket.
+ * @param b Buffer con la trama incompleta de la conexión.
+ * @param datos Bloque leído. Debe tener un byte más de espacio al final.
+ * @param n Cantidad de bytes del bloque.
+ * @param max_carga Largo máximo de la carga de una trama. Las tramas más
+ *                  largas se ignoran por completo.
+ * @param procesar Función que se llama con cada trama completa; la carga
+ *                 termina en un caracter nulo (que no cuenta en su largo). Si
+ *                 devuelve algo distinto de 0, se deja de procesar el bloque.
+ * @param contexto Primer parámetro que se le pasa a procesar.
+ * @return 1 si procesar pidió detenerse, 0 en caso contrario, -1 si llegó una
+ *         cabecera inválida (la conexión ya no se puede seguir leyendo).
+ *
+ * Igual que separar_lineas, las tramas completas dentro del bloque se
+ * procesan sin copiarlas y solo lo que sobra al final se guarda en el buffer.
+ * En el protocolo binario, b->descartando indica cuántos bytes faltan por
+ * ignorar de una trama demasiado larga.
+ */
+
+int separar_tramas(buffer_entrada *b, char *datos, int n, int max_carga,
+                   int (*procesar)(void *, int, unsigned int, char *, int),
+                   void *contexto) {
+    char *fin = datos + n;
+    char *trama, guardado;
+    unsigned int id;
+    int op, largo, falta, detener;
+
+    while (datos < fin) {
+
+        if (b->descartando > 0) {
+            falta = (fin - datos < b->descartando) ? fin - datos
+                                                   : b->descartando;
+            datos += falta;
+            b->descartando -= falta;
+            continue;
+        }
+
+        // Completa la cabecera de una trama que quedó a medias
+        if (b->largo > 0 && b->largo < TAMANO_CABECERA) {
+            falta = TAMANO_CABECERA - b->largo;
+            if (falta > fin - datos)
+                falta = fin - datos;
+            if (agregar_buffer(b, datos, falta, max_carga + TAMANO_CABECERA))
+                return -1;
+            datos += falta;
+            continue;
+        }
+
+        if (b->largo > 0) {
+            trama = b->datos;
+        } else if (fin - datos >= TAMANO_CABECERA) {
+            trama = datos;
+        } else {
+            if (agregar_buffer(b, datos, fin - datos,
+                               max_carga + TAMANO_CABECERA))
+                return -1;
+            return 0;
+        }
+
+        largo = leer_cabecera(trama, &op, &id);
+        if (largo < 0)
+            return -1;
+
+        if (largo > max_carga) {
+            if (b->largo > 0) {
+                b->descartando = largo;
+                b->largo = 0;
+            } else {
+                b->descartando = largo;
+                datos += TAMANO_CABECERA;
+            }
+            continue;
+        }
+
+        if (b->largo > 0) {
+            falta = TAMANO_CABECERA + largo - b->largo;
+            if (falta > fin - datos) {
+                if (agregar_buffer(b, datos, fin - datos,
+                                   max_carga + TAMANO_CABECERA))
+                    return -1;
+                return 0;
+            }
+            if (agregar_buffer(b, datos, falta, max_carga + TAMANO_CABECERA))
+                return -1;
+            datos += falta;
+            b->largo = 0;
+            b->datos[TAMANO_CABECERA + largo] = '\0';
+            detener = procesar(contexto, op, id, b->datos + TAMANO_CABECERA,
+                               largo);
+        } else {
+            if (fin - datos < TAMANO_CABECERA + largo) {
+                if (agregar_buffer(b, datos, fin - datos,
+                                   max_carga + TAMANO_CABECERA))
+                    return -1;
+                return 0;
+            }
+            datos += TAMANO_CABECERA + largo;
+            guardado = *datos;
+            *datos = '\0';
+            detener = procesar(contexto, op, id, trama + TAMANO_CABECERA,
+                               largo);
+            *datos = guardado;
+        }
+
+        if (detener)
+            return 1;
+    }
+    return 0;
+}
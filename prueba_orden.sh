@@ -0,0 +1,49 @@
+#!/bin/sh
+#
+# Prueba que los comandos de una conexión se ejecutan en el orden en que se
+# enviaron, aunque haya varios hilos manager. Cada cliente envía de un tirón
+# "cre qN", "des", "sus qN" y "mis": si el des se ejecutara después del sus,
+# o el mis antes del sus, la lista de salas suscritas no sería solo "qN".
+#
+# Modo de uso: [OPCIONES="<opciones de schat>"] ./prueba_orden.sh [puerto]
+#              [clientes]
+
+PUERTO=${1:-20123}
+CLIENTES=${2:-40}
+SALIDA=$(mktemp -d)
+
+./schat -p "$PUERTO" -w 8 $OPCIONES > /dev/null &
+SERVIDOR=$!
+trap 'kill $SERVIDOR 2> /dev/null; rm -rf "$SALIDA"' EXIT
+sleep 1
+
+i=0
+clientes=""
+while [ $i -lt "$CLIENTES" ]; do
+    printf 'cre q%d\ndes\nsus q%d\nmis\n' $i $i |
+        ./cchat -h localhost -p "$PUERTO" -n "u$i" > "$SALIDA/u$i" &
+    clientes="$clientes $!"
+    i=$((i + 1))
+done
+wait $clientes
+
+fallas=0
+i=0
+while [ $i -lt "$CLIENTES" ]; do
+    # Lo que sigue al encabezado de la última lista, hasta la línea vacía
+    salas=$(awk '/^LISTA DE SALAS SUSCRITAS$/ { n = NR; s = "" }
+                 n && NR > n + 1 && /^$/ { n = 0 }
+                 n && NR > n + 1 { s = s $0 " " }
+                 END { print s }' "$SALIDA/u$i")
+    if [ "$salas" != "\"q$i\" " ]; then
+        echo "u$i: salas suscritas: $salas"
+        fallas=$((fallas + 1))
+    fi
+    i=$((i + 1))
+done
+
+if [ $fallas -gt 0 ]; then
+    echo "prueba_orden: $fallas de $CLIENTES conexiones fuera de orden."
+    exit 1
+fi
+echo "prueba_orden: $CLIENTES conexiones en orden."
@@ -5,28 +5,65 @@
  *
  * Programa principal del servidor. Escucha peticiones por un puerto y un
  * socket específico que determina el usuario al invocar el programa. Crea un
- * hilo manager que maneja las solicitudes el cliente y crea un hilo por cada
- * conexión que se establece.
+ * conjunto fijo de hilos manager que manejan las solicitudes de los clientes
+ * (repartidas según el usuario) y un conjunto fijo de hilos reactores (epoll)
+ * que atienden, cada uno, muchas conexiones no bloqueantes.
  * 
  */
 
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <netinet/in.h>
+#include <sys/un.h>
 #include <signal.h>
 #include <pthread.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <stdint.h>
+#include <netdb.h>
 
 #include "errors.h"
 #include "lista.c"
+#include "tabla.c"
+#include "buffer.c"
+#include "metricas.c"
+#include "compresion.c"
+#include "envio.c"
+#include "historial.c"
+#include "bitacora.c"
+#include "instantanea.c"
+#include "protocolo.c"
+#include "anillo.c"
 
 #define QUEUELENGTH 5
 #define MAXLENGTH 500
 #define MAXLENGTH_USER 25
+#define MAXEVENTOS 64
+#define ESPERA_ESCRITURA 1000
+#define CUBETAS_INICIALES 64
+#define TAMANO_LECTURA 65536
+#define ENTRADAS_ANILLO 128
+#define TAMANO_LECTURA_ANILLO 16384
+#define BLOQUES_ANILLO 64
+#define LIMITE_SALIDA 1048576
+#define FACTOR_LIMITE_PAR 16
+#define HISTORIAL 32
+#define MAX_HISTORIAL 65536
+#define POLITICA_DESCARTAR 0
+#define POLITICA_DESCONECTAR 1
+#define POLITICA_MARCAR 2
+#define NUM_ORDENES (OP_FUERA + 1)
+#define TAMANO_INDICE_ORDENES 32
+#define INTERVALO_ENLACE 1
 
 //------------------------------------------------------- Variables globales -//
 
@@ -46,6 +83,14 @@ char *sala_pedida = "actual";
  */
 char *salida;
 
+/**
+ * \var ultimo_id
+ * \brief Último identificador asignado a una sala o a un usuario.
+ *
+ * Los identificadores se usan en el protocolo binario.
+ */
+unsigned int ultimo_id = 0;
+
 /**
  * \var puerto
  * \brief Puerto por el que escucha el servidor.
@@ -53,10 +98,50 @@ char *salida;
 int puerto;
 
 /**
- * \var sockfd
- * \brief Socket por el que el servidor escucha peticiones.
+ * \var sockets_escucha
+ * \brief Sockets por los que el servidor escucha peticiones, uno por
+ *        aceptador.
+ */
+int *sockets_escucha;
+
+/**
+ * \var ruta_local
+ * \brief Ruta del socket local (AF_UNIX) por el que también se aceptan
+ *        conexiones (opción -x), o NULL si no se usa.
+ */
+char *ruta_local = NULL;
+
+/**
+ * \var socket_local
+ * \brief Socket de escucha local, o -1 si no se usa.
+ */
+int socket_local = -1;
+
+/**
+ * \var num_aceptadores
+ * \brief Cantidad de hilos que aceptan conexiones (opción -n).
+ *
+ * Cada uno tiene su propio socket con SO_REUSEPORT y el núcleo reparte las
+ * conexiones entrantes entre ellos. Por defecto se usa uno por cada
+ * procesador en línea.
+ */
+int num_aceptadores = 0;
+
+/**
+ * \var largo_cola
+ * \brief Conexiones que pueden esperar en la cola de cada socket de escucha
+ *        (opción -k).
+ *
+ * El sistema lo limita a net.core.somaxconn.
+ */
+int largo_cola = SOMAXCONN;
+
+/**
+ * \var siguiente_reactor
+ * \brief Contador con el que los aceptadores reparten las conexiones entre
+ *        los reactores por turnos.
  */
-int sockfd;
+unsigned int siguiente_reactor = 0;
 
 /**
  * \var ret_value
@@ -65,47 +150,314 @@ int sockfd;
 int ret_value;
 
 /**
- * \var lista_global_salas
- * \brief Lista de salas del servidor.
+ * \var tabla_global_salas
+ * \brief Tabla de salas del servidor, indexada por nombre.
+ *
+ * Además de buscar, agregar y eliminar salas en tiempo constante, la tabla
+ * mantiene el orden de creación de las salas para listarlas.
  */
-lista lista_global_salas;
+tabla tabla_global_salas;
 
 /**
- * \var cola_global_comandos
- * \brief Cola de los comandos de la cual lee el hilo manager.
+ * \var tabla_global_usuarios
+ * \brief Directorio de usuarios del sistema, indexado por nombre.
+ *
+ * Esta tabla contiene todos los usuarios que ya completaron el saludo inicial
+ * (es decir, que tienen un nombre asignado).
  */
-lista cola_global_comandos;
+tabla tabla_global_usuarios;
 
 /**
- * \var lista_global_hilos_usuarios
- * \brief Lista de hilos y usuarios.
- * 
- * Esta lista contiene todos los usuarios del sistema y el hilo asignado a cada
- * uno, de manera que cada elemento de la lista coincide con un hilo y un
- * cliente del servidor.
+ * \var largo_maximo
+ * \brief Largo máximo de una línea enviada por un cliente (opción -l).
+ *
+ * Lo que pase de este largo se descarta.
+ */
+int largo_maximo = MAXLENGTH;
+
+/**
+ * \var limite_salida
+ * \brief Bytes que pueden quedar pendientes en la cola de salida de un
+ *        usuario antes de aplicarle politica_lentos (opción -q).
+ */
+int limite_salida = LIMITE_SALIDA;
+
+/**
+ * \var politica_lentos
+ * \brief Qué se hace con un usuario que no lee a tiempo (opción -d).
+ *
+ * POLITICA_DESCARTAR descarta sus mensajes más antiguos, POLITICA_DESCONECTAR
+ * cierra su conexión y POLITICA_MARCAR lo marca como rezagado: se le omiten
+ * los mensajes nuevos hasta que vacíe la mitad de su cola, y entonces se le
+ * avisa cuántos se perdió.
+ */
+int politica_lentos = POLITICA_DESCARTAR;
+
+/**
+ * \var capacidad_historial
+ * \brief Cantidad de mensajes que guarda el historial de cada sala
+ *        (opción -m).
+ *
+ * Si es 0 las salas no guardan historial.
+ */
+int capacidad_historial = HISTORIAL;
+
+/**
+ * \var puerto_admin
+ * \brief Puerto local en el que se publican las métricas (opción -a).
+ *
+ * Si es 0 no se abre el puerto de administración.
+ */
+int puerto_admin = 0;
+
+/**
+ * \var num_reactores
+ * \brief Cantidad de hilos reactores (opción -r).
+ *
+ * Por defecto se usa un reactor por cada procesador en línea.
+ */
+int num_reactores = 0;
+
+/**
+ * \var reactores
+ * \brief Arreglo con los num_reactores reactores del servidor.
+ */
+struct reactor *reactores;
+
+/**
+ * \var usar_anillo
+ * \brief Indica si los reactores leen y escriben con io_uring (opción -u).
+ *
+ * Si el núcleo no tiene io_uring, se vuelve a 0 al crear los reactores. Si
+ * después falla el anillo de un reactor, solo ese reactor deja de usarlo
+ * (ver desactivar_anillo).
+ */
+int usar_anillo = 0;
+
+/**
+ * \var num_managers
+ * \brief Cantidad de hilos manager (opción -w).
+ *
+ * Por defecto se usa un manager por cada procesador en línea.
+ */
+int num_managers = 0;
+
+/**
+ * \var managers
+ * \brief Arreglo con los num_managers hilos manager del servidor.
+ */
+struct manager *managers;
+
+/**
+ * \var rwlock_salas
+ * \brief Semáforo de lectores y escritores que bloquea la tabla de salas.
+ *
+ * Solo se toma para escribir al crear o eliminar una sala; buscar una sala
+ * (para suscribirse) o listarlas solo necesita leer. Los miembros de cada
+ * sala tienen su propio semáforo.
+ */
+pthread_rwlock_t rwlock_salas;
+
+/**
+ * \var rwlock_usuarios
+ * \brief Semáforo de lectores y escritores que bloquea el directorio de
+ *        usuarios.
+ */
+pthread_rwlock_t rwlock_usuarios;
+
+/**
+ * \var clave_federacion
+ * \brief Clave que deben presentar los enlaces entre servidores (opción -g;
+ *        NULL si el servidor no se federa).
  */
-lista lista_global_hilos_usuarios;
+char *clave_federacion = NULL;
 
 /**
- * \var tid_manager
- * \brief Thread ID del hilo manager.
+ * \var direcciones_pares
+ * \brief Direcciones ("host:puerto") de los servidores a los que este abre
+ *        un enlace (opción -v, una vez por servidor).
  */
-pthread_t tid_manager;
+char **direcciones_pares = NULL;
 
 /**
- * \var mutex_comandos
- * \brief Semáforo que bloquea la cola de comandos.
+ * \var num_direcciones_pares
+ * \brief Cantidad de elementos de direcciones_pares.
  */
-pthread_mutex_t mutex_comandos;
+int num_direcciones_pares = 0;
 
 /**
- * \var mutex_salas
- * \brief Semáforo que bloquea la lista de salas.
+ * \var pares
+ * \brief Enlaces abiertos con otros servidores (structs par, enlazados por
+ *        en_pares).
+ */
+lista_doble pares;
+
+/**
+ * \var rwlock_pares
+ * \brief Semáforo de lectores y escritores que bloquea la lista de pares y
+ *        las salas de interés de cada uno.
+ *
+ * Reenviar un mensaje o anunciar una sala solo lee; abrir o cerrar un
+ * enlace, o que un par cambie sus salas de interés, escribe.
+ */
+pthread_rwlock_t rwlock_pares = PTHREAD_RWLOCK_INITIALIZER;
+
+/*
+ * Orden de los semáforos
+ * ----------------------
+ *
+ * Un hilo que necesite más de uno debe tomarlos en este orden (y nunca al
+ * revés):
+ *
+ *   1. rwlock_salas
+ *   2. usuario->mutex_suscripciones
+ *   3. sala->rwlock_miembros
+ *   4. sala->historial.mutex
+ *   5. rwlock_pares
+ *   6. usuario->mutex_socket
+ *   7. reactor->mutex_pendientes
+ *
+ * rwlock_usuarios y manager->mutex_comandos no se toman junto con ningún
+ * otro (salvo al terminar el servidor, que toma los mutex_socket con
+ * rwlock_usuarios bloqueado; ver terminar_servidor), y los semáforos de la
+ * bitácora (bitacora.c) y mutex_guardadas (instantanea.c) se toman últimos.
+ * Con io_uring, un reactor toma a la vez los mutex_socket de varios de sus
+ * usuarios, pero sin tener ningún otro semáforo y sin pedir otro mientras
+ * los tiene (vaciar_lote_anillo). Así, por ejemplo, enviar un mensaje
+ * (2 -> 3 -> 6 -> 7) o desuscribirse de todas las salas (2 -> 3) no
+ * bloquean la tabla de salas, y dos usuarios que se suscriben a salas
+ * distintas solo comparten la lectura de rwlock_salas.
  */
-pthread_mutex_t mutex_salas;
 
 //------------------------------------------------ Definición de estructuras -//
 
+/**
+ * \struct reactor
+ * \brief Struct que representa un hilo de eventos (epoll).
+ *
+ * Cada reactor es dueño de un conjunto de sockets no bloqueantes, que le son
+ * asignados por el hilo principal al aceptar las conexiones.
+ */
+typedef struct reactor {
+
+    /**
+     * \var hilo
+     * \brief Thread ID del hilo que ejecuta el reactor.
+     */
+    pthread_t hilo;
+
+    /**
+     * \var epollfd
+     * \brief Descriptor de la instancia de epoll del reactor.
+     */
+    int epollfd;
+
+    /**
+     * \var lectura
+     * \brief Bloque de TAMANO_LECTURA bytes en el que se lee de los sockets.
+     *
+     * Lo comparten todas las conexiones del reactor; solo las líneas
+     * incompletas se copian al buffer de cada usuario. Tiene un byte más al
+     * final, que separar_tramas usa para terminar la carga en nulo.
+     */
+    char *lectura;
+
+    /**
+     * \var eventfd
+     * \brief Descriptor con el que otros hilos despiertan al reactor.
+     */
+    int eventfd;
+
+    /**
+     * \var pendientes
+     * \brief Usuarios del reactor con salida pendiente por escribir.
+     *
+     * El reactor vacía sus colas de salida al final de cada vuelta, así que
+     * todos los mensajes que recibió un usuario en esa vuelta se escriben
+     * con un solo writev.
+     */
+    lista pendientes;
+
+    /**
+     * \var mutex_pendientes
+     * \brief Semáforo que bloquea la lista de pendientes.
+     */
+    pthread_mutex_t mutex_pendientes;
+
+    /**
+     * \var anillo
+     * \brief Anillo de io_uring del reactor (solo si usar_anillo).
+     */
+    anillo anillo;
+
+    /**
+     * \var con_anillo
+     * \brief Indica si el reactor todavía usa su anillo: empieza igual a
+     *        usar_anillo y se vuelve 0 si io_uring_enter falla.
+     */
+    int con_anillo;
+
+    /**
+     * \var lecturas
+     * \brief MAXEVENTOS bloques de TAMANO_LECTURA_ANILLO + 1 bytes, uno por
+     *        cada evento de una vuelta, para las lecturas con el anillo.
+     */
+    char *lecturas;
+
+    /**
+     * \var bloques
+     * \brief ENTRADAS_ANILLO grupos de BLOQUES_ANILLO iovec, uno por cada
+     *        escritura de un lote, para las escrituras con el anillo.
+     */
+    struct iovec *bloques;
+
+} reactor;
+
+
+/**
+ * \struct manager
+ * \brief Struct que representa un hilo manager y su cola de comandos.
+ *
+ * Los comandos se reparten entre los managers según el hash del nombre del
+ * usuario que los envía, así que los comandos de una misma conexión se
+ * ejecutan en el orden en que llegaron y los de usuarios distintos pueden
+ * ejecutarse en paralelo. Los comandos sobre una misma sala se ordenan con
+ * los semáforos de las salas.
+ */
+typedef struct manager {
+
+    /**
+     * \var hilo
+     * \brief Thread ID del hilo manager.
+     */
+    pthread_t hilo;
+
+    /**
+     * \var cola
+     * \brief Cola de los comandos de la cual lee el hilo manager.
+     *
+     * Los comandos se enlazan por en_cola, así que encolar no pide memoria
+     * aparte ni recorre la cola.
+     */
+    lista_doble cola;
+
+    /**
+     * \var mutex_comandos
+     * \brief Semáforo que bloquea la cola de comandos.
+     */
+    pthread_mutex_t mutex_comandos;
+
+    /**
+     * \var hay_comandos
+     * \brief Variable de condición en la que duerme el hilo manager.
+     *
+     * Se señala cada vez que la cola de comandos pasa de vacía a no vacía.
+     */
+    pthread_cond_t hay_comandos;
+
+} manager;
+
+
 /**
  * \struct usuario
  * \brief Struct que representa un usuario del sistema.
@@ -127,15 +479,172 @@ typedef struct {
     /**
      * \var mutex_socket
      * \brief Semáforo que bloquea el socket por el que se comunica el cliente.
+     *
+     * También protege la cola de salida y las banderas de envío del usuario.
      */
     pthread_mutex_t mutex_socket;
+
+    /**
+     * \var salida_pendiente
+     * \brief Cola de lo que falta por escribir en el socket.
+     */
+    cola_envio salida_pendiente;
+
+    /**
+     * \var programado
+     * \brief Indica si el usuario ya está en los pendientes de su reactor.
+     */
+    int programado;
+
+    /**
+     * \var en_lote
+     * \brief Indica si el usuario ya está en el grupo que su reactor va a
+     *        escribir con el anillo (solo lo usa el reactor).
+     *
+     * Un usuario puede quedar dos veces en los pendientes si el reactor lo
+     * vacía por EPOLLOUT y en la misma vuelta recibe otro mensaje; con el
+     * anillo se toma su mutex_socket una sola vez por grupo.
+     */
+    int en_lote;
+
+    /**
+     * \var esperando_escritura
+     * \brief Indica si se le pidió a epoll avisar cuando el socket acepte
+     *        más datos (EPOLLOUT).
+     */
+    int esperando_escritura;
+
+    /**
+     * \var rezagado
+     * \brief Indica si se le están omitiendo mensajes (POLITICA_MARCAR).
+     */
+    int rezagado;
+
+    /**
+     * \var omitidos
+     * \brief Cantidad de mensajes que se le han descartado u omitido.
+     */
+    int omitidos;
+
+    /**
+     * \var desconectar
+     * \brief Indica que su reactor debe cerrar la conexión
+     *        (POLITICA_DESCONECTAR).
+     */
+    int desconectar;
+
+    /**
+     * \var comandos_pendientes
+     * \brief Comandos del usuario encolados en su manager que todavía no se
+     *        han ejecutado.
+     *
+     * Se modifica con mutex_socket bloqueado. Solo el reactor lo aumenta, así
+     * que si el reactor lee 0, no hay ningún comando pendiente.
+     */
+    int comandos_pendientes;
+
+    /**
+     * \var cierre_pendiente
+     * \brief Indica que la conexión se cierra en cuanto el manager termine
+     *        los comandos pendientes (fue, o el cliente cerró su lado).
+     *
+     * Mientras tanto, el reactor no lee más del socket. Solo lo modifica el
+     * reactor, con mutex_socket bloqueado.
+     */
+    int cierre_pendiente;
+
+    /**
+     * \var despedida_pendiente
+     * \brief Indica si el cierre pendiente es una despedida (fue).
+     */
+    int despedida_pendiente;
     
     /**
      * \var lista_salas_suscritas
-     * \brief Lista de salas a las que está suscrito el usuario.
+     * \brief Suscripciones del usuario (enlazadas por en_usuario).
      */
-    lista lista_salas_suscritas;
-    
+    lista_doble lista_salas_suscritas;
+
+    /**
+     * \var mutex_suscripciones
+     * \brief Semáforo que bloquea la lista de salas suscritas del usuario.
+     *
+     * Mientras se tiene, ninguna de las salas de la lista puede liberarse.
+     */
+    pthread_mutex_t mutex_suscripciones;
+
+    /**
+     * \var reactor
+     * \brief Reactor que atiende el socket del usuario.
+     */
+    reactor *reactor;
+
+    /**
+     * \var entrada
+     * \brief Línea incompleta que se está leyendo del socket.
+     */
+    buffer_entrada entrada;
+
+    /**
+     * \var registrado
+     * \brief Indica si el usuario ya tiene un nombre aceptado.
+     */
+    int registrado;
+
+    /**
+     * \var negociado
+     * \brief Indica si ya se leyó el primer byte de la conexión, que decide
+     *        el protocolo.
+     */
+    int negociado;
+
+    /**
+     * \var binario
+     * \brief Indica si el cliente usa el protocolo binario (protocolo.c).
+     */
+    int binario;
+
+    /**
+     * \var comprimido
+     * \brief Indica si el cliente pidió que su salida se comprima
+     *        (compresion.c).
+     *
+     * Desde ese momento todo lo que se encola para él es la versión
+     * comprimida de cada mensaje.
+     */
+    int comprimido;
+
+    /**
+     * \var id
+     * \brief Identificador del usuario en el protocolo binario.
+     */
+    unsigned int id;
+
+    /**
+     * \var cerrado
+     * \brief Indica si la conexión del usuario ya fue cerrada.
+     *
+     * Se modifica con mutex_suscripciones y mutex_socket bloqueados, de
+     * manera que basta con tener cualquiera de los dos para leerlo.
+     */
+    int cerrado;
+
+    /**
+     * \var referencias
+     * \brief Cantidad de referencias vivas al usuario.
+     *
+     * El reactor tiene una referencia y cada comando encolado otra. El
+     * usuario se libera cuando la última referencia se suelta.
+     */
+    int referencias;
+
+    /**
+     * \var par
+     * \brief Enlace con otro servidor que usa esta conexión (NULL si es un
+     *        cliente).
+     */
+    struct par *par;
+
 } usuario;
 
 
@@ -150,799 +659,3817 @@ typedef struct {
      * \brief Nombre de la sala.
      */
     char *nombre_sala;
+
+    /**
+     * \var id
+     * \brief Identificador de la sala en el protocolo binario.
+     */
+    unsigned int id;
     
     /**
      * \var lista_usuarios_activos
-     * \brief Lista de usuarios que están suscritos a la sala.
+     * \brief Suscripciones de los usuarios de la sala (enlazadas por
+     *        en_sala).
+     */
+    lista_doble lista_usuarios_activos;
+
+    /**
+     * \var rwlock_miembros
+     * \brief Semáforo de lectores y escritores que bloquea la lista de
+     *        usuarios activos.
+     *
+     * Enviar un mensaje a la sala solo lee la lista; suscribirse o
+     * desuscribirse la modifica.
+     */
+    pthread_rwlock_t rwlock_miembros;
+
+    /**
+     * \var historial
+     * \brief Últimos mensajes de la sala, que se le reenvían a quien se
+     *        suscribe.
      */
-    lista lista_usuarios_activos;
+    historial historial;
     
 } sala;
 
 
 /**
- * \struct comando
- * \brief Struct que representa un comando que envía cada usuario conectado.
- * 
- * Estos comandos son manejados por el hilo manager en una cola de comandos.
+ * \struct par
+ * \brief Struct que representa el enlace con otro servidor de la federación.
+ *
+ * Un enlace es una conexión del protocolo binario entre dos servidores, que
+ * se usa en ambos sentidos. Cada lado le anuncia al otro las salas en las que
+ * tiene miembros, y solo le reenvía los mensajes de las salas que el otro le
+ * anunció: un mensaje cruza cada enlace una sola vez, sin importar cuántos
+ * miembros tenga la sala del otro lado.
  */
-typedef struct {
-    
+typedef struct par {
+
     /**
-     * \var texto
-     * \brief Texto del comando.
+     * \var direccion
+     * \brief Dirección ("host:puerto") a la que se conecta este servidor, o
+     *        NULL si el enlace lo abrió el otro.
+     *
+     * Los enlaces salientes los mantiene un hilo que vuelve a conectarse
+     * cuando se cierran, así que su par no se libera; el de un enlace
+     * entrante se libera al cerrarse la conexión.
      */
-    char *texto;
-    
+    char *direccion;
+
     /**
-     * \var sender
-     * \brief Usuario que envía el comando.
+     * \var conexion
+     * \brief Conexión del enlace (NULL mientras no esté conectado).
      */
-    usuario *sender;
-    
-} comando;
+    usuario *conexion;
 
+    /**
+     * \var intereses
+     * \brief Salas en las que el otro servidor tiene miembros, indexadas por
+     *        nombre (cada elemento es su propia clave).
+     */
+    tabla intereses;
 
-/**
- * \struct hilo_usuario
- * \brief Struct que representa un hilo y un usuario asociado a una conexión.
- */
-typedef struct {
-    
     /**
-     * \var hilo
-     * \brief Thread ID del hilo que maneja una conexión.
+     * \var en_lista
+     * \brief Indica si el par está en la lista de pares.
      */
-    pthread_t hilo;
-    
+    int en_lista;
+
     /**
-     * \var cliente
-     * \brief Usuario que representa el cliente que crea una conexión.
+     * \var en_pares
+     * \brief Enlace en la lista de pares.
      */
-    usuario *cliente;
-    
-} hilo_usuario;
+    enlace en_pares;
+
+} par;
 
 
 /**
- * \struct param_hc
- * \brief Envuelve un hilo_usuario para pasarlo como parámetro a un hilo.
+ * \struct suscripcion
+ * \brief Struct que representa la suscripción de un usuario a una sala.
+ *
+ * Está a la vez en la lista de salas suscritas del usuario y en la lista de
+ * usuarios activos de la sala, así que se puede quitar de cualquiera de las
+ * dos en O(1). Cada lado se modifica con el semáforo de su dueño; la
+ * suscripción se libera cuando se sueltan las dos referencias (una por
+ * lado).
  */
 typedef struct {
-    
+
     /**
-     * \var hilo_cliente
-     * \brief Parámetro que se pasa a un hilo asociado a un cliente.
-     * 
-     * El hilo maneja esta conexión con un nuevo cliente, utilizando los
-     * atributos del hilo_usuario pasado como parámetro mediante esta
-     * estructura.
+     * \var s
+     * \brief Sala a la que está suscrito el usuario.
      */
-    hilo_usuario *hilo_cliente;
-    
-} param_hc;
+    sala *s;
 
+    /**
+     * \var user
+     * \brief Usuario suscrito.
+     */
+    usuario *user;
 
-//------------------------------------------------------------------ Métodos -//
+    /**
+     * \var en_usuario
+     * \brief Enlace en lista_salas_suscritas del usuario.
+     */
+    enlace en_usuario;
 
-/**
- * hilos_iguales
- * 
- * @brief Compara dos estructuras hilo_usuario.
- * 
- * @param h1 Nombre del usuario.
- * @param h2 Estructura hilo_usuario a comparar.
- * @return 1 si son iguales y 0 si son diferentes.
- * 
- * Compara el nombre del cliente de una estructura hilo_usuario con un nombre de
- * usuario pasado como parámetro.
- */
+    /**
+     * \var en_sala
+     * \brief Enlace en lista_usuarios_activos de la sala.
+     */
+    enlace en_sala;
 
-int hilos_iguales(void *h1, void *h2) {
-    char *hilo1 = (char *) h1;
-    hilo_usuario *hilo2 = (hilo_usuario *) h2;
-    return (!strcmp(hilo1,hilo2->cliente->nombre_usuario));
-}
+    /**
+     * \var con_usuario
+     * \brief Indica si sigue en la lista del usuario (mutex_suscripciones).
+     */
+    int con_usuario;
+
+    /**
+     * \var con_sala
+     * \brief Indica si sigue en la lista de la sala (rwlock_miembros).
+     */
+    int con_sala;
+
+    /**
+     * \var referencias
+     * \brief Lados (usuario y sala) que todavía usan la suscripción.
+     */
+    int referencias;
+
+} suscripcion;
 
 
 /**
- * salas_iguales
- * 
- * @brief Compara dos salas.
- * 
- * @param s1 Nombre de la sala.
- * @param s2 Sala a comparar.
- * @return 1 si son iguales y 0 si son diferentes.
+ * \struct orden
+ * \brief Struct que describe un comando del servidor en la tabla ordenes.
+ *
+ * El mismo comando se puede pedir por texto (con su nombre de tres letras) o
+ * con una trama del protocolo binario (con su código de operación).
+ */
+typedef struct {
+
+    /**
+     * \var nombre
+     * \brief Nombre de tres letras del comando en el protocolo de texto.
+     */
+    char *nombre;
+
+    /**
+     * \var op
+     * \brief Código de operación del comando (lo completa
+     *        crear_indice_ordenes).
+     */
+    int op;
+
+    /**
+     * \var argumento
+     * \brief Indica si el comando lleva un argumento (separado por un
+     *        espacio en el protocolo de texto).
+     */
+    int argumento;
+
+    /**
+     * \var en_manager
+     * \brief Indica si el comando lo ejecuta un hilo manager; si no, lo
+     *        ejecuta el reactor que lo recibió.
+     */
+    int en_manager;
+
+    /**
+     * \var por_sala
+     * \brief Indica si el argumento es el nombre de una sala (y no puede
+     *        faltar).
+     */
+    int por_sala;
+
+    /**
+     * \var ejecutar
+     * \brief Función que ejecuta el comando. Recibe al usuario, el argumento
+     *        y el identificador de la trama (0 en el protocolo de texto), y
+     *        devuelve 1 si cerró la conexión.
+     */
+    int (*ejecutar)(usuario *, char *, unsigned int);
+
+} orden;
+
+
+/**
+ * \struct comando
+ * \brief Struct que representa un comando que envía cada usuario conectado.
  * 
- * Compara el nombre de una sala con el nombre pasado como parámetro.
+ * Estos comandos son manejados por el hilo manager en una cola de comandos.
+ * El comando ya viene reconocido: el manager no vuelve a leer el texto.
+ */
+typedef struct {
+    
+    /**
+     * \var orden
+     * \brief Entrada de la tabla ordenes del comando.
+     */
+    orden *orden;
+
+    /**
+     * \var argumento
+     * \brief Argumento del comando (reservado junto con el struct).
+     */
+    char *argumento;
+
+    /**
+     * \var en_cola
+     * \brief Enlace en la cola de comandos de su manager.
+     */
+    enlace en_cola;
+    
+    /**
+     * \var sender
+     * \brief Usuario que envía el comando.
+     */
+    usuario *sender;
+
+    /**
+     * \var recibido
+     * \brief Instante en que se encoló el comando (para las métricas).
+     */
+    long long recibido;
+
+    /**
+     * \var id
+     * \brief Identificador de la trama (0 en el protocolo de texto).
+     */
+    unsigned int id;
+    
+} comando;
+
+
+//------------------------------------------------------------------ Métodos -//
+
+/**
+ * retener_usuario
+ *
+ * @brief Agrega una referencia a un usuario.
+ *
+ * @param user Usuario a retener.
+ */
+
+void retener_usuario(usuario *user) {
+    __sync_fetch_and_add(&user->referencias, 1);
+}
+
+
+/**
+ * soltar_usuario
+ *
+ * @brief Suelta una referencia a un usuario.
+ *
+ * @param user Usuario a soltar.
+ *
+ * Si era la última referencia, se libera la memoria del usuario. Para ese
+ * momento el socket ya fue cerrado y el usuario ya no está en ninguna lista.
+ */
+
+void soltar_usuario(usuario *user) {
+    if (__sync_sub_and_fetch(&user->referencias, 1) == 0) {
+        pthread_mutex_destroy(&user->mutex_socket);
+        pthread_mutex_destroy(&user->mutex_suscripciones);
+        destruir_cola_envio(&user->salida_pendiente);
+        free(user->nombre_usuario);
+        destruir_buffer(&user->entrada);
+        free(user);
+    }
+}
+
+
+/**
+ * soltar_suscripcion
+ *
+ * @brief Suelta una de las dos referencias de una suscripción.
+ *
+ * @param susc Suscripción a soltar.
+ *
+ * Se llama después de quitarla de la lista del usuario o de la de la sala;
+ * cuando ya no está en ninguna de las dos, se libera.
+ */
+
+void soltar_suscripcion(suscripcion *susc) {
+    if (__sync_sub_and_fetch(&susc->referencias, 1) == 0)
+        free(susc);
+}
+
+
+/**
+ * programar_envio
+ *
+ * @brief Agrega un usuario a los pendientes de su reactor.
+ *
+ * @param user Usuario con salida pendiente.
+ *
+ * La lista retiene una referencia al usuario. Solo se despierta al reactor
+ * (con su eventfd) si la lista estaba vacía y quien llama no es el propio
+ * reactor: en cualquier otro caso el reactor ya va a revisar sus pendientes.
+ */
+
+void programar_envio(usuario *user) {
+
+    reactor *r = user->reactor;
+    uint64_t uno = 1;
+    int despertar;
+
+    retener_usuario(user);
+
+    pthread_mutex_lock(&r->mutex_pendientes);
+    despertar = lista_vacia(r->pendientes) &&
+                !pthread_equal(pthread_self(), r->hilo);
+    agregar_principio(&r->pendientes, user);
+    pthread_mutex_unlock(&r->mutex_pendientes);
+
+    if (despertar)
+        write(r->eventfd, &uno, sizeof(uno));
+}
+
+
+/**
+ * version_para
+ *
+ * @brief Elige la versión de un mensaje que se encola para un usuario.
+ *
+ * @param user Usuario al que se le escribe.
+ * @param men Mensaje sin comprimir.
+ * @return El mismo mensaje, o su versión comprimida si el usuario pidió la
+ *         compresión (NULL si no se pudo comprimir).
+ *
+ * La versión comprimida se guarda en el mensaje, así que un mensaje de sala
+ * se comprime una sola vez para todos sus miembros comprimidos.
+ */
+
+mensaje *version_para(usuario *user, mensaje *men) {
+
+    mensaje *comprimido;
+
+    if (!user->comprimido)
+        return men;
+
+    comprimido = mensaje_comprimido(men);
+    if (comprimido == NULL)
+        fprintf(stderr, "No se pudo comprimir un mensaje.\n");
+    return comprimido;
+}
+
+
+/**
+ * agregar_usuario
+ *
+ * @brief Agrega una copia de un texto a la cola de salida de un usuario,
+ *        comprimida si él lo pidió. Se debe tener su mutex_socket bloqueado.
+ *
+ * @param user Usuario al que se le escribe.
+ * @param datos Texto a agregar.
+ * @param largo Cantidad de bytes del texto.
+ */
+
+void agregar_usuario(usuario *user, char *datos, int largo) {
+
+    mensaje *men = crear_mensaje(largo), *version;
+
+    if (men == NULL) {
+        fprintf(stderr, "No se puede asignar memoria.\n");
+        return;
+    }
+
+    memcpy(men->datos, datos, largo);
+    version = version_para(user, men);
+    if (version != NULL && encolar_mensaje(&user->salida_pendiente, version))
+        fprintf(stderr, "No se puede asignar memoria.\n");
+    soltar_mensaje(men);
+}
+
+
+/**
+ * enviar_compartido
+ *
+ * @brief Encola un mensaje para escribirlo en el socket de un usuario.
+ *
+ * @param user Usuario al que se le escribe.
+ * @param men Mensaje a escribir. No se copia: la cola toma una referencia.
+ *
+ * El reactor dueño del socket escribe el mensaje cuando pueda, así que quien
+ * envía nunca se bloquea por un cliente lento. Si la cola pasaría de
+ * limite_salida bytes, se aplica politica_lentos. Un enlace con otro
+ * servidor lleva los mensajes de muchos usuarios, así que su límite es
+ * FACTOR_LIMITE_PAR veces mayor y no se le aplica politica_lentos: si aun
+ * así no cabe, solo se pierde este mensaje y se cuenta en reenvios_perdidos.
+ * Si la conexión ya fue cerrada, no se encola nada. A un usuario comprimido
+ * se le encola la versión comprimida del mensaje.
+ */
+
+void enviar_compartido(usuario *user, mensaje *men) {
+
+    int programar = 0;
+    int largo;
+    int descartados;
+
+    if (user == NULL)
+        return;
+
+    men = version_para(user, men);
+    if (men == NULL)
+        return;
+    largo = men->largo;
+
+    pthread_mutex_lock(&user->mutex_socket);
+
+    if (user->cerrado || user->desconectar) {
+        pthread_mutex_unlock(&user->mutex_socket);
+        return;
+    }
+
+    if (user->rezagado) {
+        user->omitidos++;
+        mis_metricas()->omitidos++;
+        pthread_mutex_unlock(&user->mutex_socket);
+        return;
+    }
+
+    if (user->par != NULL) {
+        if (user->salida_pendiente.bytes + largo >
+            (long long) limite_salida * FACTOR_LIMITE_PAR) {
+            mis_metricas()->reenvios_perdidos++;
+            largo = 0;
+        }
+    } else if (user->salida_pendiente.bytes + largo > limite_salida) {
+        if (politica_lentos == POLITICA_DESCARTAR) {
+            descartados = descartar_antiguos(&user->salida_pendiente,
+                                             limite_salida - largo);
+            user->omitidos += descartados;
+            mis_metricas()->omitidos += descartados;
+        } else if (politica_lentos == POLITICA_DESCONECTAR) {
+            user->desconectar = 1;
+            largo = 0;
+        } else {
+            user->rezagado = 1;
+            user->omitidos++;
+            mis_metricas()->omitidos++;
+            largo = 0;
+        }
+    }
+
+    if (largo > 0 && encolar_mensaje(&user->salida_pendiente, men))
+        fprintf(stderr, "No se puede asignar memoria.\n");
+
+    if (!user->programado) {
+        user->programado = 1;
+        programar = 1;
+    }
+
+    pthread_mutex_unlock(&user->mutex_socket);
+
+    if (programar)
+        programar_envio(user);
+}
+
+
+/**
+ * enviar_usuario
+ *
+ * @brief Encola una copia de un texto para escribirlo en el socket de un
+ *        usuario.
+ *
+ * @param user Usuario al que se le escribe.
+ * @param texto Texto a escribir.
+ * @param largo Cantidad de bytes de texto.
+ */
+
+void enviar_usuario(usuario *user, char *texto, int largo) {
+
+    mensaje *men;
+
+    if (user == NULL)
+        return;
+
+    men = crear_mensaje(largo);
+    if (men == NULL) {
+        fprintf(stderr, "No se puede asignar memoria.\n");
+        return;
+    }
+
+    memcpy(men->datos, texto, largo);
+    enviar_compartido(user, men);
+    soltar_mensaje(men);
+}
+
+
+/**
+ * enviar_respuesta
+ *
+ * @brief Le responde a un usuario según el protocolo que use.
+ *
+ * @param user Usuario al que se le responde (si es NULL no se hace nada).
+ * @param op Código de la respuesta en el protocolo binario (RES_*).
+ * @param id Identificador de la sala o del usuario al que se refiere.
+ * @param texto Respuesta para un cliente de texto; si es NULL, a un cliente
+ *              de texto no se le responde nada.
+ * @param carga Carga de la trama para un cliente binario.
+ */
+
+void enviar_respuesta(usuario *user, int op, unsigned int id, char *texto,
+                      char *carga) {
+
+    mensaje *men;
+    int largo;
+
+    if (user == NULL)
+        return;
+
+    if (!user->binario) {
+        if (texto != NULL)
+            enviar_usuario(user, texto, strlen(texto));
+        return;
+    }
+
+    largo = strlen(carga);
+    men = crear_mensaje(TAMANO_CABECERA + largo);
+    if (men == NULL) {
+        fprintf(stderr, "No se puede asignar memoria.\n");
+        return;
+    }
+
+    escribir_cabecera(men->datos, op, id, largo);
+    memcpy(men->datos + TAMANO_CABECERA, carga, largo);
+    enviar_compartido(user, men);
+    soltar_mensaje(men);
+}
+
+
+/**
+ * enviar_historial
+ *
+ * @brief Encola para un usuario todos los mensajes del historial de una
+ *        sala.
+ *
+ * @param user Usuario que se acaba de suscribir a la sala.
+ * @param s Sala cuyo historial se envía. Quien llama debe tener su
+ *          rwlock_miembros bloqueado para escribir, de manera que nadie
+ *          agregue mensajes al historial mientras tanto.
+ *
+ * Los mensajes se encolan todos con una sola toma del semáforo del socket,
+ * en el formato del protocolo del usuario (comprimidos, si los pidió), y el
+ * reactor los escribe juntos con un solo writev. Si no caben todos en
+ * limite_salida, se omiten los más antiguos. A un usuario rezagado no se le
+ * envía nada.
+ */
+
+void enviar_historial(usuario *user, sala *s) {
+
+    historial *h = &s->historial;
+    entrada_historial *e;
+    mensaje *men;
+    int i, primero, bytes;
+    int programar = 0;
+
+    if (h->cantidad == 0)
+        return;
+
+    pthread_mutex_lock(&user->mutex_socket);
+
+    if (user->cerrado || user->desconectar || user->rezagado) {
+        pthread_mutex_unlock(&user->mutex_socket);
+        return;
+    }
+
+    // Se buscan, desde el más reciente, los mensajes que caben en la cola
+    bytes = user->salida_pendiente.bytes;
+    for (primero = h->cantidad; primero > 0; primero--) {
+        e = entrada_historial_en(h, capacidad_historial, primero - 1);
+        men = version_para(user, user->binario ? e->trama : e->texto);
+        if (men == NULL || bytes + men->largo > limite_salida)
+            break;
+        bytes += men->largo;
+    }
+
+    for (i = primero; i < h->cantidad; i++) {
+        e = entrada_historial_en(h, capacidad_historial, i);
+        men = version_para(user, user->binario ? e->trama : e->texto);
+        if (encolar_mensaje(&user->salida_pendiente, men)) {
+            fprintf(stderr, "No se puede asignar memoria.\n");
+            break;
+        }
+    }
+
+    if (i > primero && !user->programado) {
+        user->programado = 1;
+        programar = 1;
+    }
+
+    pthread_mutex_unlock(&user->mutex_socket);
+
+    if (programar)
+        programar_envio(user);
+}
+
+
+/**
+ * anunciar_interes
+ *
+ * @brief Les avisa a todos los servidores pares que este servidor empezó (o
+ *        dejó) de tener miembros en una sala.
+ *
+ * @param nombre_sala Nombre de la sala.
+ * @param op OP_INTERES u OP_SIN_INTERES.
+ *
+ * Todos los pares comparten la misma trama. Quien llama tiene bloqueado para
+ * escribir el semáforo de los miembros de la sala, así que los avisos de una
+ * sala salen en el mismo orden en que cambió su lista de miembros.
+ */
+
+void anunciar_interes(char *nombre_sala, int op) {
+
+    mensaje *men;
+    enlace *aux;
+    int largo = strlen(nombre_sala);
+
+    pthread_rwlock_rdlock(&rwlock_pares);
+
+    if (pares.primero != NULL) {
+        men = crear_mensaje(TAMANO_CABECERA + largo);
+        if (men == NULL) {
+            fprintf(stderr, "No se puede asignar memoria.\n");
+        } else {
+            escribir_cabecera(men->datos, op, 0, largo);
+            memcpy(men->datos + TAMANO_CABECERA, nombre_sala, largo);
+            for (aux = pares.primero; aux != NULL; aux = aux->siguiente)
+                enviar_compartido(contenedor(aux, par, en_pares)->conexion,
+                                  men);
+            soltar_mensaje(men);
+        }
+    }
+
+    pthread_rwlock_unlock(&rwlock_pares);
+}
+
+
+/**
+ * anunciar_intereses
+ *
+ * @brief Le avisa a un servidor par recién conectado todas las salas en las
+ *        que este servidor tiene miembros.
+ *
+ * @param conexion Conexión del enlace, que ya está en la lista de pares.
+ *
+ * Como el par ya está en la lista, una sala que gane o pierda su primer
+ * miembro mientras tanto también se le avisa con anunciar_interes; cada sala
+ * se revisa con el semáforo de sus miembros, así que el último aviso de cada
+ * sala siempre es el que corresponde a su estado.
  */
 
-int salas_iguales(void *s1, void *s2) {
-    char *sala1 = (char *) s1;
-    sala *sala2 = (sala *) s2;
-    return (!strcmp(sala1,sala2->nombre_sala));
+void anunciar_intereses(usuario *conexion) {
+
+    celda *c;
+    sala *s;
+
+    pthread_rwlock_rdlock(&rwlock_salas);
+
+    for (c = tabla_global_salas.primera; c != NULL; c = c->siguiente) {
+        s = (sala *) c->elemento;
+        pthread_rwlock_rdlock(&s->rwlock_miembros);
+        if (s->lista_usuarios_activos.largo > 0)
+            enviar_respuesta(conexion, OP_INTERES, 0, NULL, s->nombre_sala);
+        pthread_rwlock_unlock(&s->rwlock_miembros);
+    }
+
+    pthread_rwlock_unlock(&rwlock_salas);
+}
+
+
+/**
+ * crear_par
+ *
+ * @brief Crea el par de un enlace, sin salas de interés.
+ *
+ * @param direccion Dirección del otro servidor, o NULL si el enlace es
+ *                  entrante.
+ * @return El par, o NULL si no se pudo asignar memoria.
+ */
+
+par *crear_par(char *direccion) {
+
+    par *p = calloc(1, sizeof(par));
+
+    if (p == NULL || crear_tabla(&p->intereses, CUBETAS_INICIALES)) {
+        fprintf(stderr, "No se puede asignar memoria.\n");
+        free(p);
+        return NULL;
+    }
+
+    p->direccion = direccion;
+    return p;
+}
+
+
+/**
+ * olvidar_intereses
+ *
+ * @brief Vacía las salas de interés de un par. Se debe tener rwlock_pares
+ *        bloqueado para escribir.
+ *
+ * @param p Par.
+ */
+
+void olvidar_intereses(par *p) {
+    while (p->intereses.primera != NULL)
+        free(eliminar_tabla(&p->intereses, p->intereses.primera->clave));
+}
+
+
+/**
+ * unirse_pares
+ *
+ * @brief Agrega un enlace recién abierto a la lista de pares.
+ *
+ * @param p Par del enlace.
+ * @param conexion Conexión del enlace.
+ *
+ * Si la conexión ya se cerró (retirar_par ya pasó), no se agrega.
+ */
+
+void unirse_pares(par *p, usuario *conexion) {
+
+    pthread_rwlock_wrlock(&rwlock_pares);
+    if (!conexion->cerrado) {
+        agregar_final_doble(&pares, &p->en_pares);
+        p->en_lista = 1;
+    }
+    pthread_rwlock_unlock(&rwlock_pares);
+}
+
+
+/**
+ * retirar_par
+ *
+ * @brief Saca de la lista de pares el enlace de una conexión que se cierra.
+ *
+ * @param user Conexión que se cierra (si no es un enlace no se hace nada).
+ *
+ * Las salas de interés se olvidan: al volver a conectarse, el otro servidor
+ * las anuncia de nuevo. El par de un enlace entrante se libera.
+ */
+
+void retirar_par(usuario *user) {
+
+    par *p = user->par;
+
+    if (p == NULL)
+        return;
+
+    pthread_rwlock_wrlock(&rwlock_pares);
+    if (p->en_lista) {
+        quitar_doble(&pares, &p->en_pares);
+        p->en_lista = 0;
+    }
+    olvidar_intereses(p);
+    p->conexion = NULL;
+    pthread_rwlock_unlock(&rwlock_pares);
+
+    user->par = NULL;
+
+    if (p->direccion == NULL) {
+        destruir_tabla(&p->intereses);
+        free(p);
+    }
+}
+
+
+/**
+ * nueva_sala
+ *
+ * @brief Crea una sala vacía y la agrega a la tabla de salas.
+ *
+ * @param nombre Nombre de la sala (se copia). No debe existir otra sala con
+ *               ese nombre.
+ * @return La sala, o NULL si no se pudo asignar memoria.
+ *
+ * Quien llama debe tener rwlock_salas bloqueado para escribir.
+ */
+
+sala *nueva_sala(char *nombre) {
+
+    sala *nueva = malloc(sizeof(sala));
+
+    if (nueva == NULL) {
+        fprintf(stderr, "No se puede asignar memoria.\n");
+        return NULL;
+    }
+
+    nueva->nombre_sala = strdup(nombre);
+    nueva->id = __sync_add_and_fetch(&ultimo_id, 1);
+    crear_lista_doble(&nueva->lista_usuarios_activos);
+    pthread_rwlock_init(&nueva->rwlock_miembros, NULL);
+    crear_historial(&nueva->historial);
+
+    if (nueva->nombre_sala == NULL ||
+        insertar_tabla(&tabla_global_salas, nueva->nombre_sala, nueva) != 0) {
+        fprintf(stderr, "No se puede asignar memoria.\n");
+        pthread_rwlock_destroy(&nueva->rwlock_miembros);
+        destruir_historial(&nueva->historial, capacidad_historial);
+        free(nueva->nombre_sala);
+        free(nueva);
+        return NULL;
+    }
+
+    return nueva;
+}
+
+
+/**
+ * crear_sala
+ * 
+ * @brief Crea una nueva sala y la agrega a la lista global de salas.
+ * 
+ * @param sala_agregar Nombre de la sala nueva.
+ * @param user Usuario que solicita crear la sala.
+ * 
+ * Crea una nueva sala mediante un malloc, le asigna una copia del nombre
+ * pasado como parámetro y la agrega a la tabla de salas. Al agregar a la tabla
+ * se bloquea el semáforo correspondiente en caso de que otro procedimiento
+ * esté accediendo a la misma tabla. Si ocurre algún error o
+ * la sala ya existe, el procedimiento le escribe directamente al socket del
+ * usuario que ejecutó el comando.
+ */
+
+void crear_sala(char *sala_agregar, usuario *user) {
+    
+    pthread_rwlock_wrlock(&rwlock_salas);
+
+    if (buscar_tabla(&tabla_global_salas, sala_agregar) != NULL) {
+        
+        enviar_respuesta(user, RES_ERROR, 0, "\nLa sala ya existe.\n\n",
+                         "La sala ya existe.");
+        
+        pthread_rwlock_unlock(&rwlock_salas);
+        return;
+    }
+    
+    sala *nueva = nueva_sala(sala_agregar);
+
+    if (nueva != NULL)
+        enviar_respuesta(user, RES_OK, nueva->id, NULL, nueva->nombre_sala);
+    
+    pthread_rwlock_unlock(&rwlock_salas);
+}
+
+
+/**
+ * eliminar_sala
+ * 
+ * @brief Elimina una sala de la lista global de salas.
+ * 
+ * @param sala_eliminar Nombre de la sala a eliminar.
+ * @param user Usuario que solicita eliminar la sala.
+ * 
+ * Busca en la tabla de salas la que se solicita eliminar, la saca de las
+ * salas suscritas de cada uno de sus usuarios y libera su memoria. Al
+ * eliminar de la tabla se bloquea rwlock_salas para escribir, de manera que
+ * nadie más puede encontrar la sala. Las suscripciones se sacan de la sala
+ * con el semáforo de la sala y luego de las salas suscritas de cada miembro
+ * con su propio semáforo (respetando el orden de los semáforos); cada
+ * miembro se retiene mientras tanto, por si se desconecta.
+ * Si la sala no existe, el procedimiento le escribe directamente al socket
+ * del usuario que ejecutó el comando.
+ */
+
+void eliminar_sala(char *sala_eliminar, usuario *user) {
+    
+    pthread_rwlock_wrlock(&rwlock_salas);
+    
+    sala *s = (sala *) eliminar_tabla(&tabla_global_salas, sala_eliminar);
+    suscripcion *susc;
+    usuario *miembro;
+    lista_doble miembros;
+    enlace *aux;
+    
+    if (s != NULL) {
+        // Las suscripciones se pasan a una lista local por su enlace en_sala
+        crear_lista_doble(&miembros);
+        pthread_rwlock_wrlock(&s->rwlock_miembros);
+        while ((aux = s->lista_usuarios_activos.primero) != NULL) {
+            susc = contenedor(aux, suscripcion, en_sala);
+            quitar_doble(&s->lista_usuarios_activos, aux);
+            susc->con_sala = 0;
+            retener_usuario(susc->user);
+            agregar_final_doble(&miembros, aux);
+        }
+        if (miembros.largo > 0)
+            anunciar_interes(s->nombre_sala, OP_SIN_INTERES);
+        pthread_rwlock_unlock(&s->rwlock_miembros);
+        
+        while ((aux = miembros.primero) != NULL) {
+            quitar_doble(&miembros, aux);
+            susc = contenedor(aux, suscripcion, en_sala);
+            miembro = susc->user;
+
+            pthread_mutex_lock(&miembro->mutex_suscripciones);
+            if (susc->con_usuario) {
+                quitar_doble(&miembro->lista_salas_suscritas,
+                             &susc->en_usuario);
+                susc->con_usuario = 0;
+                soltar_suscripcion(susc);
+            }
+            pthread_mutex_unlock(&miembro->mutex_suscripciones);
+
+            soltar_suscripcion(susc);
+            soltar_usuario(miembro);
+        }
+        
+        enviar_respuesta(user, RES_OK, s->id, NULL, s->nombre_sala);
+
+        pthread_rwlock_destroy(&s->rwlock_miembros);
+        destruir_historial(&s->historial, capacidad_historial);
+        free(s->nombre_sala);
+        free(s);
+        
+    } else {
+        enviar_respuesta(user, RES_ERROR, 0, "\nLa sala no existe.\n\n",
+                         "La sala no existe.");
+    }
+    
+    pthread_rwlock_unlock(&rwlock_salas);
+}
+
+
+/**
+ * suscribir_usuario
+ * 
+ * @brief Suscribe un usuario a una sala.
+ * 
+ * @param sala_suscribir Nombre de la sala a suscribir.
+ * @param user Usuario que solicita suscribirse a la sala.
+ * 
+ * Busca en la tabla de salas la que se solicita. Una vez encontrada, se crea
+ * una suscripción que se agrega al inicio de la lista de usuarios activos de
+ * esa sala y al inicio de las salas suscritas del usuario.
+ * La tabla de salas solo se bloquea para leer, así que muchos usuarios pueden
+ * suscribirse al mismo tiempo; las listas se modifican con los semáforos del
+ * usuario y de la sala. Antes de soltar el semáforo de la sala se le
+ * reenvía su historial, así que el usuario no se pierde ni recibe dos veces
+ * ningún mensaje. Si ocurre algún error o la sala no existe, el
+ * procedimiento le escribe directamente al socket del usuario que ejecutó el
+ * comando. Si la conexión del usuario ya se cerró, no se hace nada.
+ */
+
+void suscribir_usuario(char *sala_suscribir, usuario *user) {
+    
+    suscripcion *susc;
+    enlace *aux;
+
+    pthread_rwlock_rdlock(&rwlock_salas);
+    pthread_mutex_lock(&user->mutex_suscripciones);
+
+    if (user->cerrado) {
+        pthread_mutex_unlock(&user->mutex_suscripciones);
+        pthread_rwlock_unlock(&rwlock_salas);
+        return;
+    }
+
+    sala *actual = (sala *) buscar_tabla(&tabla_global_salas, sala_suscribir);
+            
+    if (actual != NULL) {
+        for (aux = user->lista_salas_suscritas.primero; aux != NULL;
+             aux = aux->siguiente)
+            if (contenedor(aux, suscripcion, en_usuario)->s == actual)
+                break;
+
+        if (aux == NULL) {
+            susc = malloc(sizeof(suscripcion));
+
+            if (susc == NULL) {
+                fprintf(stderr, "No se puede asignar memoria.\n");
+            } else {
+                susc->s = actual;
+                susc->user = user;
+                susc->con_usuario = 1;
+                susc->con_sala = 1;
+                susc->referencias = 2;
+
+                agregar_inicio_doble(&user->lista_salas_suscritas,
+                                     &susc->en_usuario);
+                pthread_rwlock_wrlock(&actual->rwlock_miembros);
+                agregar_inicio_doble(&actual->lista_usuarios_activos,
+                                     &susc->en_sala);
+                if (actual->lista_usuarios_activos.largo == 1)
+                    anunciar_interes(actual->nombre_sala, OP_INTERES);
+                enviar_respuesta(user, RES_OK, actual->id, NULL,
+                                 actual->nombre_sala);
+                enviar_historial(user, actual);
+                pthread_rwlock_unlock(&actual->rwlock_miembros);
+            }
+        
+        } else {
+            enviar_respuesta(user, RES_ERROR, actual->id,
+                             "\nYa estás suscrito.\n\n", "Ya estás suscrito.");
+        }
+    } else {
+        enviar_respuesta(user, RES_ERROR, 0, "\nLa sala no existe.\n\n",
+                         "La sala no existe.");
+    }
+    
+    pthread_mutex_unlock(&user->mutex_suscripciones);
+    pthread_rwlock_unlock(&rwlock_salas);
+}
+
+
+/**
+ * restaurar_suscripciones
+ *
+ * @brief Suscribe a un usuario que se acaba de registrar a las salas que
+ *        tenía según la instantánea.
+ *
+ * @param user Usuario registrado.
+ * @return 1 si el usuario estaba en la instantánea, 0 si no.
+ *
+ * Las salas que ya no existen se ignoran. Las suscripciones guardadas se
+ * descartan después de usarlas, así que solo se restauran la primera vez
+ * que el usuario se conecta.
+ */
+
+int restaurar_suscripciones(usuario *user) {
+
+    suscripciones_guardadas *g;
+    int i, existe;
+
+    if (archivo_instantanea == NULL)
+        return 0;
+
+    g = tomar_guardadas(user->nombre_usuario);
+    if (g == NULL)
+        return 0;
+
+    for (i = 0; i < g->cantidad; i++) {
+        pthread_rwlock_rdlock(&rwlock_salas);
+        existe = buscar_tabla(&tabla_global_salas, g->salas[i]) != NULL;
+        pthread_rwlock_unlock(&rwlock_salas);
+        if (existe)
+            suscribir_usuario(g->salas[i], user);
+    }
+
+    liberar_guardadas(g);
+    return 1;
+}
+
+
+/**
+ * desuscribir_usuario
+ * 
+ * @brief De-suscribe al usuario de todas las salas.
+ * 
+ * @param user Usuario que solicita de-suscribirse a la sala.
+ * 
+ * Elimina al usuario de todas las salas a las que está suscrito, recorriendo
+ * sus suscripciones y quitando cada una de su sala en O(1), así que el costo
+ * solo depende de la cantidad de salas suscritas.
+ * 
+ * Solo se bloquean las suscripciones del usuario y, una a la vez, cada una
+ * de sus salas; la tabla de salas no se bloquea, así que los demás usuarios
+ * pueden seguir suscribiéndose mientras tanto.
+ */
+
+void desuscribir_usuario(usuario *user) {
+    
+    pthread_mutex_lock(&user->mutex_suscripciones);
+    
+    enlace *aux;
+    suscripcion *susc;
+    sala *s;
+
+    while ((aux = user->lista_salas_suscritas.primero) != NULL) {
+        susc = contenedor(aux, suscripcion, en_usuario);
+        s = susc->s;
+
+        pthread_rwlock_wrlock(&s->rwlock_miembros);
+        if (susc->con_sala) {
+            quitar_doble(&s->lista_usuarios_activos, &susc->en_sala);
+            susc->con_sala = 0;
+            soltar_suscripcion(susc);
+            if (s->lista_usuarios_activos.largo == 0)
+                anunciar_interes(s->nombre_sala, OP_SIN_INTERES);
+        }
+        pthread_rwlock_unlock(&s->rwlock_miembros);
+
+        quitar_doble(&user->lista_salas_suscritas, aux);
+        susc->con_usuario = 0;
+        soltar_suscripcion(susc);
+    }
+    
+    pthread_mutex_unlock(&user->mutex_suscripciones);
+}
+
+
+/**
+ * eliminar_usuario
+ * 
+ * @brief Elimina un usuario del sistema.
+ * 
+ * @param user Usuario que se va a eliminar.
+ * 
+ * La función marca la conexión del usuario como cerrada (a partir de aquí no
+ * se le escribe nada más ni se le puede suscribir a salas), lo desuscribe de
+ * todas las salas, lo saca de los pares si es un enlace con otro servidor y
+ * después lo elimina del directorio de usuarios.
+ */
+
+void eliminar_usuario(usuario *user) {
+
+    pthread_mutex_lock(&user->mutex_suscripciones);
+    pthread_mutex_lock(&user->mutex_socket);
+    user->cerrado = 1;
+    pthread_mutex_unlock(&user->mutex_socket);
+    pthread_mutex_unlock(&user->mutex_suscripciones);
+
+    desuscribir_usuario(user);
+    retirar_par(user);
+
+    if (user->registrado) {
+        pthread_rwlock_wrlock(&rwlock_usuarios);
+        eliminar_tabla(&tabla_global_usuarios, user->nombre_usuario);
+        pthread_rwlock_unlock(&rwlock_usuarios);
+    }
+}
+
+
+/**
+ * agregar_nombre_sala
+ * 
+ * @brief Copia el nombre de una sala entre comillas al final de un texto.
+ * 
+ * @param fin Posición del texto donde se copia el nombre.
+ * @param nombre Nombre de la sala.
+ * @return Nueva posición del final del texto.
+ */
+
+char *agregar_nombre_sala(char *fin, char *nombre) {
+    int largo = strlen(nombre);
+    
+    *fin++ = '"';
+    memcpy(fin, nombre, largo);
+    fin += largo;
+    *fin++ = '"';
+    *fin++ = '\n';
+    return fin;
+}
+
+
+/**
+ * imprimir_lista_salas
+ * 
+ * @brief Imprime una lista de salas.
+ * 
+ * @param user Usuario que desea imprimir una lista de salas.
+ * @param sistema Variable de control que indica si son las salas del sistema.
+ * 
+ * En caso de que la variable sistema sea 1, imprime el encabezado y las salas
+ * del sistema, recorriendo la tabla de salas de la más reciente a la más
+ * antigua (el orden es estable: no depende del hash). En caso de que sea 0,
+ * imprime la lista de salas a las que está suscrito el usuario. Al recorrer
+ * la tabla de salas solo se bloquea rwlock_salas para leer, y al recorrer las
+ * salas suscritas solo se bloquean las suscripciones del usuario, así que
+ * ninguno de los dos casos detiene a otros lectores.
+ * 
+ * La lista de salas (vacía o no) se arma completa en memoria y se envía de
+ * una sola vez al socket del usuario que ejecuta el comando. A un cliente
+ * binario se le envía como una trama RES_LISTA, sin encabezado.
+ */
+
+void imprimir_lista_salas(usuario *user, int sistema) {
+    
+    celda *c;
+    enlace *aux;
+    sala *s;
+    char *texto, *fin;
+    char *(*agregar)(char *, char *);
+    int largo = 57;
+
+    agregar = user->binario ? agregar_campo : agregar_nombre_sala;
+
+    if (sistema)
+        pthread_rwlock_rdlock(&rwlock_salas);
+    else
+        pthread_mutex_lock(&user->mutex_suscripciones);
+
+    if (sistema) {
+        for (c = tabla_global_salas.ultima; c != NULL; c = c->anterior)
+            largo += strlen(c->clave) + 3;
+    } else {
+        for (aux = user->lista_salas_suscritas.primero; aux != NULL;
+             aux = aux->siguiente)
+            largo += strlen(contenedor(aux, suscripcion, en_usuario)->s->
+                            nombre_sala) + 3;
+    }
+
+    texto = malloc(largo);
+
+    if (texto == NULL) {
+        fprintf(stderr, "No se puede asignar memoria.\n");
+        if (sistema)
+            pthread_rwlock_unlock(&rwlock_salas);
+        else
+            pthread_mutex_unlock(&user->mutex_suscripciones);
+        return;
+    }
+    
+    if (user->binario)
+        fin = texto + TAMANO_CABECERA;
+    else if (sistema)
+        fin = stpcpy(texto, "\nLISTA DE SALAS DEL SISTEMA\n================\
+==========\n");
+    else
+        fin = stpcpy(texto, "\nLISTA DE SALAS SUSCRITAS\n==================\
+======\n");
+
+    if (sistema) {
+        for (c = tabla_global_salas.ultima; c != NULL; c = c->anterior)
+            fin = agregar(fin, c->clave);
+    } else {
+        for (aux = user->lista_salas_suscritas.primero; aux != NULL;
+             aux = aux->siguiente) {
+            s = contenedor(aux, suscripcion, en_usuario)->s;
+            fin = agregar(fin, s->nombre_sala);
+        }
+    }
+    
+    if (user->binario)
+        escribir_cabecera(texto, RES_LISTA, 0, fin - texto - TAMANO_CABECERA);
+    else
+        *fin++ = '\n';
+    
+    if (sistema)
+        pthread_rwlock_unlock(&rwlock_salas);
+    else
+        pthread_mutex_unlock(&user->mutex_suscripciones);
+
+    enviar_usuario(user, texto, fin - texto);
+    free(texto);
+}
+
+
+/**
+ * listar_usuarios
+ * 
+ * @brief Imprime la lista de usuarios del sistema.
+ * 
+ * @param user Usuario que desea imprimir una lista de salas.
+ * 
+ * La función recorre el directorio de usuarios del sistema, del más reciente
+ * al más antiguo, y arma con cada nombre un texto que se envía de una sola
+ * vez al socket del usuario que ejecuta el comando (a un cliente binario, como
+ * una trama RES_LISTA).
+ */
+
+void listar_usuarios(usuario *user) {
+    
+    celda *c;
+    char *fin;
+    int largo = 62;
+    int largo_nombre;
+    
+    pthread_rwlock_rdlock(&rwlock_usuarios);
+    
+    for (c = tabla_global_usuarios.ultima; c != NULL; c = c->anterior)
+        largo += strlen(c->clave) + 1;
+
+    char *texto = malloc(largo);
+
+    if (texto == NULL) {
+        fprintf(stderr, "No se puede asignar memoria.\n");
+        pthread_rwlock_unlock(&rwlock_usuarios);
+        return;
+    }
+    
+    if (user->binario)
+        fin = texto + TAMANO_CABECERA;
+    else
+        fin = stpcpy(texto, "\nLISTA DE USUARIOS DEL SISTEMA\n=============\
+================\n");
+    
+    for (c = tabla_global_usuarios.ultima; c != NULL; c = c->anterior) {
+        largo_nombre = strlen(c->clave);
+        memcpy(fin, c->clave, largo_nombre);
+        fin += largo_nombre;
+        *fin++ = user->binario ? '\0' : '\n';
+    }
+    
+    if (user->binario)
+        escribir_cabecera(texto, RES_LISTA, 0, fin - texto - TAMANO_CABECERA);
+    else
+        *fin++ = '\n';
+
+    pthread_rwlock_unlock(&rwlock_usuarios);
+
+    enviar_usuario(user, texto, fin - texto);
+    free(texto);
+}
+
+
+/**
+ * formatear_texto
+ *
+ * @brief Arma el mensaje de sala para los clientes de texto.
+ *
+ * @param nombre_usuario Nombre del usuario que envía el mensaje.
+ * @param s Sala a la que se envía.
+ * @param mens Texto del mensaje.
+ * @return El mensaje "\n>> usuario@sala: mensaje\n" con una referencia, o
+ *         NULL si no se pudo asignar memoria.
+ */
+
+mensaje *formatear_texto(char *nombre_usuario, sala *s, char *mens) {
+
+    int largo_usuario = strlen(nombre_usuario);
+    int largo_sala = strlen(s->nombre_sala);
+    int largo_mens = strlen(mens);
+    mensaje *men;
+    char *fin;
+
+    men = crear_mensaje(largo_usuario + largo_sala + largo_mens + 8);
+    if (men == NULL) {
+        fprintf(stderr, "No se puede asignar memoria.\n");
+        return NULL;
+    }
+
+    fin = men->datos;
+    memcpy(fin, "\n>> ", 4);
+    fin += 4;
+    memcpy(fin, nombre_usuario, largo_usuario);
+    fin += largo_usuario;
+    *fin++ = '@';
+    memcpy(fin, s->nombre_sala, largo_sala);
+    fin += largo_sala;
+    memcpy(fin, ": ", 2);
+    fin += 2;
+    memcpy(fin, mens, largo_mens);
+    fin += largo_mens;
+    *fin = '\n';
+    return men;
+}
+
+
+/**
+ * formatear_trama
+ *
+ * @brief Arma el mensaje de sala para los clientes binarios.
+ *
+ * @param nombre_usuario Nombre del usuario que envía el mensaje.
+ * @param s Sala a la que se envía.
+ * @param mens Texto del mensaje.
+ * @return La trama RES_MENSAJE con una referencia, o NULL si no se pudo
+ *         asignar memoria.
+ */
+
+mensaje *formatear_trama(char *nombre_usuario, sala *s, char *mens) {
+
+    mensaje *men;
+    char *fin;
+
+    men = crear_mensaje(TAMANO_CABECERA + strlen(nombre_usuario) +
+                        strlen(s->nombre_sala) + strlen(mens) + 3);
+    if (men == NULL) {
+        fprintf(stderr, "No se puede asignar memoria.\n");
+        return NULL;
+    }
+
+    escribir_cabecera(men->datos, RES_MENSAJE, s->id,
+                      men->largo - TAMANO_CABECERA);
+    fin = men->datos + TAMANO_CABECERA;
+    fin = agregar_campo(fin, nombre_usuario);
+    fin = agregar_campo(fin, s->nombre_sala);
+    agregar_campo(fin, mens);
+    return men;
+}
+
+
+/**
+ * reenviar_a_pares
+ *
+ * @brief Reenvía un mensaje de sala a los servidores pares que tienen
+ *        miembros en esa sala.
+ *
+ * @param nombre Nombre del usuario que envió el mensaje.
+ * @param s Sala del mensaje.
+ * @param mens Texto del mensaje.
+ * @param trama Trama RES_MENSAJE del mensaje; si apunta a NULL, se arma
+ *              aquí (y quien llama la suelta).
+ *
+ * Cada par recibe una sola copia, que comparte la trama con los clientes
+ * binarios de la sala.
+ */
+
+void reenviar_a_pares(char *nombre, sala *s, char *mens, mensaje **trama) {
+
+    enlace *aux;
+    par *p;
+
+    pthread_rwlock_rdlock(&rwlock_pares);
+
+    for (aux = pares.primero; aux != NULL; aux = aux->siguiente) {
+        p = contenedor(aux, par, en_pares);
+        if (buscar_tabla(&p->intereses, s->nombre_sala) == NULL)
+            continue;
+        if (*trama == NULL)
+            *trama = formatear_trama(nombre, s, mens);
+        if (*trama == NULL)
+            break;
+        enviar_compartido(p->conexion, *trama);
+        mis_metricas()->reenvios++;
+    }
+
+    pthread_rwlock_unlock(&rwlock_pares);
+}
+
+
+/**
+ * difundir_mensaje
+ *
+ * @brief Reparte un mensaje entre los miembros de una sala.
+ *
+ * @param nombre Nombre del usuario que envía el mensaje.
+ * @param s Sala a la que se envía; quien llama se asegura de que no se
+ *          elimine mientras tanto.
+ * @param mens Texto del mensaje.
+ * @param reenviar Indica si el mensaje también se reenvía a los servidores
+ *                 pares (0 si vino de uno de ellos).
+ *
+ * Los miembros se recorren con el semáforo de la sala bloqueado para leer,
+ * así que varios usuarios pueden enviar mensajes a la misma sala a la vez.
+ *
+ * El texto ">> usuario@sala: mensaje" (o la trama RES_MENSAJE, para los
+ * clientes binarios) se arma una sola vez y todos los miembros comparten ese
+ * mismo mensaje en sus colas de salida; se libera cuando el último de ellos
+ * termina de escribirlo. Los pares con miembros en la sala reciben la misma
+ * trama, una vez cada uno. Si las salas guardan historial, se arman los dos
+ * formatos y el historial de la sala retiene ambos. Si hay bitácora, el
+ * mensaje solo se copia a su buffer en memoria. El tiempo de repartirlo se
+ * cuenta en las métricas.
+ */
+
+void difundir_mensaje(char *nombre, sala *s, char *mens, int reenviar) {
+
+    mensaje *complemento_mensaje = NULL, *trama = NULL, *men;
+    usuario *user_act;
+    enlace *user_nod;
+    metricas *m = mis_metricas();
+    long long inicio = reloj();
+
+    pthread_rwlock_rdlock(&s->rwlock_miembros);
+
+    user_nod = s->lista_usuarios_activos.primero;
+
+    // por cada usuario en la sala
+    while(user_nod != NULL){
+        user_act = contenedor(user_nod, suscripcion, en_sala)->user;
+        user_nod = user_nod->siguiente;
+
+        if (user_act->binario && trama == NULL)
+            trama = formatear_trama(nombre, s, mens);
+        else if (!user_act->binario && complemento_mensaje == NULL)
+            complemento_mensaje = formatear_texto(nombre, s, mens);
+
+        men = user_act->binario ? trama : complemento_mensaje;
+        if (men == NULL)
+            continue;
+
+        enviar_compartido(user_act, men);
+        m->entregas++;
+    }
+
+    if (reenviar)
+        reenviar_a_pares(nombre, s, mens, &trama);
+
+    if (capacidad_historial > 0) {
+        if (trama == NULL)
+            trama = formatear_trama(nombre, s, mens);
+        if (complemento_mensaje == NULL)
+            complemento_mensaje = formatear_texto(nombre, s, mens);
+        if (trama != NULL && complemento_mensaje != NULL &&
+            agregar_historial(&s->historial, capacidad_historial,
+                              complemento_mensaje, trama))
+            fprintf(stderr, "No se puede asignar memoria.\n");
+    }
+
+    if (directorio_bitacora != NULL)
+        agregar_bitacora(nombre, s->nombre_sala, mens);
+
+    if (complemento_mensaje != NULL)
+        soltar_mensaje(complemento_mensaje);
+    if (trama != NULL)
+        soltar_mensaje(trama);
+
+    pthread_rwlock_unlock(&s->rwlock_miembros);
+    observar(&m->difusion, reloj() - inicio);
+}
+
+
+/**
+ * enviar_mensaje
+ * 
+ * @brief Envía un mensaje de parte de un usuario.
+ * 
+ * @param user Usuario que desea imprimir una lista de salas.
+ * @param mens Mensaje a enviar (sin el comando).
+ * @param id_sala Si no es 0, el mensaje solo se envía a la sala con ese
+ *                identificador (protocolo binario).
+ * 
+ * La función recibe un usuario y un mensaje a enviar. Recorre la lista de
+ * salas suscritas del usuario y por cada sala suscrita reparte el mensaje
+ * con difundir_mensaje, incluyéndolo a él mismo. Las salas suscritas se
+ * recorren con las suscripciones del usuario bloqueadas.
+ */
+
+void enviar_mensaje(usuario *user, char *mens, unsigned int id_sala){
+
+    enlace *nodo_sala_usuario;
+    sala *aux_sala_usuario;//auxiliar para moverse por las salas del user
+
+    pthread_mutex_lock(&user->mutex_suscripciones);
+
+    nodo_sala_usuario = user->lista_salas_suscritas.primero;
+
+    // por cada sala en el usuario
+    while(nodo_sala_usuario != NULL){
+        
+        aux_sala_usuario = contenedor(nodo_sala_usuario, suscripcion,
+                                      en_usuario)->s;
+        nodo_sala_usuario = nodo_sala_usuario->siguiente;
+
+        if (id_sala != 0 && aux_sala_usuario->id != id_sala)
+            continue;
+
+        difundir_mensaje(user->nombre_usuario, aux_sala_usuario, mens, 1);
+    }
+
+    pthread_mutex_unlock(&user->mutex_suscripciones);
+}
+
+
+/**
+ * entregar_remoto
+ *
+ * @brief Reparte un mensaje que reenvió un servidor par entre los miembros
+ *        locales de la sala.
+ *
+ * @param carga Carga de la trama RES_MENSAJE: usuario, sala y texto, cada
+ *              uno terminado en un caracter nulo.
+ * @param largo Cantidad de bytes de la carga.
+ *
+ * La sala se busca por nombre (los identificadores son de cada servidor); si
+ * no existe aquí, el mensaje se descarta. El mensaje no se vuelve a
+ * reenviar, así que nunca da vueltas entre los servidores.
+ */
+
+void entregar_remoto(char *carga, int largo) {
+
+    char *campos[3], *pos = carga, *fin = carga + largo, *nulo;
+    sala *s;
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        nulo = memchr(pos, '\0', fin - pos);
+        if (nulo == NULL)
+            return;
+        campos[i] = pos;
+        pos = nulo + 1;
+    }
+
+    pthread_rwlock_rdlock(&rwlock_salas);
+    s = (sala *) buscar_tabla(&tabla_global_salas, campos[1]);
+    if (s != NULL)
+        difundir_mensaje(campos[0], s, campos[2], 0);
+    pthread_rwlock_unlock(&rwlock_salas);
+}
+
+
+/**
+ * procesar_trama_par
+ *
+ * @brief Procesa una trama que llega por el enlace con otro servidor.
+ *
+ * @param user Conexión del enlace.
+ * @param op Código de operación de la trama.
+ * @param carga Carga de la trama, terminada en un caracter nulo.
+ * @param largo Cantidad de bytes de la carga.
+ *
+ * OP_INTERES y OP_SIN_INTERES cambian las salas de interés del par;
+ * RES_MENSAJE es un mensaje reenviado. Un RES_ERROR (por ejemplo, si el otro
+ * servidor no aceptó la clave) solo se informa; las demás tramas se
+ * ignoran.
+ */
+
+void procesar_trama_par(usuario *user, int op, char *carga, int largo) {
+
+    par *p = user->par;
+    char *nombre_sala;
+
+    if (op == RES_MENSAJE) {
+        entregar_remoto(carga, largo);
+        return;
+    }
+
+    if (op == RES_ERROR) {
+        fprintf(stderr, "Un servidor par respondió: %s\n", carga);
+        return;
+    }
+
+    if ((op != OP_INTERES && op != OP_SIN_INTERES) || largo == 0)
+        return;
+
+    pthread_rwlock_wrlock(&rwlock_pares);
+
+    if (op == OP_SIN_INTERES) {
+        free(eliminar_tabla(&p->intereses, carga));
+    } else if (buscar_tabla(&p->intereses, carga) == NULL) {
+        nombre_sala = strdup(carga);
+        if (nombre_sala == NULL ||
+            insertar_tabla(&p->intereses, nombre_sala, nombre_sala)) {
+            fprintf(stderr, "No se puede asignar memoria.\n");
+            free(nombre_sala);
+        }
+    }
+
+    pthread_rwlock_unlock(&rwlock_pares);
+}
+
+
+/**
+ * aceptar_par
+ *
+ * @brief Convierte una conexión entrante en un enlace con otro servidor, si
+ *        presenta la clave de la federación.
+ *
+ * @param user Conexión que envió OP_PAR.
+ * @param clave Clave que presentó.
+ */
+
+void aceptar_par(usuario *user, char *clave) {
+
+    par *p;
+
+    if (clave_federacion == NULL || strcmp(clave, clave_federacion)) {
+        enviar_respuesta(user, RES_ERROR, 0, NULL, "Clave incorrecta.");
+        return;
+    }
+
+    p = crear_par(NULL);
+    if (p == NULL)
+        return;
+
+    p->conexion = user;
+    user->par = p;
+    enviar_respuesta(user, RES_OK, 0, NULL, "");
+    unirse_pares(p, user);
+    anunciar_intereses(user);
+}
+
+
+/**
+ * recuperar_mensaje
+ *
+ * @brief Agrega un mensaje leído de la bitácora al historial de su sala.
+ *
+ * @param contexto No se usa.
+ * @param c Cabecera del registro.
+ * @param datos Usuario, sala y texto del registro, seguidos.
+ *
+ * Si la sala del mensaje no existe, el mensaje se ignora. Quien llama tiene
+ * rwlock_salas bloqueado para leer.
+ */
+
+void recuperar_mensaje(void *contexto, cabecera_registro *c, char *datos) {
+
+    char *usuario, *nombre_sala, *texto;
+    mensaje *complemento_mensaje, *trama;
+    sala *s;
+
+    usuario = malloc(c->largo_usuario + c->largo_sala + c->largo_texto + 3);
+    if (usuario == NULL) {
+        fprintf(stderr, "No se puede asignar memoria.\n");
+        return;
+    }
+
+    nombre_sala = usuario + c->largo_usuario + 1;
+    texto = nombre_sala + c->largo_sala + 1;
+    memcpy(usuario, datos, c->largo_usuario);
+    usuario[c->largo_usuario] = '\0';
+    memcpy(nombre_sala, datos + c->largo_usuario, c->largo_sala);
+    nombre_sala[c->largo_sala] = '\0';
+    memcpy(texto, datos + c->largo_usuario + c->largo_sala, c->largo_texto);
+    texto[c->largo_texto] = '\0';
+
+    s = (sala *) buscar_tabla(&tabla_global_salas, nombre_sala);
+    if (s != NULL) {
+        complemento_mensaje = formatear_texto(usuario, s, texto);
+        trama = formatear_trama(usuario, s, texto);
+        if (complemento_mensaje != NULL && trama != NULL)
+            agregar_historial(&s->historial, capacidad_historial,
+                              complemento_mensaje, trama);
+        if (complemento_mensaje != NULL)
+            soltar_mensaje(complemento_mensaje);
+        if (trama != NULL)
+            soltar_mensaje(trama);
+    }
+
+    free(usuario);
+}
+
+
+/**
+ * recuperar_historial
+ *
+ * @brief Llena el historial de las salas existentes con los mensajes de la
+ *        bitácora.
+ *
+ * Los segmentos se leen con mmap, del más antiguo al más reciente, así que
+ * cada sala termina con sus últimos capacidad_historial mensajes.
+ */
+
+void recuperar_historial() {
+
+    long leidos;
+
+    if (capacidad_historial == 0)
+        return;
+
+    pthread_rwlock_rdlock(&rwlock_salas);
+    leidos = leer_bitacora(recuperar_mensaje, NULL);
+    pthread_rwlock_unlock(&rwlock_salas);
+
+    printf("Se leyeron %ld mensajes de la bitácora.\n", leidos);
+}
+
+
+/**
+ * encolar_comando
+ *
+ * @brief Agrega un comando a la cola del hilo manager que le corresponde.
+ *
+ * @param sender Usuario que envía el comando (NULL si es el servidor).
+ * @param o Entrada de la tabla ordenes del comando.
+ * @param argumento Argumento del comando (NULL si no lleva); se copia.
+ * @param id Identificador de la trama (0 en el protocolo de texto).
+ *
+ * Todos los comandos de un usuario van al manager que indique el hash de su
+ * nombre, así que se ejecutan en el orden en que los envió (por ejemplo, un
+ * des seguido de un sus). Los comandos que encola el servidor van al manager
+ * que indique el hash de su argumento. El comando retiene una referencia al
+ * usuario, que el hilo manager suelta después de ejecutarlo. El argumento
+ * se copia en la misma reserva que el comando, y el comando se enlaza por su
+ * propio enlace al final de la cola, así que encolar pide memoria una sola
+ * vez y no depende del largo de la cola. Solo se despierta al hilo manager
+ * si la cola estaba vacía: si no lo estaba, el manager todavía no ha tomado
+ * el lote anterior. El comando se cuenta en los comandos_pendientes del
+ * usuario hasta que se ejecuta.
+ */
+
+void encolar_comando(usuario *sender, orden *o, char *argumento,
+                     unsigned int id) {
+
+    manager *m;
+    unsigned int h;
+
+    if (argumento == NULL)
+        argumento = "";
+
+    if (sender != NULL)
+        h = hash_cadena(sender->nombre_usuario);
+    else
+        h = hash_cadena(argumento);
+    m = &managers[h % num_managers];
+
+    comando *com = malloc(sizeof(comando) + strlen(argumento) + 1);
+
+    if (com == NULL) {
+        fprintf(stderr, "No se puede asignar memoria.\n");
+        return;
+    }
+
+    com->sender = sender;
+    com->orden = o;
+    com->recibido = reloj();
+    com->id = id;
+    com->argumento = (char *) (com + 1);
+    strcpy(com->argumento, argumento);
+
+    if (sender != NULL) {
+        retener_usuario(sender);
+        pthread_mutex_lock(&sender->mutex_socket);
+        sender->comandos_pendientes++;
+        pthread_mutex_unlock(&sender->mutex_socket);
+    }
+
+    pthread_mutex_lock(&m->mutex_comandos);
+
+    if (m->cola.largo == 0)
+        pthread_cond_signal(&m->hay_comandos);
+    agregar_final_doble(&m->cola, &com->en_cola);
+
+    pthread_mutex_unlock(&m->mutex_comandos);
+}
+
+
+//------------------------------------------------------------- Hilo manager -//
+
+/**
+ * terminar_comando
+ *
+ * @brief Descuenta un comando ejecutado de los pendientes de un usuario.
+ *
+ * @param user Usuario que envió el comando.
+ *
+ * Si era el último y la conexión tiene un cierre pendiente, se le avisa al
+ * reactor (como si tuviera salida pendiente) para que la cierre.
+ */
+
+void terminar_comando(usuario *user) {
+
+    int programar = 0;
+
+    pthread_mutex_lock(&user->mutex_socket);
+
+    user->comandos_pendientes--;
+    if (user->comandos_pendientes == 0 && user->cierre_pendiente &&
+        !user->programado) {
+        user->programado = 1;
+        programar = 1;
+    }
+
+    pthread_mutex_unlock(&user->mutex_socket);
+
+    if (programar)
+        programar_envio(user);
+}
+
+
+/**
+ * rutina_hilo_manager
+ * 
+ * @brief Función que ejecuta cada hilo manager del servidor.
+ * @param args Manager que ejecuta el hilo.
+ *
+ * El hilo duerme en hay_comandos mientras su cola esté vacía. Cuando hay
+ * trabajo, se lleva la cola completa (el lote) con una sola adquisición de
+ * mutex_comandos y la ejecuta en orden sin tener el semáforo, de manera que
+ * los productores pueden seguir encolando mientras tanto. Cada comando se
+ * ejecuta con la función de su entrada en la tabla ordenes, y su tiempo
+ * (desde que se encoló hasta que terminó) se cuenta en las métricas.
+ * 
+ * @see Proyecto 1 - Informe.pdf
+ */
+
+void *rutina_hilo_manager(void *args) {
+    
+    manager *m = (manager *) args;
+    comando *com;
+    enlace *lote, *aux;
+        
+    while (1) {
+        pthread_mutex_lock(&m->mutex_comandos);
+
+        while (m->cola.largo == 0)
+            pthread_cond_wait(&m->hay_comandos, &m->mutex_comandos);
+
+        lote = m->cola.primero;
+        crear_lista_doble(&m->cola);
+
+        pthread_mutex_unlock(&m->mutex_comandos);
+
+        while (lote != NULL) {
+            aux = lote;
+            lote = lote->siguiente;
+
+            com = contenedor(aux, comando, en_cola);
+            com->orden->ejecutar(com->sender, com->argumento, com->id);
+            observar(&mis_metricas()->comandos[com->orden->op],
+                     reloj() - com->recibido);
+
+            if (com->sender != NULL) {
+                terminar_comando(com->sender);
+                soltar_usuario(com->sender);
+            }
+            free(com);
+        }
+    }
+}
+
+
+/**
+ * crear_managers
+ *
+ * @brief Crea los num_managers hilos manager y sus colas.
+ */
+
+void crear_managers() {
+
+    int i;
+
+    managers = malloc(num_managers * sizeof(manager));
+
+    if (managers == NULL) {
+        fprintf(stderr, "No se puede asignar memoria.\n");
+        exit(1);
+    }
+
+    for (i = 0; i < num_managers; i++) {
+        crear_lista_doble(&managers[i].cola);
+        pthread_mutex_init(&managers[i].mutex_comandos, NULL);
+        pthread_cond_init(&managers[i].hay_comandos, NULL);
+
+        if (pthread_create(&managers[i].hilo, NULL, rutina_hilo_manager,
+                           &managers[i]))
+            fatalerror("No se pudo crear el hilo manager.\n");
+    }
+}
+
+
+//------------------------------------------------------------------ Reactor -//
+
+/**
+ * vaciar_con_espera
+ *
+ * @brief Escribe toda la cola de salida de un usuario, esperando si hace falta.
+ *
+ * @param user Usuario cuya cola se escribe. Se debe tener mutex_socket.
+ *
+ * Se usa solo al cerrar la conexión: se espera con poll, como máximo
+ * ESPERA_ESCRITURA milisegundos cada vez, a que el socket acepte más datos.
+ */
+
+void vaciar_con_espera(usuario *user) {
+
+    struct pollfd pfd;
+
+    pfd.fd = user->socket;
+    pfd.events = POLLOUT;
+
+    while (vaciar_cola_envio(&user->salida_pendiente, user->socket) == 1) {
+        if (poll(&pfd, 1, ESPERA_ESCRITURA) <= 0)
+            break;
+    }
+}
+
+
+/**
+ * diferir_cierre
+ *
+ * @brief Deja para después el cierre de una conexión que todavía tiene
+ *        comandos en su manager.
+ *
+ * @param user Usuario cuya conexión se cierra.
+ * @param despedida Indica si el cierre es una despedida (fue).
+ * @return 1 si el cierre quedó pendiente, 0 si no había comandos pendientes
+ *         y quien llama debe cerrar la conexión de una vez.
+ *
+ * El socket sale de epoll y el reactor lo cierra cuando el manager termina
+ * el último comando (ver terminar_comando y vaciar_usuario), así que las
+ * respuestas de esos comandos llegan antes de la despedida. Mientras tanto
+ * se le escribe solo por la lista de pendientes del reactor; lo que no quepa
+ * en el socket se escribe al cerrarlo, si es una despedida. Si el socket
+ * siguiera en epoll, este avisaría de EPOLLHUP y EPOLLERR en cada vuelta
+ * aunque no se le pidan. Solo la llama el reactor dueño del socket.
+ */
+
+int diferir_cierre(usuario *user, int despedida) {
+
+    pthread_mutex_lock(&user->mutex_socket);
+
+    if (user->comandos_pendientes == 0) {
+        pthread_mutex_unlock(&user->mutex_socket);
+        return 0;
+    }
+
+    if (!user->cierre_pendiente) {
+        user->cierre_pendiente = 1;
+        user->despedida_pendiente = despedida;
+        epoll_ctl(user->reactor->epollfd, EPOLL_CTL_DEL, user->socket, NULL);
+    }
+
+    pthread_mutex_unlock(&user->mutex_socket);
+    return 1;
+}
+
+
+/**
+ * cerrar_conexion
+ *
+ * @brief Cierra la conexión de un usuario y lo elimina del sistema.
+ *
+ * @param user Usuario cuya conexión se cierra.
+ * @param despedida Indica si se le envía el caracter salida antes de cerrar.
+ *
+ * Saca el socket del reactor y elimina al usuario del sistema. Si es una
+ * despedida, se escribe lo que quedaba en la cola de salida seguido del
+ * caracter salida (o de una trama RES_FIN); si no, se descarta. Luego se
+ * cierra el socket y se suelta la referencia del reactor. Solo la llama el
+ * reactor dueño del socket.
+ */
+
+void cerrar_conexion(usuario *user, int despedida) {
+
+    if (user->cerrado)
+        return;
+
+    epoll_ctl(user->reactor->epollfd, EPOLL_CTL_DEL, user->socket, NULL);
+    mis_metricas()->conexiones_cerradas++;
+
+    if (despedida && user->binario)
+        enviar_respuesta(user, RES_FIN, 0, NULL, "");
+    else if (despedida)
+        enviar_usuario(user, salida, 1);
+
+    eliminar_usuario(user);
+
+    pthread_mutex_lock(&user->mutex_socket);
+    if (despedida)
+        vaciar_con_espera(user);
+    destruir_cola_envio(&user->salida_pendiente);
+    close(user->socket);
+    pthread_mutex_unlock(&user->mutex_socket);
+
+    soltar_usuario(user);
+}
+
+
+//------------------------------------------------------- Tabla de comandos -//
+
+/**
+ * ejecutar_men
+ *
+ * @brief Envía un mensaje a las salas del usuario (comando men).
+ */
+
+int ejecutar_men(usuario *user, char *argumento, unsigned int id) {
+    enviar_mensaje(user, argumento, id);
+    return 0;
+}
+
+
+/**
+ * ejecutar_usu
+ *
+ * @brief Lista los usuarios del sistema (comando usu).
+ */
+
+int ejecutar_usu(usuario *user, char *argumento, unsigned int id) {
+    listar_usuarios(user);
+    return 0;
+}
+
+
+/**
+ * ejecutar_fue
+ *
+ * @brief Cierra la conexión del usuario (comando fue), o la deja por cerrar
+ *        si todavía tiene comandos en su manager.
+ */
+
+int ejecutar_fue(usuario *user, char *argumento, unsigned int id) {
+    if (!diferir_cierre(user, 1))
+        cerrar_conexion(user, 1);
+    return 1;
+}
+
+
+/**
+ * ejecutar_cre
+ *
+ * @brief Crea una sala (comando cre). Se ignora si el nombre es vacío.
+ */
+
+int ejecutar_cre(usuario *user, char *argumento, unsigned int id) {
+    if (strcmp(argumento, ""))
+        crear_sala(argumento, user);
+    return 0;
+}
+
+
+/**
+ * ejecutar_eli
+ *
+ * @brief Elimina una sala (comando eli).
+ */
+
+int ejecutar_eli(usuario *user, char *argumento, unsigned int id) {
+    eliminar_sala(argumento, user);
+    return 0;
+}
+
+
+/**
+ * ejecutar_sus
+ *
+ * @brief Suscribe al usuario a una sala (comando sus).
+ */
+
+int ejecutar_sus(usuario *user, char *argumento, unsigned int id) {
+    suscribir_usuario(argumento, user);
+    return 0;
+}
+
+
+/**
+ * ejecutar_sal
+ *
+ * @brief Lista las salas del sistema (comando sal).
+ */
+
+int ejecutar_sal(usuario *user, char *argumento, unsigned int id) {
+    imprimir_lista_salas(user, 1);
+    return 0;
+}
+
+
+/**
+ * ejecutar_des
+ *
+ * @brief Desuscribe al usuario de todas sus salas (comando des).
+ */
+
+int ejecutar_des(usuario *user, char *argumento, unsigned int id) {
+    desuscribir_usuario(user);
+    enviar_respuesta(user, RES_OK, 0, NULL, "");
+    return 0;
+}
+
+
+/**
+ * ejecutar_mis
+ *
+ * @brief Lista las salas a las que está suscrito el usuario (comando mis).
+ */
+
+int ejecutar_mis(usuario *user, char *argumento, unsigned int id) {
+    imprimir_lista_salas(user, 0);
+    return 0;
+}
+
+
+/**
+ * \var ordenes
+ * \brief Tabla de los comandos del servidor, por código de operación.
+ *
+ * Para agregar un comando basta con agregar su entrada (y su código en
+ * protocolo.c); el índice del protocolo de texto se arma a partir de esta
+ * tabla al iniciar el servidor.
+ */
+orden ordenes[NUM_ORDENES] = {
+    [OP_MENSAJE]     = { "men", 0, 1, 0, 0, ejecutar_men },
+    [OP_CREAR]       = { "cre", 0, 1, 1, 1, ejecutar_cre },
+    [OP_ELIMINAR]    = { "eli", 0, 1, 1, 1, ejecutar_eli },
+    [OP_SUSCRIBIR]   = { "sus", 0, 1, 1, 1, ejecutar_sus },
+    [OP_SALAS]       = { "sal", 0, 0, 1, 0, ejecutar_sal },
+    [OP_DESUSCRIBIR] = { "des", 0, 0, 1, 0, ejecutar_des },
+    [OP_MIS_SALAS]   = { "mis", 0, 0, 1, 0, ejecutar_mis },
+    [OP_USUARIOS]    = { "usu", 0, 0, 0, 0, ejecutar_usu },
+    [OP_FUERA]       = { "fue", 0, 0, 0, 0, ejecutar_fue },
+};
+
+/**
+ * \var indice_ordenes
+ * \brief Índice de la tabla ordenes por nombre de tres letras.
+ *
+ * La clave de cada nombre son sus tres bytes empaquetados en un entero; las
+ * colisiones se resuelven con la siguiente posición libre.
+ */
+orden *indice_ordenes[TAMANO_INDICE_ORDENES];
+
+
+/**
+ * clave_orden
+ *
+ * @brief Empaqueta los tres primeros bytes de un comando en un entero.
+ * @param texto Comando (al menos tres caracteres).
+ * @return Clave del comando.
+ */
+
+unsigned int clave_orden(char *texto) {
+    return (unsigned char) texto[0] | (unsigned char) texto[1] << 8 |
+           (unsigned char) texto[2] << 16;
+}
+
+
+/**
+ * crear_indice_ordenes
+ *
+ * @brief Arma indice_ordenes a partir de la tabla ordenes.
+ */
+
+void crear_indice_ordenes() {
+
+    unsigned int i, pos;
+
+    for (i = 0; i < NUM_ORDENES; i++) {
+        if (ordenes[i].ejecutar == NULL)
+            continue;
+        ordenes[i].op = i;
+        pos = clave_orden(ordenes[i].nombre) % TAMANO_INDICE_ORDENES;
+        while (indice_ordenes[pos] != NULL)
+            pos = (pos + 1) % TAMANO_INDICE_ORDENES;
+        indice_ordenes[pos] = &ordenes[i];
+    }
+}
+
+
+/**
+ * buscar_orden
+ *
+ * @brief Reconoce un comando del protocolo de texto.
+ * @param texto Línea enviada por el cliente.
+ * @param largo Cantidad de caracteres de la línea.
+ * @return Entrada de la tabla ordenes, o NULL si la línea no es un comando.
+ *
+ * Un comando con argumento debe ir seguido de un espacio; uno sin argumento
+ * debe ser la línea completa.
+ */
+
+orden *buscar_orden(char *texto, int largo) {
+
+    unsigned int clave, pos;
+    orden *o;
+
+    if (largo < 3)
+        return NULL;
+
+    clave = clave_orden(texto);
+    pos = clave % TAMANO_INDICE_ORDENES;
+
+    while ((o = indice_ordenes[pos]) != NULL) {
+        if (clave_orden(o->nombre) == clave) {
+            if (o->argumento ? largo >= 4 && texto[3] == ' ' : largo == 3)
+                return o;
+            return NULL;
+        }
+        pos = (pos + 1) % TAMANO_INDICE_ORDENES;
+    }
+    return NULL;
+}
+
+
+/**
+ * despachar_orden
+ *
+ * @brief Ejecuta un comando ya reconocido o lo encola para su manager.
+ * @param user Usuario que envía el comando.
+ * @param o Entrada de la tabla ordenes del comando.
+ * @param argumento Argumento del comando.
+ * @param id Identificador de la trama (0 en el protocolo de texto).
+ * @return 1 si la conexión se cerró, 0 en caso contrario.
+ *
+ * Los comandos que se ejecutan en el reactor (men, usu) también van al
+ * manager si el usuario todavía tiene comandos ahí, para que se ejecuten en
+ * el orden en que llegaron; fue deja la conexión por cerrar hasta que el
+ * manager termine (diferir_cierre). El tiempo de los comandos que se
+ * ejecutan en el reactor se cuenta aquí; el de los que van al manager,
+ * cuando el manager termina de ejecutarlos.
+ */
+
+int despachar_orden(usuario *user, orden *o, char *argumento,
+                    unsigned int id) {
+    long long inicio;
+    int cerrada;
+
+    if (o->en_manager ||
+        (user->comandos_pendientes > 0 && o->op != OP_FUERA)) {
+        encolar_comando(user, o, argumento, id);
+        return 0;
+    }
+
+    inicio = reloj();
+    cerrada = o->ejecutar(user, argumento, id);
+    observar(&mis_metricas()->comandos[o->op], reloj() - inicio);
+    return cerrada;
+}
+
+
+/**
+ * registrar_usuario
+ * 
+ * @brief Procesa el nombre que envía un cliente al conectarse.
+ * 
+ * @param user Usuario que se está conectando.
+ * @param nombre Nombre que propone el cliente.
+ *
+ * Si el nombre ya existe se le pide otro al cliente. Si no, se le asigna al
+ * usuario, se agrega al directorio de usuarios y se suscribe a la sala por
+ * defecto. La verificación y la reserva del nombre son una sola
+ * operación (insertar_tabla) hecha con rwlock_usuarios bloqueado para
+ * escribir, de manera que dos clientes no pueden quedarse con el mismo
+ * nombre.
+ */
+
+void registrar_usuario(usuario *user, char *nombre) {
+    
+    char *mens_pide_nombre = "Ese nombre de usuario ya existe, por favor \
+ingrese otro: \n";
+
+    if (strlen(nombre) >= MAXLENGTH_USER)
+        nombre[MAXLENGTH_USER - 1] = '\0';
+
+    strcpy(user->nombre_usuario, nombre);
+
+    pthread_rwlock_wrlock(&rwlock_usuarios);
+
+    if (insertar_tabla(&tabla_global_usuarios, user->nombre_usuario, user)) {
+        pthread_rwlock_unlock(&rwlock_usuarios);
+        enviar_respuesta(user, RES_ERROR, 0, mens_pide_nombre,
+                         "Ese nombre de usuario ya existe.");
+        return;
+    }
+            
+    user->registrado = 1;
+        
+    pthread_rwlock_unlock(&rwlock_usuarios);
+
+    enviar_respuesta(user, RES_OK, user->id, NULL, user->nombre_usuario);
+    
+    // Aquí se suscribe al usuario a la sala default (o a las que tenía según
+    // la instantánea), antes de procesar su siguiente línea: si se encolara
+    // para el manager, los mensajes que el cliente envíe apenas se conecta
+    // llegarían antes que la suscripción.
+    if (!restaurar_suscripciones(user))
+        suscribir_usuario(sala_pedida, user);
+}
+
+
+/**
+ * procesar_linea
+ *
+ * @brief Procesa una línea completa enviada por un cliente.
+ *
+ * @param u Usuario que envía la línea.
+ * @param mensaje Línea recibida, sin el salto de línea.
+ * @return 1 si la conexión se cerró, 0 en caso contrario.
+ *
+ * Mientras el usuario no tenga nombre, la línea es el nombre propuesto. Luego
+ * cada línea es un comando, que se reconoce una sola vez con buscar_orden:
+ * men y usu se ejecutan en el reactor, fue cierra la conexión y el resto se
+ * encola para el hilo manager.
+ */
+
+int procesar_linea(void *u, char *mensaje) {
+
+    usuario *user = (usuario *) u;
+    orden *o;
+
+    if (!user->registrado) {
+        registrar_usuario(user, mensaje);
+        return 0;
+    }
+
+    if (mensaje[0] == '\0')
+        return 0;
+
+    o = buscar_orden(mensaje, strlen(mensaje));
+
+    if (o == NULL) {
+        enviar_usuario(user, "Comando no reconocido\n", 22);
+        return 0;
+    }
+
+    return despachar_orden(user, o, o->argumento ? mensaje + 4 : NULL, 0);
+}
+
+
+/**
+ * procesar_trama
+ *
+ * @brief Procesa una trama completa enviada por un cliente binario.
+ *
+ * @param u Usuario que envía la trama.
+ * @param op Código de operación de la trama.
+ * @param id Identificador que trae la trama.
+ * @param carga Carga de la trama, terminada en un caracter nulo.
+ * @param largo Cantidad de bytes de la carga.
+ * @return 1 si la conexión se cerró, 0 en caso contrario.
+ *
+ * Las tramas de un enlace con otro servidor se procesan con
+ * procesar_trama_par. Mientras el usuario no tenga nombre, solo se acepta
+ * OP_NOMBRE (u OP_PAR, que convierte la conexión en un enlace). Las demás
+ * operaciones son la entrada de la tabla ordenes con ese código, igual que el
+ * comando de texto equivalente. En OP_MENSAJE, un id distinto de 0 indica que
+ * el mensaje solo va a esa sala.
+ */
+
+int procesar_trama(void *u, int op, unsigned int id, char *carga, int largo) {
+
+    usuario *user = (usuario *) u;
+    orden *o;
+
+    if (user->par != NULL) {
+        procesar_trama_par(user, op, carga, largo);
+        return 0;
+    }
+
+    if (!user->registrado) {
+        if (op == OP_NOMBRE && largo > 0)
+            registrar_usuario(user, carga);
+        else if (op == OP_PAR)
+            aceptar_par(user, carga);
+        else
+            enviar_respuesta(user, RES_ERROR, 0, NULL, "Falta el nombre.");
+        return 0;
+    }
+
+    if (op <= 0 || op >= NUM_ORDENES || ordenes[op].ejecutar == NULL) {
+        enviar_respuesta(user, RES_ERROR, 0, NULL,
+                         "Comando no reconocido.");
+        return 0;
+    }
+
+    o = &ordenes[op];
+
+    if (o->por_sala && largo == 0) {
+        enviar_respuesta(user, RES_ERROR, 0, NULL,
+                         "Falta el nombre de la sala.");
+        return 0;
+    }
+
+    return despachar_orden(user, o, o->argumento ? carga : NULL, id);
+}
+
+
+/**
+ * procesar_lectura
+ *
+ * @brief Procesa lo que se leyó del socket de un usuario.
+ *
+ * @param user Usuario del que se leyó.
+ * @param lectura Bloque en el que se leyó (con un byte libre al final).
+ * @param status Lo que devolvió la lectura (si es negativo, el error queda
+ *               en errno).
+ * @return 1 si la conexión se cerró (o quedó por cerrar), 0 en caso
+ *         contrario.
+ *
+ * Los datos se separan en líneas con separar_lineas (o en tramas con
+ * separar_tramas, si el cliente pidió el protocolo binario con su primer
+ * byte, o con el segundo si el primero pidió la compresión), así que una
+ * sola lectura puede traer muchos comandos encadenados. Las líneas de más de
+ * largo_maximo caracteres se truncan. Si el cliente cerró la conexión o hubo
+ * un error, se cierra la conexión (cuando el manager termine sus comandos,
+ * si todavía tiene).
+ */
+
+int procesar_lectura(usuario *user, char *lectura, int status) {
+
+    int resultado = 0;
+    char *datos = lectura;
+
+    if (status > 0)
+        mis_metricas()->bytes_recibidos += status;
+
+    if (status > 0 && !user->negociado) {
+        if (datos[0] == PEDIR_COMPRESION && !user->comprimido) {
+            // La respuesta es el mismo byte, sin comprimir
+            enviar_usuario(user, datos, 1);
+            user->comprimido = 1;
+            datos++;
+            status--;
+            if (status == 0)
+                return 0;
+        }
+        user->negociado = 1;
+        if (datos[0] == PROTOCOLO_BINARIO) {
+            user->binario = 1;
+            datos++;
+            status--;
+            if (status == 0)
+                return 0;
+        }
+    }
+
+    if (status > 0) {
+        if (user->binario)
+            resultado = separar_tramas(&user->entrada, datos, status,
+                                       largo_maximo, procesar_trama, user);
+        else
+            resultado = separar_lineas(&user->entrada, datos, status,
+                                       largo_maximo, procesar_linea, user);
+        if (resultado == 1)
+            return 1;
+        if (resultado < 0)
+            status = -1;
+    }
+
+    if (status == 0 || (status < 0 && (resultado < 0 || (errno != EAGAIN &&
+                        errno != EWOULDBLOCK && errno != EINTR)))) {
+        if (!diferir_cierre(user, 0))
+            cerrar_conexion(user, 0);
+        return 1;
+    }
+    return 0;
+}
+
+
+/**
+ * atender_usuario
+ *
+ * @brief Lee lo disponible en el socket de un usuario.
+ *
+ * @param user Usuario cuyo socket está listo para leer.
+ * @param lectura Bloque del reactor en el que se lee.
+ * @return 1 si la conexión se cerró, 0 en caso contrario.
+ *
+ * Se lee un bloque de hasta TAMANO_LECTURA bytes y se procesa con
+ * procesar_lectura. Se lee una sola vez por evento: si quedan datos, epoll
+ * vuelve a avisar en la próxima vuelta, después de que el reactor haya
+ * escrito la salida que produjo este bloque y atendido a las demás
+ * conexiones.
+ */
+
+int atender_usuario(usuario *user, char *lectura) {
+
+    int status;
+
+    status = recv(user->socket, lectura, TAMANO_LECTURA, 0);
+    mis_metricas()->lecturas++;
+
+    return procesar_lectura(user, lectura, status);
+}
+
+
+/**
+ * terminar_vaciado
+ *
+ * @brief Actualiza el estado de un usuario después de escribir su cola de
+ *        salida y suelta su mutex_socket.
+ *
+ * @param user Usuario cuya cola se escribió (con mutex_socket tomado).
+ * @param estado Lo que devolvió la escritura, como en vaciar_cola_envio.
+ * @return 1 si hay que cerrar la conexión, 0 si no.
+ *
+ * Si el socket no aceptó todo, se le pide a epoll que avise cuando acepte más
+ * (EPOLLOUT); cuando la cola queda vacía se deja de pedir. Un usuario
+ * rezagado deja de estarlo cuando su cola baja de la mitad de limite_salida,
+ * y se le avisa cuántos mensajes se perdió. Quien llama cierra la conexión
+ * si hubo un error en el socket o la política de lentos pidió desconectarlo.
+ */
+
+int terminar_vaciado(usuario *user, int estado) {
+
+    struct epoll_event evento;
+    char aviso[64];
+    int cerrar;
+
+    if (estado >= 0 && user->rezagado &&
+        user->salida_pendiente.bytes <= limite_salida / 2) {
+        user->rezagado = 0;
+        sprintf(aviso, "\nSe omitieron %d mensajes por lentitud.\n\n",
+                user->omitidos);
+        user->omitidos = 0;
+        agregar_usuario(user, aviso, strlen(aviso));
+        estado = vaciar_cola_envio(&user->salida_pendiente, user->socket);
+    }
+
+    // Con un cierre pendiente el socket ya no está en epoll
+    if ((estado == 1) != user->esperando_escritura && estado >= 0 &&
+        !user->cierre_pendiente) {
+        user->esperando_escritura = (estado == 1);
+        evento.events = EPOLLIN | (estado == 1 ? EPOLLOUT : 0);
+        evento.data.ptr = user;
+        epoll_ctl(user->reactor->epollfd, EPOLL_CTL_MOD, user->socket,
+                  &evento);
+    }
+
+    cerrar = (estado < 0 || user->desconectar);
+
+    pthread_mutex_unlock(&user->mutex_socket);
+    return cerrar;
+}
+
+
+/**
+ * vaciar_usuario
+ *
+ * @brief Escribe lo que se pueda de la cola de salida de un usuario.
+ *
+ * @param user Usuario cuya cola se escribe.
+ *
+ * Después de escribir se llama a terminar_vaciado, y se cierra la conexión
+ * si hace falta. Si la conexión tenía un cierre pendiente y su manager ya
+ * terminó sus comandos, se cierra en lugar de escribir (cerrar_conexion
+ * escribe lo que quede si es una despedida). Solo la llama el reactor dueño
+ * del socket.
+ */
+
+void vaciar_usuario(usuario *user) {
+
+    int estado;
+
+    pthread_mutex_lock(&user->mutex_socket);
+
+    user->programado = 0;
+
+    if (user->cerrado) {
+        pthread_mutex_unlock(&user->mutex_socket);
+        return;
+    }
+
+    if (user->cierre_pendiente && user->comandos_pendientes == 0) {
+        pthread_mutex_unlock(&user->mutex_socket);
+        cerrar_conexion(user, user->despedida_pendiente);
+        return;
+    }
+
+    estado = vaciar_cola_envio(&user->salida_pendiente, user->socket);
+
+    if (terminar_vaciado(user, estado))
+        cerrar_conexion(user, 0);
+}
+
+
+/**
+ * desactivar_anillo
+ *
+ * @brief Hace que un reactor deje de usar io_uring porque io_uring_enter
+ *        falló.
+ *
+ * @param r Reactor.
+ *
+ * Desde aquí el reactor lee y escribe con las llamadas de siempre, igual que
+ * si se hubiera iniciado sin -u; los demás reactores no cambian. Las
+ * operaciones que io_uring_enter alcanzó a entregar ya terminaron (todas
+ * llevan MSG_DONTWAIT) y tienen su resultado; las demás nunca se entregan, y
+ * quien llama las repite por el camino de siempre.
+ */
+
+void desactivar_anillo(reactor *r) {
+    fprintf(stderr, "Error en io_uring (%s); el reactor sigue con epoll.\n",
+            strerror(errno));
+    r->con_anillo = 0;
+}
+
+
+/**
+ * vaciar_lote_anillo
+ *
+ * @brief Escribe las colas de salida de un grupo de usuarios con una sola
+ *        llamada a io_uring_enter.
+ *
+ * @param r Reactor dueño de los usuarios.
+ * @param usuarios Usuarios a escribir (hasta ENTRADAS_ANILLO).
+ * @param n Cantidad de usuarios.
+ *
+ * Se toma el mutex_socket de todos los usuarios del grupo, se prepara un
+ * writev por cada uno con hasta BLOQUES_ANILLO mensajes de su cola y se
+ * entregan todos juntos. Solo el reactor toma varios mutex_socket a la vez,
+ * y no toma ningún otro semáforo mientras tanto; las conexiones que haya que
+ * cerrar (incluidas las que tenían un cierre pendiente y ya no tienen
+ * comandos en su manager) se cierran al final, cuando ya los soltó todos.
+ * Lo que quede en una cola se escribe en la próxima vuelta (se pide
+ * EPOLLOUT). Si io_uring_enter falla, las escrituras que no tienen
+ * resultado se hacen con vaciar_cola_envio y el reactor deja el anillo.
+ */
+
+void vaciar_lote_anillo(reactor *r, usuario **usuarios, int n) {
+
+    int estados[ENTRADAS_ANILLO], abiertos[ENTRADAS_ANILLO];
+    int cerrar[ENTRADAS_ANILLO], listos[ENTRADAS_ANILLO];
+    int escritos[ENTRADAS_ANILLO];
+    struct iovec *iov;
+    unsigned long long dato;
+    int i, bloques, res, fallo;
+    cola_envio *cola;
+
+    for (i = 0; i < n; i++) {
+        pthread_mutex_lock(&usuarios[i]->mutex_socket);
+        usuarios[i]->programado = 0;
+        estados[i] = 0;
+        escritos[i] = 0;
+        listos[i] = !usuarios[i]->cerrado && usuarios[i]->cierre_pendiente &&
+                    usuarios[i]->comandos_pendientes == 0;
+        abiertos[i] = !usuarios[i]->cerrado && !listos[i];
+
+        if (!abiertos[i]) {
+            pthread_mutex_unlock(&usuarios[i]->mutex_socket);
+            continue;
+        }
+
+        iov = r->bloques + i * BLOQUES_ANILLO;
+        bloques = preparar_envio(&usuarios[i]->salida_pendiente, iov,
+                                 BLOQUES_ANILLO);
+        if (bloques > 0)
+            preparar_escritura(&r->anillo, usuarios[i]->socket, iov, bloques,
+                               i);
+    }
+
+    fallo = completar_anillo(&r->anillo);
+    if (fallo)
+        desactivar_anillo(r);
+    mis_metricas()->escrituras++;
+
+    while (tomar_resultado(&r->anillo, &dato, &res)) {
+        escritos[dato] = 1;
+        cola = &usuarios[dato]->salida_pendiente;
+        if (res == -EAGAIN || res == -EWOULDBLOCK || res == -EINTR)
+            estados[dato] = 1;
+        else if (res < 0)
+            estados[dato] = -1;
+        else
+            estados[dato] = avanzar_cola_envio(cola, res) ||
+                            !cola_envio_vacia(cola);
+    }
+
+    for (i = 0; fallo && i < n; i++)
+        if (abiertos[i] && !escritos[i])
+            estados[i] = vaciar_cola_envio(&usuarios[i]->salida_pendiente,
+                                           usuarios[i]->socket);
+
+    for (i = 0; i < n; i++)
+        cerrar[i] = abiertos[i] && terminar_vaciado(usuarios[i], estados[i]);
+
+    for (i = 0; i < n; i++)
+        if (cerrar[i])
+            cerrar_conexion(usuarios[i], 0);
+        else if (listos[i])
+            cerrar_conexion(usuarios[i], usuarios[i]->despedida_pendiente);
+}
+
+
+/**
+ * enviar_pendientes
+ *
+ * @brief Vacía las colas de salida de los usuarios pendientes de un reactor.
+ *
+ * @param r Reactor cuyos pendientes se atienden.
+ *
+ * Se toma la lista completa con una sola adquisición de mutex_pendientes y se
+ * suelta la referencia que tenía cada usuario. Con el anillo, los usuarios se
+ * escriben en grupos de ENTRADAS_ANILLO (vaciar_lote_anillo).
+ */
+
+void enviar_pendientes(reactor *r) {
+
+    usuario *usuarios[ENTRADAS_ANILLO];
+    nodo *lote, *aux;
+    usuario *user;
+    int n = 0, i;
+
+    pthread_mutex_lock(&r->mutex_pendientes);
+    lote = r->pendientes.cabeza;
+    crear_lista(&r->pendientes);
+    pthread_mutex_unlock(&r->mutex_pendientes);
+
+    while (lote != NULL) {
+        user = (usuario *) lote->elemento;
+
+        if (r->con_anillo && user->en_lote) {
+            soltar_usuario(user);
+        } else if (r->con_anillo) {
+            user->en_lote = 1;
+            usuarios[n++] = user;
+        } else {
+            vaciar_usuario(user);
+            soltar_usuario(user);
+        }
+
+        aux = lote;
+        lote = lote->sig;
+        liberar_nodo(aux);
+
+        if (n == ENTRADAS_ANILLO || (n > 0 && lote == NULL)) {
+            vaciar_lote_anillo(r, usuarios, n);
+            for (i = 0; i < n; i++) {
+                usuarios[i]->en_lote = 0;
+                soltar_usuario(usuarios[i]);
+            }
+            n = 0;
+        }
+    }
+}
+
+
+/**
+ * atender_eventos_anillo
+ *
+ * @brief Atiende los eventos de una vuelta de un reactor leyendo de todos
+ *        los sockets listos con una sola llamada a io_uring_enter.
+ *
+ * @param r Reactor.
+ * @param eventos Eventos que devolvió epoll_wait.
+ * @param n Cantidad de eventos.
+ *
+ * Cada socket se lee en su propio bloque de r->lecturas. Después se procesa
+ * cada lectura en el orden de los eventos, igual que con atender_usuario, y
+ * se escriben los sockets que pidieron EPOLLOUT. Si io_uring_enter falla,
+ * los sockets cuya lectura no tiene resultado se leen con atender_usuario y
+ * el reactor deja el anillo.
+ */
+
+void atender_eventos_anillo(reactor *r, struct epoll_event *eventos, int n) {
+
+    int resultados[MAXEVENTOS], leidos[MAXEVENTOS];
+    unsigned long long dato;
+    usuario *user;
+    uint64_t valor;
+    char *lectura;
+    int i, res, fallo;
+
+    for (i = 0; i < n; i++) {
+        user = (usuario *) eventos[i].data.ptr;
+        leidos[i] = 0;
+
+        if (user == NULL) {
+            read(r->eventfd, &valor, sizeof(valor));
+            continue;
+        }
+
+        // Si la conexión ya se va a cerrar, no se lee más
+        if (user->cierre_pendiente)
+            eventos[i].events &= ~(EPOLLIN | EPOLLHUP | EPOLLERR);
+
+        if (eventos[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            preparar_lectura(&r->anillo, user->socket,
+                             r->lecturas + i * (TAMANO_LECTURA_ANILLO + 1),
+                             TAMANO_LECTURA_ANILLO, i);
+    }
+
+    fallo = completar_anillo(&r->anillo);
+    if (fallo)
+        desactivar_anillo(r);
+    mis_metricas()->lecturas++;
+
+    while (tomar_resultado(&r->anillo, &dato, &res)) {
+        resultados[dato] = res;
+        leidos[dato] = 1;
+    }
+
+    for (i = 0; i < n; i++) {
+        user = (usuario *) eventos[i].data.ptr;
+
+        if (user == NULL)
+            continue;
+
+        if ((eventos[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) &&
+            !leidos[i]) {
+            if (atender_usuario(user, r->lectura))
+                continue;
+        } else if (eventos[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+            lectura = r->lecturas + i * (TAMANO_LECTURA_ANILLO + 1);
+            res = resultados[i];
+            if (res < 0) {
+                errno = -res;
+                res = -1;
+            }
+            if (procesar_lectura(user, lectura, res))
+                continue;
+        }
+
+        if (eventos[i].events & EPOLLOUT)
+            vaciar_usuario(user);
+    }
+}
+
+
+/**
+ * atender_eventos
+ *
+ * @brief Atiende los eventos de una vuelta de un reactor.
+ *
+ * @param r Reactor.
+ * @param eventos Eventos que devolvió epoll_wait.
+ * @param n Cantidad de eventos.
+ *
+ * Cada socket listo para leer se lee con atender_usuario, y cada uno listo
+ * para escribir se escribe con vaciar_usuario.
+ */
+
+void atender_eventos(reactor *r, struct epoll_event *eventos, int n) {
+
+    usuario *user;
+    uint64_t valor;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        user = (usuario *) eventos[i].data.ptr;
+
+        if (user == NULL) {
+            read(r->eventfd, &valor, sizeof(valor));
+            continue;
+        }
+
+        // Si la conexión ya se va a cerrar, no se lee más
+        if ((eventos[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) &&
+            !user->cierre_pendiente && atender_usuario(user, r->lectura))
+            continue;
+
+        if (eventos[i].events & EPOLLOUT)
+            vaciar_usuario(user);
+    }
+}
+
+
+/**
+ * rutina_hilo_reactor
+ *
+ * @brief Función que ejecuta cada hilo reactor del servidor.
+ * @param args Reactor que ejecuta el hilo.
+ *
+ * Espera eventos en su instancia de epoll y atiende cada socket que esté
+ * listo para leer o escribir (con io_uring, si r->con_anillo). Al final de
+ * cada vuelta escribe la salida que se acumuló para sus usuarios (propia o
+ * encolada por otros hilos, que lo despiertan con su eventfd).
+ */
+
+void *rutina_hilo_reactor(void *args) {
+
+    reactor *r = (reactor *) args;
+    struct epoll_event eventos[MAXEVENTOS];
+    int n;
+
+    while (1) {
+        n = epoll_wait(r->epollfd, eventos, MAXEVENTOS, -1);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            fatalerror("Error esperando eventos en el reactor.\n");
+        }
+
+        if (r->con_anillo)
+            atender_eventos_anillo(r, eventos, n);
+        else
+            atender_eventos(r, eventos, n);
+
+        enviar_pendientes(r);
+    }
+}
+
+
+/**
+ * crear_reactores
+ *
+ * @brief Crea los num_reactores reactores y sus hilos.
+ */
+
+void crear_reactores() {
+
+    struct epoll_event evento;
+    int i;
+
+    reactores = malloc(num_reactores * sizeof(reactor));
+
+    if (reactores == NULL) {
+        fprintf(stderr, "No se puede asignar memoria.\n");
+        exit(1);
+    }
+
+    for (i = 0; usar_anillo && i < num_reactores; i++) {
+        if (crear_anillo(&reactores[i].anillo, ENTRADAS_ANILLO)) {
+            while (i-- > 0)
+                destruir_anillo(&reactores[i].anillo);
+            usar_anillo = 0;
+            printf("io_uring no está disponible; se usa epoll.\n");
+        }
+    }
+
+    for (i = 0; i < num_reactores; i++) {
+        reactores[i].epollfd = epoll_create1(0);
+        reactores[i].lectura = malloc(TAMANO_LECTURA + 1);
+
+        if (reactores[i].lectura == NULL) {
+            fprintf(stderr, "No se puede asignar memoria.\n");
+            exit(1);
+        }
+
+        if (reactores[i].epollfd < 0)
+            fatalerror("No se pudo crear la instancia de epoll.\n");
+
+        reactores[i].eventfd = eventfd(0, EFD_NONBLOCK);
+        evento.events = EPOLLIN;
+        evento.data.ptr = NULL;
+
+        if (reactores[i].eventfd < 0 || epoll_ctl(reactores[i].epollfd,
+            EPOLL_CTL_ADD, reactores[i].eventfd, &evento) < 0)
+            fatalerror("No se pudo crear el eventfd del reactor.\n");
+
+        crear_lista(&reactores[i].pendientes);
+        pthread_mutex_init(&reactores[i].mutex_pendientes, NULL);
+        reactores[i].con_anillo = usar_anillo;
+
+        reactores[i].lecturas = NULL;
+        reactores[i].bloques = NULL;
+        if (usar_anillo) {
+            reactores[i].lecturas = malloc(MAXEVENTOS *
+                                           (TAMANO_LECTURA_ANILLO + 1));
+            reactores[i].bloques = malloc(ENTRADAS_ANILLO * BLOQUES_ANILLO *
+                                          sizeof(struct iovec));
+            if (reactores[i].lecturas == NULL ||
+                reactores[i].bloques == NULL) {
+                fprintf(stderr, "No se puede asignar memoria.\n");
+                exit(1);
+            }
+        }
+
+        if (pthread_create(&reactores[i].hilo, NULL, rutina_hilo_reactor,
+                           &reactores[i]))
+            fatalerror("No se pudo crear un hilo reactor.\n");
+    }
+}
+
+
+/**
+ * agregar_conexion
+ *
+ * @brief Crea el usuario de una conexión nueva y se la asigna a un reactor.
+ *
+ * @param newsockfd Socket de la conexión aceptada.
+ * @param r Reactor que atenderá la conexión.
+ * @param p Par, si la conexión es un enlace saliente con otro servidor, o
+ *          NULL.
+ * @return El usuario, o NULL si no se pudo agregar.
+ *
+ * El enlace saliente ya está negociado en binario y tiene una referencia
+ * más, que es del hilo del enlace.
+ */
+
+usuario *agregar_conexion(int newsockfd, reactor *r, par *p) {
+
+    struct epoll_event evento;
+    usuario *usuario_nuevo = malloc(sizeof(usuario));
+
+    if (usuario_nuevo == NULL) {
+        fprintf(stderr, "No se puede asignar memoria.\n");
+        return NULL;
+    }
+
+    usuario_nuevo->nombre_usuario = malloc(MAXLENGTH_USER);
+
+    if (usuario_nuevo->nombre_usuario == NULL) {
+        fprintf(stderr, "No se puede asignar memoria.\n");
+        free(usuario_nuevo);
+        return NULL;
+    }
+
+    *usuario_nuevo->nombre_usuario = '\0';
+    usuario_nuevo->socket = newsockfd;
+    usuario_nuevo->reactor = r;
+    crear_buffer(&usuario_nuevo->entrada);
+    usuario_nuevo->registrado = 0;
+    usuario_nuevo->negociado = (p != NULL);
+    usuario_nuevo->binario = (p != NULL);
+    usuario_nuevo->comprimido = 0;
+    usuario_nuevo->id = __sync_add_and_fetch(&ultimo_id, 1);
+    usuario_nuevo->cerrado = 0;
+    usuario_nuevo->referencias = (p != NULL) ? 2 : 1;
+    usuario_nuevo->par = p;
+    usuario_nuevo->programado = 0;
+    usuario_nuevo->en_lote = 0;
+    usuario_nuevo->esperando_escritura = 0;
+    usuario_nuevo->rezagado = 0;
+    usuario_nuevo->omitidos = 0;
+    usuario_nuevo->desconectar = 0;
+    usuario_nuevo->comandos_pendientes = 0;
+    usuario_nuevo->cierre_pendiente = 0;
+    usuario_nuevo->despedida_pendiente = 0;
+    crear_cola_envio(&usuario_nuevo->salida_pendiente);
+    pthread_mutex_init(&usuario_nuevo->mutex_socket, NULL);
+    pthread_mutex_init(&usuario_nuevo->mutex_suscripciones, NULL);
+    crear_lista_doble(&usuario_nuevo->lista_salas_suscritas);
+
+    fcntl(newsockfd, F_SETFL, fcntl(newsockfd, F_GETFL) | O_NONBLOCK);
+
+    evento.events = EPOLLIN;
+    evento.data.ptr = usuario_nuevo;
+
+    if (p != NULL)
+        p->conexion = usuario_nuevo;
+
+    if (epoll_ctl(r->epollfd, EPOLL_CTL_ADD, newsockfd, &evento) < 0) {
+        fprintf(stderr, "No se pudo agregar la conexión al reactor.\n");
+        if (p != NULL) {
+            p->conexion = NULL;
+            soltar_usuario(usuario_nuevo);
+        }
+        soltar_usuario(usuario_nuevo);
+        return NULL;
+    }
+
+    mis_metricas()->conexiones_abiertas++;
+    return usuario_nuevo;
+}
+
+
+//-------------------------------------------------------------- Instantánea -//
+
+/**
+ * escribir_instantanea
+ *
+ * @brief Escribe en archivo_instantanea las salas y las suscripciones.
+ *
+ * Se guardan las salas en orden de creación y, por cada miembro de cada
+ * sala, el nombre del usuario con el índice de la sala. También se guardan
+ * las suscripciones de la instantánea anterior cuyos usuarios todavía no se
+ * han vuelto a conectar. Todo se arma en memoria con rwlock_salas bloqueado
+ * para leer, y se escribe en disco después de soltarlo. Todo se hace con
+ * mutex_instantanea bloqueado, así que dos instantáneas no se mezclan en el
+ * archivo temporal y la última en escribirse es la más nueva.
+ */
+
+void escribir_instantanea() {
+
+    escritor e = { NULL, 0, 0, 0 };
+    tabla indices;
+    celda *c, *g;
+    sala *s;
+    enlace *aux;
+    suscripciones_guardadas *guardadas;
+    void *indice;
+    int posicion, i;
+    unsigned int pares = 0;
+
+    pthread_mutex_lock(&mutex_instantanea);
+
+    if (crear_tabla(&indices, CUBETAS_INICIALES)) {
+        fprintf(stderr, "No se puede asignar memoria.\n");
+        pthread_mutex_unlock(&mutex_instantanea);
+        return;
+    }
+
+    agregar_bytes(&e, MARCA_INSTANTANEA, strlen(MARCA_INSTANTANEA));
+
+    pthread_rwlock_rdlock(&rwlock_salas);
+
+    agregar_entero(&e, tabla_global_salas.num_elementos);
+    for (c = tabla_global_salas.primera, i = 0; c != NULL;
+         c = c->siguiente, i++) {
+        s = (sala *) c->elemento;
+        agregar_cadena(&e, s->nombre_sala);
+        // Se guarda índice + 1 para distinguirlo de NULL
+        if (insertar_tabla(&indices, s->nombre_sala, (void *) (long) (i + 1)))
+            e.error = 1;
+    }
+
+    posicion = e.largo;
+    agregar_entero(&e, 0);
+
+    for (c = tabla_global_salas.primera, i = 0; c != NULL;
+         c = c->siguiente, i++) {
+        s = (sala *) c->elemento;
+        pthread_rwlock_rdlock(&s->rwlock_miembros);
+        for (aux = s->lista_usuarios_activos.primero; aux != NULL;
+             aux = aux->siguiente) {
+            agregar_cadena(&e, contenedor(aux, suscripcion,
+                                          en_sala)->user->nombre_usuario);
+            agregar_entero(&e, i);
+            pares++;
+        }
+        pthread_rwlock_unlock(&s->rwlock_miembros);
+    }
+
+    pthread_mutex_lock(&mutex_guardadas);
+    for (g = tabla_guardadas.primera; g != NULL; g = g->siguiente) {
+        guardadas = (suscripciones_guardadas *) g->elemento;
+        for (i = 0; i < guardadas->cantidad; i++) {
+            indice = buscar_tabla(&indices, guardadas->salas[i]);
+            if (indice == NULL)
+                continue;
+            agregar_cadena(&e, guardadas->nombre);
+            agregar_entero(&e, (long) indice - 1);
+            pares++;
+        }
+    }
+    pthread_mutex_unlock(&mutex_guardadas);
+
+    pthread_rwlock_unlock(&rwlock_salas);
+
+    cambiar_entero(&e, posicion, pares);
+    destruir_tabla(&indices);
+
+    if (guardar_archivo(archivo_instantanea, &e))
+        fprintf(stderr, "No se pudo escribir la instantánea.\n");
+    free(e.datos);
+
+    pthread_mutex_unlock(&mutex_instantanea);
+}
+
+
+/**
+ * cargar_instantanea
+ *
+ * @brief Lee archivo_instantanea, crea sus salas y guarda sus suscripciones
+ *        hasta que cada usuario se conecte.
+ *
+ * Todas las salas se crean con una sola toma de rwlock_salas. Si el archivo
+ * no existe no se hace nada; si no es válido, se ignora lo que sigue al
+ * primer error.
+ */
+
+void cargar_instantanea() {
+
+    lector l;
+    char *datos, *nombre;
+    sala **salas;
+    unsigned int num_salas, num_pares, i, indice;
+    int largo, marca = strlen(MARCA_INSTANTANEA);
+
+    datos = leer_archivo(archivo_instantanea, &largo);
+    if (datos == NULL)
+        return;
+
+    l.pos = datos + marca;
+    l.fin = datos + largo;
+    l.error = (largo < marca || memcmp(datos, MARCA_INSTANTANEA, marca));
+
+    num_salas = leer_entero(&l);
+    if (l.error || num_salas > (unsigned int) largo / 4 ||
+        (salas = calloc(num_salas + 1, sizeof(sala *))) == NULL) {
+        fprintf(stderr, "La instantánea no es válida.\n");
+        free(datos);
+        return;
+    }
+
+    pthread_rwlock_wrlock(&rwlock_salas);
+    for (i = 0; i < num_salas; i++) {
+        nombre = leer_cadena(&l);
+        if (nombre == NULL)
+            break;
+        salas[i] = (sala *) buscar_tabla(&tabla_global_salas, nombre);
+        if (salas[i] == NULL)
+            salas[i] = nueva_sala(nombre);
+        free(nombre);
+    }
+    pthread_rwlock_unlock(&rwlock_salas);
+
+    num_pares = leer_entero(&l);
+    for (i = 0; i < num_pares && !l.error; i++) {
+        nombre = leer_cadena(&l);
+        indice = leer_entero(&l);
+        if (nombre != NULL && !l.error && indice < num_salas &&
+            salas[indice] != NULL &&
+            guardar_suscripcion(nombre, salas[indice]->nombre_sala))
+            fprintf(stderr, "No se puede asignar memoria.\n");
+        free(nombre);
+    }
+
+    if (l.error)
+        fprintf(stderr, "La instantánea no es válida.\n");
+    printf("Se cargaron %u salas y %u suscripciones de la instantánea.\n",
+           num_salas, num_pares);
+
+    free(salas);
+    free(datos);
+}
+
+
+/**
+ * rutina_hilo_instantanea
+ *
+ * @brief Función que ejecuta el hilo de las instantáneas.
+ * @param args No se usa.
+ *
+ * Escribe una instantánea cada intervalo_instantanea segundos.
+ */
+
+void *rutina_hilo_instantanea(void *args) {
+    while (1) {
+        sleep(intervalo_instantanea);
+        escribir_instantanea();
+    }
+}
+
+
+/**
+ * crear_hilo_instantanea
+ *
+ * @brief Crea el hilo que escribe las instantáneas.
+ */
+
+void crear_hilo_instantanea() {
+
+    pthread_t hilo;
+
+    if (pthread_create(&hilo, NULL, rutina_hilo_instantanea, NULL))
+        fatalerror("No se pudo crear el hilo de la instantánea.\n");
+}
+
+
+//-------------------------------------------------------------- Aceptadores -//
+
+/**
+ * abrir_escucha
+ *
+ * @brief Abre un socket de escucha en el puerto del servidor.
+ *
+ * @return El socket.
+ *
+ * Con SO_REUSEPORT, cada aceptador puede abrir su propio socket en el mismo
+ * puerto y el núcleo reparte las conexiones nuevas entre todos, cada una con
+ * su propia cola de largo_cola conexiones.
+ */
+
+int abrir_escucha() {
+
+    struct sockaddr_in serveraddr;
+    int fd, uno = 1;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (fd < 0)
+        fatalerror("No se puede abrir el socket.\n");
+
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &uno, sizeof(uno)) < 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &uno, sizeof(uno)) < 0)
+        fatalerror("No se pudo configurar el socket.\n");
+
+    bzero(&serveraddr, sizeof(serveraddr));
+    serveraddr.sin_family = AF_INET;
+    serveraddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    serveraddr.sin_port = htons(puerto);
+
+    if (bind(fd, (struct sockaddr *) &serveraddr, sizeof(serveraddr)) != 0)
+        fatalerror("No se pudo asociar al socket.\n");
+
+    if (listen(fd, largo_cola) < 0)
+        fatalerror("No se puede escuchar por el socket.\n");
+
+    return fd;
 }
 
 
 /**
- * usuarios_iguales
- * 
- * @brief Compara dos usuarios.
- * 
- * @param u1 Nombre del usuario.
- * @param u2 Usuario a comparar.
- * @return 1 si son iguales y 0 si son diferentes.
- * 
- * Compara el nombre del usuario u2 con el nombre pasado como parámetro.
+ * abrir_escucha_local
+ *
+ * @brief Abre el socket de escucha local (AF_UNIX) en ruta_local.
+ *
+ * @return El socket.
+ *
+ * Si en la ruta quedó el socket de una ejecución anterior, se borra antes;
+ * se reconoce porque nadie acepta conexiones en él. Si en la ruta hay otra
+ * cosa que no es un socket, o un servidor la está usando, no se toca y el
+ * programa termina. Los clientes de la misma máquina que se conectan por
+ * aquí se ahorran la pila TCP.
  */
 
-int usuarios_iguales(void *u1, void *u2) {
-    char *usuario1 = (char *) u1;
-    usuario *usuario2 = (usuario *) u2;
-    return (!strcmp(usuario1,usuario2->nombre_usuario));
-}
+int abrir_escucha_local() {
 
+    struct sockaddr_un direccion;
+    struct stat estado;
+    int fd, prueba;
 
-/**
- * crear_sala
- * 
- * @brief Crea una nueva sala y la agrega a la lista global de salas.
- * 
- * @param sala_agregar Nombre de la sala nueva.
- * @param user Usuario que solicita crear la sala.
- * 
- * Crea una nueva sala mediante un malloc, le asigna el nombre pasado como
- * parámetro y la agrega al inicio de la lista de salas para mayor eficiencia.
- * Al agregar a la lista se bloquea el semáforo correspondiente en caso de que
- * otro procedimiento esté accediendo a la misma lista. Si ocurre algún error o
- * la sala ya existe, el procedimiento le escribe directamente al socket del
- * usuario que ejecutó el comando.
- */
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
 
-void crear_sala(char *sala_agregar, usuario *user) {
-    
-    pthread_mutex_lock(&mutex_salas);
+    if (fd < 0)
+        fatalerror("No se puede abrir el socket local.\n");
 
-    if (existe_elemento(lista_global_salas, sala_agregar, salas_iguales)) {
-        
-        pthread_mutex_lock(&user->mutex_socket);
-        write(user->socket, "\nLa sala ya existe.\n\n", 21);
-        pthread_mutex_unlock(&user->mutex_socket);
-        
-        pthread_mutex_unlock(&mutex_salas);
-        return;
-    }
-    
-    sala *nueva_sala = malloc(sizeof(sala));
-    
-    if (nueva_sala == NULL) {
-        fprintf(stderr, "No se puede asignar memoria.\n");
-        pthread_mutex_unlock(&mutex_salas);
-        return;
+    bzero(&direccion, sizeof(direccion));
+    direccion.sun_family = AF_UNIX;
+    strcpy(direccion.sun_path, ruta_local);
+
+    if (lstat(ruta_local, &estado) == 0) {
+        if (!S_ISSOCK(estado.st_mode)) {
+            errno = EEXIST;
+            fatalerror("La ruta del socket local existe y no es un socket.\n");
+        }
+        prueba = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (prueba < 0)
+            fatalerror("No se puede abrir el socket local.\n");
+        if (connect(prueba, (struct sockaddr *) &direccion,
+                    sizeof(direccion)) == 0 || errno != ECONNREFUSED) {
+            errno = EADDRINUSE;
+            fatalerror("El socket local ya está en uso.\n");
+        }
+        close(prueba);
+        if (unlink(ruta_local) < 0)
+            fatalerror("No se pudo borrar el socket local anterior.\n");
+    } else if (errno != ENOENT) {
+        fatalerror("No se puede revisar la ruta del socket local.\n");
     }
-    
-    nueva_sala->nombre_sala = sala_agregar;
-    crear_lista(&nueva_sala->lista_usuarios_activos);
-                    
-    agregar_principio(&lista_global_salas, nueva_sala);
-    
-    pthread_mutex_unlock(&mutex_salas);
+
+    if (bind(fd, (struct sockaddr *) &direccion, sizeof(direccion)) != 0)
+        fatalerror("No se pudo asociar al socket local.\n");
+
+    if (listen(fd, largo_cola) < 0)
+        fatalerror("No se puede escuchar por el socket local.\n");
+
+    return fd;
 }
 
 
 /**
- * eliminar_sala
- * 
- * @brief Elimina una sala de la lista global de salas.
- * 
- * @param sala_eliminar Nombre de la sala a eliminar.
- * @param user Usuario que solicita eliminar la sala.
- * 
- * Recorre la lista de salas en busca de la que se solicita eliminar. 
- * Al eliminar de la lista se bloquea el semáforo correspondiente en caso de que
- * otro procedimiento esté accediendo a la misma lista. Si ocurre algún error o
- * la sala no existe, el procedimiento le escribe directamente al socket del
- * usuario que ejecutó el comando.
+ * rutina_hilo_aceptador
+ *
+ * @brief Función que ejecuta cada aceptador.
+ *
+ * @param args Socket de escucha del aceptador.
+ *
+ * Acepta conexiones y se las asigna a los reactores por turnos. El turno es
+ * un contador compartido por todos los aceptadores. Sirve igual para los
+ * sockets TCP y para el socket local: desde ahí en adelante las conexiones
+ * no se distinguen.
  */
 
-void eliminar_sala(char *sala_eliminar, usuario *user) {
-    
-    pthread_mutex_lock(&mutex_salas);
-    
-    sala *s = (sala *) encontrar_elemento(lista_global_salas, sala_eliminar,
-                                          salas_iguales);
-    usuario *user_sala;
-    nodo *usuarios_sala;
-    
-    if (s != NULL) {
-        usuarios_sala = s->lista_usuarios_activos.cabeza;
-        
-        while (usuarios_sala != NULL) {
-            user_sala = (usuario *) usuarios_sala->elemento;
-            eliminar_elemento(&user_sala->lista_salas_suscritas, sala_eliminar,
-                              salas_iguales, 0);
-            usuarios_sala = usuarios_sala->sig;
+void *rutina_hilo_aceptador(void *args) {
+
+    int fd = *(int *) args;
+    int newsockfd;
+    reactor *r;
+
+    while (1) {
+        newsockfd = accept(fd, NULL, NULL);
+
+        if (newsockfd < 0) {
+            fprintf(stderr, "Error al aceptar la conexión\n");
+            continue;
         }
-        
-        eliminar_elemento(&lista_global_salas, sala_eliminar, salas_iguales, 1);
-        
-    } else {
-        pthread_mutex_lock(&user->mutex_socket);
-        write(user->socket, "\nLa sala no existe.\n\n", 21);
-        pthread_mutex_unlock(&user->mutex_socket);
+
+        r = &reactores[__sync_fetch_and_add(&siguiente_reactor, 1) %
+                       num_reactores];
+        if (agregar_conexion(newsockfd, r, NULL) == NULL)
+            close(newsockfd);
     }
-    
-    pthread_mutex_unlock(&mutex_salas);
 }
 
 
 /**
- * suscribir_usuario
- * 
- * @brief Suscribe un usuario a una sala.
- * 
- * @param sala_suscribir Nombre de la sala a suscribir.
- * @param user Usuario que solicita suscribirse a la sala.
- * 
- * Recorre la lista de salas en busca de la que se solicita. Una vez
- * encontrada, se agrega al usuario al inicio de la lista de usuarios activos de
- * esa sala y se agrega la sala al inicio de las salas suscritas del usuario.
- * Al suscribirse a la sala, se bloquea el semáforo correspondiente a la lista
- * global de salas en caso de que otro procedimiento esté accediendo a la misma
- * lista. Si ocurre algún error o la sala no existe, el procedimiento le
- * escribe directamente al socket del usuario que ejecutó el comando.
+ * crear_aceptadores
+ *
+ * @brief Abre los sockets de escucha y crea los hilos aceptadores.
+ *
+ * Todos los sockets se abren antes de crear los hilos, así que si el puerto
+ * no se puede usar el servidor termina de una vez. El primer aceptador no
+ * tiene hilo propio: lo ejecuta el hilo principal (ver main). Con la opción
+ * -x, un aceptador más atiende el socket local.
  */
 
-void suscribir_usuario(char *sala_suscribir, usuario *user) {
-    
-    pthread_mutex_lock(&mutex_salas);
+void crear_aceptadores() {
 
-    if (!lista_vacia(lista_global_salas)) {
-        sala *actual = (sala *) encontrar_elemento(lista_global_salas,
-                                sala_suscribir, salas_iguales);
-                
-        if (actual != NULL) {
-            if (!existe_elemento(user->lista_salas_suscritas,
-                                 actual->nombre_sala, salas_iguales)) {
-                
-                agregar_principio(&user->lista_salas_suscritas, actual);
-                agregar_principio(&actual->lista_usuarios_activos, user);
-            
-            } else {
-                pthread_mutex_lock(&user->mutex_socket);
-                write(user->socket, "\nYa estás suscrito.\n\n", 22);
-                pthread_mutex_unlock(&user->mutex_socket);
-            }
-            pthread_mutex_unlock(&mutex_salas);
-            return;
-        }
+    pthread_t hilo;
+    int i;
+
+    sockets_escucha = malloc(num_aceptadores * sizeof(int));
+
+    if (sockets_escucha == NULL) {
+        fprintf(stderr, "No se puede asignar memoria.\n");
+        exit(1);
     }
-    
-    pthread_mutex_lock(&user->mutex_socket);
-    write(user->socket, "\nLa sala no existe.\n\n", 21);
-    pthread_mutex_unlock(&user->mutex_socket);
-    
-    pthread_mutex_unlock(&mutex_salas);
-}
 
+    for (i = 0; i < num_aceptadores; i++)
+        sockets_escucha[i] = abrir_escucha();
+
+    if (ruta_local != NULL)
+        socket_local = abrir_escucha_local();
+
+    for (i = 1; i < num_aceptadores; i++)
+        if (pthread_create(&hilo, NULL, rutina_hilo_aceptador,
+                           &sockets_escucha[i]))
+            fatalerror("No se pudo crear un hilo aceptador.\n");
+
+    if (socket_local >= 0 &&
+        pthread_create(&hilo, NULL, rutina_hilo_aceptador, &socket_local))
+        fatalerror("No se pudo crear el aceptador local.\n");
+}
 
 
 /**
- * desuscribir_usuario
- * 
- * @brief De-suscribe al usuario de todas las salas.
- * 
- * @param user Usuario que solicita de-suscribirse a la sala.
- * 
- * Elimina al usuario de todas las salas a las que está suscrito, recorriendo
- * la lista del usuario y eliminándolo sala por sala. Después crea una sala
- * vacía en la lista de salas suscritas del usuario.
- * 
- * Al de-suscribirse de las salas, se bloquea el semáforo correspondiente a la
- * lista global de salas en caso de que otro procedimiento esté accediendo a
- * la misma lista.
+ * largo_cola_efectivo
+ *
+ * @brief Calcula el largo real de la cola de cada socket de escucha.
+ *
+ * @return largo_cola, o net.core.somaxconn si es menor.
  */
 
-void desuscribir_usuario(usuario *user) {
-    
-    pthread_mutex_lock(&mutex_salas);
-    
-    nodo *aux;
-    sala *s;
+int largo_cola_efectivo() {
 
-    aux = user->lista_salas_suscritas.cabeza;
-    
-    while (aux != NULL) {
-        s = (sala *) aux->elemento;
-        eliminar_elemento(&s->lista_usuarios_activos, user->nombre_usuario,
-                          usuarios_iguales, 0);
-        aux = aux -> sig;
-    }
-    
-    crear_lista(&user->lista_salas_suscritas);
-    
-    pthread_mutex_unlock(&mutex_salas);
+    FILE *f = fopen("/proc/sys/net/core/somaxconn", "r");
+    int maximo;
+
+    if (f == NULL)
+        return largo_cola;
+
+    if (fscanf(f, "%d", &maximo) != 1)
+        maximo = largo_cola;
+    fclose(f);
+
+    return (maximo < largo_cola) ? maximo : largo_cola;
 }
 
 
+//--------------------------------------------------------------- Federación -//
+
 /**
- * eliminar_usuario
- * 
- * @brief Elimina un usuario del sistema.
- * 
- * @param user Usuario que se va a eliminar.
- * 
- * La función primero desuscribe al usuario de todas las salas y después lo
- * elimina de la lista global de hilos y usuarios, liberando la memoria.
+ * conectar_par
+ *
+ * @brief Abre la conexión con otro servidor y le presenta la clave.
+ *
+ * @param direccion Dirección del otro servidor, de la forma "host:puerto".
+ * @return El socket (bloqueante), o -1 si no se pudo conectar.
+ *
+ * Se envía el byte 0 del protocolo binario y una trama OP_PAR con la clave.
  */
 
-void eliminar_usuario(usuario *user) {
-    desuscribir_usuario(user);
-    eliminar_elemento(&lista_global_hilos_usuarios, user->nombre_usuario,
-                      hilos_iguales, 1);
+int conectar_par(char *direccion) {
+
+    struct addrinfo pista, *resultado, *aux;
+    char *separador = strrchr(direccion, ':');
+    char host[NI_MAXHOST], trama[1 + TAMANO_CABECERA + MAXLENGTH];
+    int fd = -1, largo_clave = strlen(clave_federacion), largo, n, escrito;
+
+    if (separador - direccion >= NI_MAXHOST || largo_clave > MAXLENGTH)
+        return -1;
+
+    memcpy(host, direccion, separador - direccion);
+    host[separador - direccion] = '\0';
+
+    bzero(&pista, sizeof(pista));
+    pista.ai_family = AF_UNSPEC;
+    pista.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(host, separador + 1, &pista, &resultado) != 0)
+        return -1;
+
+    for (aux = resultado; aux != NULL; aux = aux->ai_next) {
+        fd = socket(aux->ai_family, aux->ai_socktype, aux->ai_protocol);
+        if (fd < 0)
+            continue;
+        if (connect(fd, aux->ai_addr, aux->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(resultado);
+
+    if (fd < 0)
+        return -1;
+
+    trama[0] = 0;
+    escribir_cabecera(trama + 1, OP_PAR, 0, largo_clave);
+    memcpy(trama + 1 + TAMANO_CABECERA, clave_federacion, largo_clave);
+    largo = 1 + TAMANO_CABECERA + largo_clave;
+
+    for (escrito = 0; escrito < largo; escrito += n) {
+        n = send(fd, trama + escrito, largo - escrito, MSG_NOSIGNAL);
+        if (n <= 0) {
+            close(fd);
+            return -1;
+        }
+    }
+
+    return fd;
 }
 
 
 /**
- * imprimir_lista_salas
- * 
- * @brief Imprime una lista de salas.
- * 
- * @param l Lista a imprimir.
- * @param user Usuario que desea imprimir una lista de salas.
- * @param sistema Variable de control que indica si son las salas del sistema.
- * 
- * La función recorre la lista pasada como parámetro imprimiendo cada uno de
- * sus elementos (salas). En caso de que la variable sistema sea 1, imprime el
- * encabezado de la lista de salas del sistema. En caso de que sea 0, imprime la
- * lista de salas a las que está suscrito un usuario. Al recorrer la lista se
- * bloquea el semáforo de la lista global de salas en caso de que otro
- * procedimiento la desee modificar mientras se lee de ella.
- * 
- * La lista de salas (vacía o no) se envía directamente al socket del usuario
- * que ejecuta el comando.
+ * rutina_hilo_enlace
+ *
+ * @brief Función que ejecuta el hilo de cada enlace saliente.
+ *
+ * @param args Par del enlace.
+ *
+ * Conecta con el otro servidor y le entrega la conexión a un reactor, que la
+ * atiende como a cualquier cliente binario. Después revisa cada segundo si
+ * la conexión se cerró; cuando pasa, espera INTERVALO_ENLACE segundos y
+ * vuelve a conectar.
  */
 
-void imprimir_lista_salas(lista l, usuario *user, int sistema) {
-    
-    pthread_mutex_lock(&mutex_salas);
-    pthread_mutex_lock(&user->mutex_socket);
-    
-    if (sistema) {
-        write(user->socket, "\nLISTA DE SALAS DEL SISTEMA\n====================\
-======\n",56);
-    } else {
-        write(user->socket, "\nLISTA DE SALAS SUSCRITAS\n======================\
-==\n",51);
-    }
+void *rutina_hilo_enlace(void *args) {
 
-    nodo *aux = l.cabeza;
-    
-    while (aux != NULL) {
-        sala *actual = (sala *) aux->elemento;
-        
-        write(user->socket, "\"", 1);
-        write(user->socket, actual->nombre_sala, strlen(actual->nombre_sala));
-        write(user->socket, "\"\n", 2);
-        
-        aux = aux->sig;
+    par *p = (par *) args;
+    usuario *user;
+    reactor *r;
+    int fd, cerrado;
+
+    while (1) {
+        fd = conectar_par(p->direccion);
+
+        if (fd >= 0) {
+            r = &reactores[__sync_fetch_and_add(&siguiente_reactor, 1) %
+                           num_reactores];
+            user = agregar_conexion(fd, r, p);
+
+            if (user == NULL) {
+                close(fd);
+            } else {
+                printf("Enlace con %s abierto.\n", p->direccion);
+                unirse_pares(p, user);
+                anunciar_intereses(user);
+
+                do {
+                    sleep(1);
+                    pthread_mutex_lock(&user->mutex_socket);
+                    cerrado = user->cerrado;
+                    pthread_mutex_unlock(&user->mutex_socket);
+                } while (!cerrado);
+
+                printf("Enlace con %s cerrado.\n", p->direccion);
+                soltar_usuario(user);
+            }
+        }
+
+        sleep(INTERVALO_ENLACE);
     }
-    
-    write(user->socket, "\n", 1);
-    
-    pthread_mutex_unlock(&user->mutex_socket);
-    pthread_mutex_unlock(&mutex_salas);
+
+    return NULL;
 }
 
 
 /**
- * listar_usuarios
- * 
- * @brief Imprime la lista de usuarios del sistema.
- * 
- * @param user Usuario que desea imprimir una lista de salas.
- * 
- * La función recorre la lista de usuarios del sistema e imprime cada elemento
- * de la misma directamente en el socket del usuario que ejecuta el comando.
+ * crear_enlaces
+ *
+ * @brief Crea un hilo por cada servidor par indicado con -v.
  */
 
-void listar_usuarios(usuario *user) {
-    
-    nodo *nodo_aux = NULL;
-    hilo_usuario *hc_aux = NULL;
-    usuario *usuario_aux = NULL;
-    
-    char *user_name = malloc(MAXLENGTH_USER);
-    
-    if (user_name == NULL) {
-        fprintf(stderr, "No se puede asignar memoria.\n");
-        return;
-    }
-    
-    pthread_mutex_lock(&user->mutex_socket);
-    write(user->socket, "\nLISTA DE USUARIOS DEL SISTEMA\n=====================\
-========\n",61);
-    
-    if(!(lista_vacia(lista_global_hilos_usuarios))){
-        nodo_aux = lista_global_hilos_usuarios.cabeza;
-    }
+void crear_enlaces() {
 
-    while(nodo_aux != NULL){
-        hc_aux = nodo_aux->elemento;
-        usuario_aux = hc_aux->cliente;
-        strcpy(user_name, usuario_aux->nombre_usuario);
-        strcat(user_name, "\n");
-        
-        write(user->socket, user_name, strlen(user_name));
-        
-        nodo_aux = nodo_aux->sig;
+    pthread_t hilo;
+    par *p;
+    int i;
+
+    for (i = 0; i < num_direcciones_pares; i++) {
+        p = crear_par(direcciones_pares[i]);
+        if (p == NULL)
+            exit(1);
+        if (pthread_create(&hilo, NULL, rutina_hilo_enlace, p))
+            fatalerror("No se pudo crear el hilo de un enlace.\n");
+        pthread_detach(hilo);
     }
-    
-    write(user->socket, "\n", 1);
-    free(user_name);
-    pthread_mutex_unlock(&user->mutex_socket);
 }
 
 
+//----------------------------------------------------------- Administración -//
+
 /**
- * enviar_mensaje
- * 
- * @brief Envía un mensaje de parte de un usuario.
- * 
- * @param user Usuario que desea imprimir una lista de salas.
- * @param mens Mensaje a enviar.
- * 
- * La función recibe un usuario y un mensaje a enviar. Recorre la lista de
- * salas suscritas del usuario y por cada sala suscrita, envía el mensaje al
- * socket de cada usuario suscrito a esa sala, incluyéndolo a él mismo.
+ * escribir_metricas
+ *
+ * @brief Escribe las métricas del servidor en el formato de texto de
+ *        Prometheus.
+ *
+ * @param f Archivo en el que se escriben.
+ *
+ * Los contadores de los hilos se suman en este momento. Las cantidades de
+ * usuarios y salas se leen con sus semáforos de lectura, y el largo de cada
+ * cola de comandos con el semáforo de su manager.
  */
 
-void enviar_mensaje(usuario *user, char *mens){
+void escribir_metricas(FILE *f) {
 
-    nodo *nodo_sala_usuario;
-    nodo *aux_nodo;
-    
-    if(!(lista_vacia(lista_global_salas))){
-        nodo_sala_usuario = user->lista_salas_suscritas.cabeza;
-    }
-        
-    char *complemento_mensaje = malloc(strlen(mens)+200);
-    
-    if (complemento_mensaje == NULL) {
-        fprintf(stderr, "No se puede asignar memoria.\n");
-        return;
-    }
-    
-    sala *aux_sala_usuario;//auxiliar para moverse por las salas del user
-    usuario *user_act;
-    nodo *user_nod;
-    mens = mens + 4;
+    metricas total;
+    char etiquetas[32];
+    int i, usuarios, salas, en_cola;
 
-    // por cada sala en el usuario
-    while(nodo_sala_usuario != NULL){
-        
-        if(!(lista_vacia(user->lista_salas_suscritas))) {
-            aux_nodo = lista_global_salas.cabeza;
-        }
-        
-        if(nodo_sala_usuario->elemento != NULL) {
-            aux_sala_usuario = nodo_sala_usuario->elemento;
-            
-            if(!(lista_vacia(aux_sala_usuario->lista_usuarios_activos))) {
-                user_nod = aux_sala_usuario->lista_usuarios_activos.cabeza;
-                
-                // por cada usuario en la sala
-                while(user_nod != NULL){
-                    user_act = user_nod->elemento;
-
-                    strcpy(complemento_mensaje, "\n>> ");
-                    strcat(complemento_mensaje, user->nombre_usuario);
-                    strcat(complemento_mensaje, "@");
-                    strcat(complemento_mensaje, aux_sala_usuario->nombre_sala);
-                    strcat(complemento_mensaje, ": ");
-                    strcat(complemento_mensaje, mens);
-                    strcat(complemento_mensaje, "\n");
-                    
-                    pthread_mutex_lock(&user_act->mutex_socket);
-                    write(user_act->socket, complemento_mensaje, 
-                          strlen(complemento_mensaje));
-                    pthread_mutex_unlock(&user_act->mutex_socket);
-
-                    user_nod = user_nod->sig;
-                }
-            }
-         }
+    sumar_metricas(&total);
 
-        nodo_sala_usuario = nodo_sala_usuario->sig;
+    pthread_rwlock_rdlock(&rwlock_usuarios);
+    usuarios = tabla_global_usuarios.num_elementos;
+    pthread_rwlock_unlock(&rwlock_usuarios);
+
+    pthread_rwlock_rdlock(&rwlock_salas);
+    salas = tabla_global_salas.num_elementos;
+    pthread_rwlock_unlock(&rwlock_salas);
+
+    escribir_contador(f, "chat_usuarios", "gauge",
+                      "Usuarios con nombre registrado.", usuarios);
+    escribir_contador(f, "chat_salas", "gauge", "Salas existentes.", salas);
+    escribir_contador(f, "chat_conexiones", "gauge", "Conexiones abiertas.",
+                      total.conexiones_abiertas - total.conexiones_cerradas);
+    escribir_contador(f, "chat_conexiones_total", "counter",
+                      "Conexiones aceptadas.", total.conexiones_abiertas);
+    escribir_contador(f, "chat_bytes_recibidos_total", "counter",
+                      "Bytes leídos de los clientes.", total.bytes_recibidos);
+    escribir_contador(f, "chat_bytes_enviados_total", "counter",
+                      "Bytes escritos a los clientes.", total.bytes_enviados);
+    escribir_contador(f, "chat_lecturas_total", "counter",
+                      "Llamadas al sistema para leer de los clientes.",
+                      total.lecturas);
+    escribir_contador(f, "chat_escrituras_total", "counter",
+                      "Llamadas al sistema para escribir a los clientes.",
+                      total.escrituras);
+    escribir_contador(f, "chat_entregas_total", "counter",
+                      "Mensajes de sala encolados para un miembro.",
+                      total.entregas);
+    escribir_contador(f, "chat_omitidos_total", "counter",
+                      "Mensajes omitidos a clientes lentos.", total.omitidos);
+    escribir_contador(f, "chat_reenvios_total", "counter",
+                      "Mensajes de sala reenviados a servidores pares.",
+                      total.reenvios);
+    escribir_contador(f, "chat_reenvios_perdidos_total", "counter",
+                      "Mensajes para servidores pares que no cupieron en la \
+cola del enlace.", total.reenvios_perdidos);
+    escribir_contador(f, "chat_compresiones_total", "counter",
+                      "Mensajes comprimidos para clientes comprimidos.",
+                      total.compresiones);
+
+    fprintf(f, "# HELP chat_comandos_en_cola Comandos esperando en la cola "
+            "de cada manager.\n# TYPE chat_comandos_en_cola gauge\n");
+    for (i = 0; i < num_managers; i++) {
+        pthread_mutex_lock(&managers[i].mutex_comandos);
+        en_cola = managers[i].cola.largo;
+        pthread_mutex_unlock(&managers[i].mutex_comandos);
+        fprintf(f, "chat_comandos_en_cola{manager=\"%d\"} %d\n", i, en_cola);
     }
-    free(complemento_mensaje);
-}
 
+    fprintf(f, "# HELP chat_comando_segundos Tiempo desde que se recibe un "
+            "comando hasta que termina.\n"
+            "# TYPE chat_comando_segundos histogram\n");
+    for (i = 0; i < NUM_ORDENES; i++) {
+        if (ordenes[i].ejecutar == NULL)
+            continue;
+        sprintf(etiquetas, "comando=\"%s\"", ordenes[i].nombre);
+        escribir_histograma(f, "chat_comando_segundos", etiquetas,
+                            &total.comandos[i]);
+    }
+
+    fprintf(f, "# HELP chat_difusion_segundos Tiempo de repartir un mensaje "
+            "entre los miembros de una sala.\n"
+            "# TYPE chat_difusion_segundos histogram\n");
+    escribir_histograma(f, "chat_difusion_segundos", "", &total.difusion);
+}
 
-//------------------------------------------------------------- Hilo manager -//
 
 /**
- * rutina_hilo_manager
- * 
- * @brief Función que ejecuta el hilo manager del servidor.
- * 
- * @see Proyecto 1 - Informe.pdf
+ * rutina_hilo_admin
+ *
+ * @brief Función que ejecuta el hilo del puerto de administración.
+ * @param args Socket en el que escucha el puerto de administración.
+ *
+ * Atiende una conexión a la vez: lee la petición HTTP (sin revisarla),
+ * responde con las métricas y cierra la conexión, como espera Prometheus.
  */
 
-void *rutina_hilo_manager() {
-    
-    comando *com;
-    char aux[4];
-        
+void *rutina_hilo_admin(void *args) {
+
+    int admin = *(int *) args;
+    struct timeval espera = { 1, 0 };
+    char peticion[1024];
+    FILE *f;
+    int fd;
+
     while (1) {
-        pthread_mutex_lock(&mutex_comandos);
-        if (!lista_vacia(cola_global_comandos)) {
-            
-            com = (comando *) extraer_primero(&cola_global_comandos);
-            pthread_mutex_unlock(&mutex_comandos);
-           
-            strncpy(aux, com->texto, 3);
-            
-            aux[3] = '\0';
-            com->texto = com->texto+4;
-            
-            if (aux != NULL) {
-                if (!strcmp(aux,"cre")) {
-                    if (strcmp(com->texto,"")) // Revisa que la sala no es vacía
-                        crear_sala(com->texto, com->sender);
-                } else if (!strcmp(aux,"eli")) {
-                    if (existe_elemento(lista_global_salas,com->texto,
-                        salas_iguales))
-                        eliminar_sala(com->texto, com->sender);
-                } else if (!strcmp(aux,"sus")) {
-                    suscribir_usuario(com->texto, com->sender);
-                } else if (!strcmp(aux,"sal")) {
-                    imprimir_lista_salas(lista_global_salas, com->sender, 1);
-                } else if (!strcmp(aux,"des")) {
-                    desuscribir_usuario(com->sender);
-                } else if (!strcmp(aux,"mis")) {
-                    imprimir_lista_salas(com->sender->lista_salas_suscritas,
-                                         com->sender, 0);
-                }
-            }
-            free(com);
+        fd = accept(admin, NULL, NULL);
+        if (fd < 0)
+            continue;
+
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &espera, sizeof(espera));
+        recv(fd, peticion, sizeof(peticion), 0);
+
+        f = fdopen(fd, "w");
+        if (f == NULL) {
+            close(fd);
+            continue;
         }
-        pthread_mutex_unlock(&mutex_comandos);
+
+        fprintf(f, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; "
+                "version=0.0.4\r\nConnection: close\r\n\r\n");
+        escribir_metricas(f);
+        fclose(f);
     }
 }
 
 
-//------------------------------------------------------------- Hilo cliente -//
-
 /**
- * rutina_hilo_cliente
- * 
- * @brief Función que ejecuta el hilo cliente de cada conexión.
- * @param args Argumentos que se le pasan a la función (estructura param_hc).
- * 
- * @see Proyecto 1 - Informe.pdf
+ * crear_hilo_admin
+ *
+ * @brief Abre el puerto de administración y crea el hilo que lo atiende.
+ *
+ * El puerto solo escucha en la interfaz local (127.0.0.1).
  */
 
-void *rutina_hilo_cliente(void *args) {
-    
-    param_hc *parametro = (param_hc *) args; //socket de la comunicación
-    
-    // Inicializo el usuario
-    usuario *user = parametro->hilo_cliente->cliente;
-    user->nombre_usuario = malloc(MAXLENGTH_USER);
-    crear_lista(&user->lista_salas_suscritas);
-    
-    if (user->nombre_usuario == NULL) {
-        fprintf(stderr, "No se puede asignar memoria.\n");
-        ret_value = 1;
-        pthread_exit(&ret_value);
-    }
-    
-    char *nombre_aux = malloc(MAXLENGTH_USER);
-    
-    if (nombre_aux == NULL) {
-        fprintf(stderr, "No se puede asignar memoria.\n");
-        ret_value = 1;
-        pthread_exit(&ret_value);
-    }
-    
-    char *mens_pide_nombre = "Ese nombre de usuario ya existe, por favor \
-ingrese otro: \n";
-
-    char c;
-    int status;
-    int i = 0;
+void crear_hilo_admin() {
 
-    do {
-        i = 0;
+    static int admin;
+    struct sockaddr_in direccion;
+    pthread_t hilo;
+    int uno = 1;
 
-        while (read(user->socket, &c, 1) == 1) {
-            
-            if (c=='\n') {
-                *(nombre_aux + i) = '\0';
-                break;
-            } else {
-                *(nombre_aux + i) = c;
-                i++;
-            }
-        }
-        
-        if(existe_elemento(lista_global_hilos_usuarios, nombre_aux, 
-                            hilos_iguales)){
-            write(user->socket, mens_pide_nombre, strlen(mens_pide_nombre));
-        }
+    admin = socket(AF_INET, SOCK_STREAM, 0);
+    if (admin < 0)
+        fatalerror("No se pudo abrir el socket de administración.\n");
+    setsockopt(admin, SOL_SOCKET, SO_REUSEADDR, &uno, sizeof(uno));
 
-    } while(existe_elemento(lista_global_hilos_usuarios, nombre_aux, 
-                            hilos_iguales));
+    bzero(&direccion, sizeof(direccion));
+    direccion.sin_family = AF_INET;
+    direccion.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    direccion.sin_port = htons(puerto_admin);
 
-    strcpy(user->nombre_usuario, nombre_aux);
-    free(nombre_aux);
-    
-    // Aquí se suscribe al usuario a la sala default
-    comando *com_inicial = malloc(sizeof(comando));
-    
-    if (com_inicial == NULL) {
-        fprintf(stderr, "No se puede asignar memoria.\n");
-        ret_value = 1;
-        pthread_exit(&ret_value);
-    }
-    
-    com_inicial->sender = user;
-    com_inicial->texto = malloc(MAXLENGTH);
-    
-    strcpy(com_inicial->texto,"sus ");
-    strcat(com_inicial->texto, sala_pedida);
+    if (bind(admin, (struct sockaddr *) &direccion, sizeof(direccion)) != 0 ||
+        listen(admin, QUEUELENGTH) < 0)
+        fatalerror("No se pudo abrir el puerto de administración.\n");
 
-    pthread_mutex_lock(&mutex_comandos);
-    agregar_final(&cola_global_comandos, com_inicial);
-    pthread_mutex_unlock(&mutex_comandos);
-    
-    // A partir de aquí se lee del socket permanentemente
-    char *mensaje = malloc(MAXLENGTH);
-    
-    if (mensaje == NULL) {
-        fprintf(stderr, "No se puede asignar memoria.\n");
-        ret_value = 1;
-        pthread_exit(&ret_value);
-    }
-    
-    comando *com_cliente;
-    int j;
-    
-    while (1) {
-        
-        i = 0;
-        j = 0;
-        
-        while ((status = read(user->socket, &c, 1)) == 1) {
-            
-            
-            if (j >= MAXLENGTH) {
-                
-                mensaje = realloc(mensaje, sizeof(j*2));
-                j = 0;
-                
-                if (mensaje == NULL) {
-                    fprintf(stderr, "No se puede reasignar memoria.\n");
-                    pthread_exit(&ret_value);
-                }
-            }
-            
-            if (c == '\n') {
-                *(mensaje+i) = '\0';
-                break;
-            } else {
-                *(mensaje+i) = c;
-                i++;
-                j++;
-            }
-        }
-        
-        if (status != 1) {
-            ret_value = 1;
-            pthread_exit(&ret_value);
-            
-        } else {
-            
-            if (strncmp(mensaje, "\0", 1)) {
-                
-                if (strlen(mensaje) >= 4) {
-                    if (!strncmp(mensaje, "men ", 4)) {
-                        enviar_mensaje(user, mensaje);
-                    } else if (!strncmp(mensaje, "sus ", 4) || 
-                               !strncmp(mensaje, "cre ", 4) ||
-                               !strncmp(mensaje, "eli ", 4)) {
-                        
-                        com_cliente = malloc(sizeof(comando));
-                    
-                        if (com_cliente == NULL) {
-                            fprintf(stderr, "No se puede asignar memoria.\n");
-                            pthread_exit(&ret_value);
-                        }
-                    
-                        com_cliente->sender = user;
-                        com_cliente->texto = malloc(sizeof(strlen(mensaje)));
-                        
-                        if (com_cliente->texto == NULL) {
-                            fprintf(stderr, "No se puede asignar memoria.\n");
-                            pthread_exit(&ret_value);
-                        }
-                        
-                        strcpy(com_cliente->texto, mensaje);
-                        
-                        pthread_mutex_lock(&mutex_comandos);
-                        agregar_final(&cola_global_comandos, com_cliente);
-                        pthread_mutex_unlock(&mutex_comandos);
-                        
-                    } else {
-                        pthread_mutex_lock(&user->mutex_socket);
-                        write(user->socket, "Comando no reconocido\n", 22);
-                        pthread_mutex_unlock(&user->mutex_socket);
-                    }
-                    
-                } else if (strlen(mensaje) == 3) {
-                    if (!strncmp(mensaje, "sal", 3) || 
-                        !strncmp(mensaje, "mis", 3) ||
-                        !strncmp(mensaje, "des", 3)) {
-                       
-                        com_cliente = malloc(sizeof(comando));
-                    
-                        if (com_cliente == NULL) {
-                            fprintf(stderr, "No se puede asignar memoria.\n");
-                            pthread_exit(&ret_value);
-                        }
-                        
-                        com_cliente->sender = user;
-                        com_cliente->texto = malloc(sizeof(strlen(mensaje)));
-                        
-                        if (com_cliente->texto == NULL) {
-                            fprintf(stderr, "No se puede asignar memoria.\n");
-                            pthread_exit(&ret_value);
-                        }
-                        
-                        strcpy(com_cliente->texto, mensaje);
-                        
-                        pthread_mutex_lock(&mutex_comandos);
-                        agregar_final(&cola_global_comandos, com_cliente);
-                        pthread_mutex_unlock(&mutex_comandos);
-                        
-                    } else if (!strncmp(mensaje, "usu", 3)){
-                        listar_usuarios(user);
-
-                    } else if (!strncmp(mensaje, "fue", 3)) {
-                        eliminar_usuario(user);
-                        pthread_mutex_lock(&user->mutex_socket);
-                        write(user->socket, salida, 1);
-                        pthread_mutex_unlock(&user->mutex_socket);
-                        ret_value = 0;
-                        pthread_exit(&ret_value);
-
-                    } else {
-                        pthread_mutex_lock(&user->mutex_socket);
-                        write(user->socket, "Comando no reconocido\n", 22);
-                        pthread_mutex_unlock(&user->mutex_socket);
-                    }
-                    
-                } else {
-                    pthread_mutex_lock(&user->mutex_socket);
-                    write(user->socket, "Comando no reconocido\n", 22);
-                    pthread_mutex_unlock(&user->mutex_socket);
-                }
-            }
-        }
-    }
-    free(mensaje);
+    if (pthread_create(&hilo, NULL, rutina_hilo_admin, &admin))
+        fatalerror("No se pudo crear el hilo de administración.\n");
 }
 
 
 /**
- * rutina_hilo_manager
+ * check_invocation
  * 
  * @brief Verifica que la invocación al programa sea correcta.
  * @param argc Cantidad de argumentos del programa principal.
  * @param argv Arreglo de argumentos del programa principal.
  * 
- * Modo de invocación: schat -p <puerto> [-s <sala>]
+ * Modo de invocación: schat -p <puerto> [-s <sala>] [-r <reactores>]
+ *                           [-w <managers>] [-l <largo>] [-q <bytes>]
+ *                           [-d <política>] [-a <puerto admin>]
+ *                           [-m <mensajes>] [-b <directorio>]
+ *                           [-f <milisegundos>] [-e <archivo>]
+ *                           [-t <segundos>] [-n <aceptadores>]
+ *                           [-k <conexiones>] [-u]
+ *                           [-v <host:puerto>] [-g <clave>]
+ *                           [-x <ruta>]
  */
 
 void check_invocation(int argc, char *argv[]) {
@@ -951,7 +4478,8 @@ void check_invocation(int argc, char *argv[]) {
     int pflag = 0; //variable que indica si se usó el flag -p
     opterr = 0; 
     
-    while ((opt = getopt (argc, argv, "p:s:")) != -1) {
+    while ((opt = getopt(argc, argv,
+                         "p:s:r:w:l:q:d:a:m:b:f:e:t:n:k:uv:g:x:")) != -1) {
         
         switch (opt) {
             case 'p':
@@ -968,6 +4496,153 @@ void check_invocation(int argc, char *argv[]) {
                 sala_pedida = optarg;
                 break;
         
+            case 'r':
+                num_reactores = atoi(optarg);
+                if (num_reactores < 1) {
+                    fprintf(stderr, "La cantidad de reactores debe ser \
+positiva.\n");
+                    exit(1);
+                }
+                break;
+
+            case 'w':
+                num_managers = atoi(optarg);
+                if (num_managers < 1) {
+                    fprintf(stderr, "La cantidad de managers debe ser \
+positiva.\n");
+                    exit(1);
+                }
+                break;
+
+            case 'l':
+                largo_maximo = atoi(optarg);
+                if (largo_maximo < 4) {
+                    fprintf(stderr, "El largo máximo de línea debe ser al \
+menos 4.\n");
+                    exit(1);
+                }
+                break;
+
+            case 'q':
+                limite_salida = atoi(optarg);
+                if (limite_salida < MAXLENGTH) {
+                    fprintf(stderr, "El límite de salida debe ser al menos \
+%d bytes.\n", MAXLENGTH);
+                    exit(1);
+                }
+                break;
+
+            case 'd':
+                if (!strcmp(optarg, "descartar")) {
+                    politica_lentos = POLITICA_DESCARTAR;
+                } else if (!strcmp(optarg, "desconectar")) {
+                    politica_lentos = POLITICA_DESCONECTAR;
+                } else if (!strcmp(optarg, "marcar")) {
+                    politica_lentos = POLITICA_MARCAR;
+                } else {
+                    fprintf(stderr, "Política inválida. Debe ser descartar, \
+desconectar o marcar.\n");
+                    exit(1);
+                }
+                break;
+
+            case 'a':
+                puerto_admin = atoi(optarg);
+                if (puerto_admin < 1024 || puerto_admin > 65535) {
+                    fprintf(stderr,"Puerto de administración inválido. Debe \
+estar entre 1025 y 65.535.\n");
+                    exit(1);
+                }
+                break;
+
+            case 'm':
+                capacidad_historial = atoi(optarg);
+                if (capacidad_historial < 0 ||
+                    capacidad_historial > MAX_HISTORIAL) {
+                    fprintf(stderr, "El historial debe tener entre 0 y %d \
+mensajes.\n", MAX_HISTORIAL);
+                    exit(1);
+                }
+                break;
+
+            case 'b':
+                directorio_bitacora = optarg;
+                break;
+
+            case 'f':
+                intervalo_bitacora = atoi(optarg);
+                if (intervalo_bitacora < 1) {
+                    fprintf(stderr, "El intervalo de la bitácora debe ser \
+positivo.\n");
+                    exit(1);
+                }
+                break;
+
+            case 'e':
+                archivo_instantanea = optarg;
+                break;
+
+            case 't':
+                intervalo_instantanea = atoi(optarg);
+                if (intervalo_instantanea < 1) {
+                    fprintf(stderr, "El intervalo de la instantánea debe ser \
+positivo.\n");
+                    exit(1);
+                }
+                break;
+
+            case 'n':
+                num_aceptadores = atoi(optarg);
+                if (num_aceptadores < 1) {
+                    fprintf(stderr, "La cantidad de aceptadores debe ser \
+positiva.\n");
+                    exit(1);
+                }
+                break;
+
+            case 'k':
+                largo_cola = atoi(optarg);
+                if (largo_cola < 1) {
+                    fprintf(stderr, "El largo de la cola de conexiones debe \
+ser positivo.\n");
+                    exit(1);
+                }
+                break;
+
+            case 'u':
+                usar_anillo = 1;
+                break;
+
+            case 'v':
+                if (strrchr(optarg, ':') == NULL) {
+                    fprintf(stderr, "La dirección de un servidor par debe \
+ser host:puerto.\n");
+                    exit(1);
+                }
+                direcciones_pares = realloc(direcciones_pares,
+                                            (num_direcciones_pares + 1) *
+                                            sizeof(char *));
+                if (direcciones_pares == NULL) {
+                    fprintf(stderr, "No se puede asignar memoria.\n");
+                    exit(1);
+                }
+                direcciones_pares[num_direcciones_pares++] = optarg;
+                break;
+
+            case 'g':
+                clave_federacion = optarg;
+                break;
+
+            case 'x':
+                ruta_local = optarg;
+                if (strlen(ruta_local) >=
+                    sizeof(((struct sockaddr_un *) NULL)->sun_path)) {
+                    fprintf(stderr, "La ruta del socket local es muy \
+larga.\n");
+                    exit(1);
+                }
+                break;
+
             case ':':
                 fprintf(stderr, "Opción -%c requiere un argumento.\n", optopt);
                 exit(1);
@@ -980,52 +4655,149 @@ void check_invocation(int argc, char *argv[]) {
     }
     
     if (!pflag) {
-        fprintf (stderr,"Modo de uso: %s -p <puerto> [-s <sala>]\n",
+        fprintf (stderr,"Modo de uso: %s -p <puerto> [-s <sala>] \
+[-r <reactores>] [-w <managers>] [-l <largo>] [-q <bytes>] \
+[-d <política>] [-a <puerto admin>] [-m <mensajes>] [-b <directorio>] \
+[-f <milisegundos>] [-e <archivo>] [-t <segundos>] [-n <aceptadores>] \
+[-k <conexiones>] [-u] [-v <host:puerto>] [-g <clave>] [-x <ruta>]\n",
                 argv[0]);
         exit(1);
     }
+
+    if (num_direcciones_pares > 0 && clave_federacion == NULL) {
+        fprintf(stderr, "Los enlaces con otros servidores (-v) necesitan la \
+clave de la federación (-g).\n");
+        exit(1);
+    }
+
+    if (num_reactores == 0) {
+        num_reactores = sysconf(_SC_NPROCESSORS_ONLN);
+        if (num_reactores < 1)
+            num_reactores = 1;
+    }
+
+    if (num_managers == 0) {
+        num_managers = sysconf(_SC_NPROCESSORS_ONLN);
+        if (num_managers < 1)
+            num_managers = 1;
+    }
+
+    if (num_aceptadores == 0) {
+        num_aceptadores = sysconf(_SC_NPROCESSORS_ONLN);
+        if (num_aceptadores < 1)
+            num_aceptadores = 1;
+    }
 }
 
 
 /**
- * ctrlc_handler
+ * terminar_servidor
  * 
- * @brief Manejador de la señal enviada por presionar Ctrl+C
+ * @brief Termina el servidor después de presionar Ctrl+C.
  * 
- * Indica en el servidor que este ha sido terminado y libera la memoria
- * necesaria. Además, envía la señal de finalización (caracter salida) a cada
- * cliente en el sistema.
+ * Escribe la instantánea, envía la señal de finalización (caracter salida)
+ * a cada cliente en el sistema, escribe lo que quede de la bitácora e
+ * imprime el estado del pool de nodos de las listas. Lo ejecuta el hilo de
+ * terminación, fuera del contexto de la señal, mientras los reactores y los
+ * managers siguen funcionando. Por eso los usuarios se recorren con
+ * rwlock_usuarios bloqueado para escribir, y no se suelta hasta salir: un
+ * reactor que cierra una conexión se queda esperándolo en eliminar_usuario,
+ * antes de soltar al usuario, y ninguno se registra ni sale del directorio.
+ * Cada usuario se marca como cerrado, para que nadie más le escriba. Las
+ * salas y lo demás no se liberan, porque otros hilos pueden estar usándolos
+ * y el proceso termina enseguida.
  */
 
-void ctrlc_handler(){
-    
-    pthread_kill(tid_manager, 0);
-    
-    hilo_usuario *hc;
-    sala *s;
+void terminar_servidor(){
     
-    while (!lista_vacia(lista_global_hilos_usuarios)) {
-        hc = (hilo_usuario *) extraer_primero(&lista_global_hilos_usuarios);
-        pthread_mutex_lock(&hc->cliente->mutex_socket);
-        write(hc->cliente->socket, salida, 1);
-        pthread_mutex_unlock(&hc->cliente->mutex_socket);
-        
-        free(hc->cliente->nombre_usuario);
-        free(hc->cliente);
-        free(hc);
+    usuario *user;
+    estadisticas_nodos nodos;
+    char fin[TAMANO_CABECERA];
+    int i;
+
+    for (i = 0; i < num_managers; i++)
+        pthread_kill(managers[i].hilo, 0);
+
+    if (archivo_instantanea != NULL) {
+        escribir_instantanea();
+        // El hilo de las instantáneas ya no escribe otra después de esta
+        pthread_mutex_lock(&mutex_instantanea);
     }
-    
-    while (!lista_vacia(lista_global_salas)) {
-        s = (sala *) extraer_primero(&lista_global_salas);
-        free(s);
+
+    pthread_rwlock_wrlock(&rwlock_usuarios);
+
+    while (tabla_global_usuarios.primera != NULL) {
+        user = (usuario *) eliminar_tabla(&tabla_global_usuarios,
+                                          tabla_global_usuarios.primera->clave);
+        pthread_mutex_lock(&user->mutex_socket);
+        if (user->binario) {
+            escribir_cabecera(fin, RES_FIN, 0, 0);
+            agregar_usuario(user, fin, TAMANO_CABECERA);
+        } else {
+            agregar_usuario(user, salida, 1);
+        }
+        vaciar_con_espera(user);
+        user->cerrado = 1;
+        close(user->socket);
+        pthread_mutex_unlock(&user->mutex_socket);
     }
     
-    free(salida);
-    close(sockfd);
+    if (directorio_bitacora != NULL)
+        cerrar_bitacora();
+
+    consultar_nodos(&nodos);
+    printf("\nNodos: %ld reservados en %ld bloques, %ld libres, %ld en uso o \
+en caché, %ld traspasos.\n", nodos.reservados, nodos.bloques, nodos.libres,
+           nodos.en_hilos, nodos.traspasos);
+
+    for (i = 0; i < num_aceptadores; i++)
+        close(sockets_escucha[i]);
+    if (socket_local >= 0) {
+        close(socket_local);
+        unlink(ruta_local);
+    }
     exit(0);
 }
 
 
+/**
+ * rutina_hilo_terminacion
+ *
+ * @brief Función que ejecuta el hilo de terminación.
+ * @param args Conjunto de señales que se esperan (solo SIGINT).
+ *
+ * Espera con sigwait a que llegue SIGINT y termina el servidor. Todos los
+ * hilos tienen SIGINT bloqueada, así que la señal solo llega por aquí.
+ */
+
+void *rutina_hilo_terminacion(void *args) {
+
+    int senal;
+
+    while (sigwait((sigset_t *) args, &senal) != 0)
+        ;
+
+    terminar_servidor();
+    return NULL;
+}
+
+
+/**
+ * crear_hilo_terminacion
+ *
+ * @brief Crea el hilo que termina el servidor al recibir SIGINT.
+ * @param senales Conjunto con SIGINT, que ya debe estar bloqueada.
+ */
+
+void crear_hilo_terminacion(sigset_t *senales) {
+
+    pthread_t hilo;
+
+    if (pthread_create(&hilo, NULL, rutina_hilo_terminacion, senales))
+        fatalerror("No se pudo crear el hilo de terminación.\n");
+}
+
+
 //------------------------------------------------------- Programa principal -//
 
 
@@ -1039,123 +4811,80 @@ void ctrlc_handler(){
 
 int main(int argc, char *argv[]) {
     
+    sigset_t senales;
+
+    /* Remember the program name for error messages. */
+    programname = argv[0];
+
     // Rutinas iniciales
     check_invocation(argc,argv);
-    signal(SIGINT, ctrlc_handler);
-    printf("Esperando conexiones por el puerto = %d...\n", puerto);
-    
-    // Crear el tid manager y la lista global de salas
-    crear_lista(&lista_global_salas);
-    crear_lista(&cola_global_comandos);
-    crear_lista(&lista_global_hilos_usuarios);
-    salida = malloc(1);
+    // Los hilos heredan SIGINT bloqueada; solo la recibe el de terminación
+    sigemptyset(&senales);
+    sigaddset(&senales, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &senales, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    printf("Esperando conexiones por el puerto = %d (%d reactores, %d \
+managers)...\n", puerto, num_reactores, num_managers);
     
-    if (salida == NULL) {
+    // Crear la tabla global de salas y el directorio de usuarios
+    if (crear_tabla(&tabla_global_salas, CUBETAS_INICIALES)) {
         fprintf(stderr, "No se puede asignar memoria.\n");
         exit(1);
     }
-    
-    *salida = EOF;
-    
-    if (pthread_create(&tid_manager, NULL, rutina_hilo_manager, NULL))
-        fatalerror("No se pudo crear el hilo manager.\n");
-    
-    comando *com_inicial = malloc(sizeof(comando));
-    
-    if (com_inicial == NULL) {
+    if (crear_tabla(&tabla_global_usuarios, CUBETAS_INICIALES)) {
         fprintf(stderr, "No se puede asignar memoria.\n");
         exit(1);
     }
-                        
-    com_inicial->sender = NULL;
-    com_inicial->texto = malloc(MAXLENGTH);
+    pthread_rwlock_init(&rwlock_salas, NULL);
+    pthread_rwlock_init(&rwlock_usuarios, NULL);
+    crear_lista_doble(&pares);
+    salida = malloc(1);
     
-    if (com_inicial->texto == NULL) {
+    if (salida == NULL) {
         fprintf(stderr, "No se puede asignar memoria.\n");
         exit(1);
     }
-                        
-    strcpy(com_inicial->texto,"cre ");
-    strcat(com_inicial->texto, sala_pedida);
-
-    pthread_mutex_lock(&mutex_comandos);
-    agregar_final(&cola_global_comandos, com_inicial);
-    pthread_mutex_unlock(&mutex_comandos);
     
-    int newsockfd;
-    struct sockaddr_in clientaddr, serveraddr;
-    int clientaddrlength;
-    pthread_t id_hc; //identificador del hilo cliente.
-    
-    /* Remember the program name for error messages. */
-    programname = argv[0];
-    /* Open a TCP socket. */
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    
-    if (sockfd < 0)
-        fatalerror("No se puede abrir el socket.\n");
-    
-    /* Bind the address to the socket. */
-    bzero(&serveraddr, sizeof(serveraddr));
-    serveraddr.sin_family = AF_INET;
-    serveraddr.sin_addr.s_addr = htonl(INADDR_ANY);
-    serveraddr.sin_port = htons(puerto);
-    
-    if (bind(sockfd, (struct sockaddr *) &serveraddr, sizeof(serveraddr)) != 0)
-        fatalerror("No se pudo asociar al socket.\n");
+    *salida = EOF;
     
-    if (listen(sockfd, QUEUELENGTH) < 0)
-        fatalerror("No se puede escuchar por el socket.\n");
-
-    while (1) {
-        /* Wait for a connection. */
-        clientaddrlength = sizeof(clientaddr);
-        newsockfd = accept(sockfd, (struct sockaddr *) &clientaddr,
-                           &clientaddrlength);
-
-        if (newsockfd < 0) {
-            fprintf(stderr, "Error al aceptar la conexión\n");
-            continue;
-        }
-        
-        // Asigno la memoria para lo que se le pasa al hilo
-        usuario *usuario_nuevo = malloc(sizeof(usuario));
-        
-        if (usuario_nuevo == NULL) {
-            fprintf(stderr, "No se puede asignar memoria.\n");
-            continue;
-        }
+    crear_indice_ordenes();
+    crear_managers();
     
-        hilo_usuario *hilo_nuevo_cliente = malloc(sizeof(hilo_usuario));
-        
-        if (hilo_nuevo_cliente == NULL) {
-            fprintf(stderr, "No se puede asignar memoria.\n");
-            continue;
-        }
-        
-        param_hc *parametro = malloc(sizeof(param_hc));
-        
-        if (parametro == NULL) {
+    if (archivo_instantanea != NULL) {
+        if (crear_tabla(&tabla_guardadas, CUBETAS_INICIALES)) {
             fprintf(stderr, "No se puede asignar memoria.\n");
-            continue;
-        }
-        
-        // Inserta el socket al usuario
-        usuario_nuevo->socket = newsockfd;
-        
-        // Inserta los parámetros del hilo
-        hilo_nuevo_cliente->cliente = usuario_nuevo;
-        parametro->hilo_cliente = hilo_nuevo_cliente;
-        
-        agregar_principio(&lista_global_hilos_usuarios, hilo_nuevo_cliente);
-        
-        if (pthread_create(&hilo_nuevo_cliente->hilo, NULL, rutina_hilo_cliente,
-                            parametro)) {
-            fprintf(stderr, "No se pudo crear un hilo para manejar al \
-cliente.");
-            continue;
+            exit(1);
         }
+        cargar_instantanea();
+        crear_hilo_instantanea();
     }
+
+    crear_sala(sala_pedida, NULL);
+
+    if (directorio_bitacora != NULL) {
+        if (abrir_bitacora())
+            fatalerror("No se pudo abrir la bitácora.\n");
+        recuperar_historial();
+        if (crear_hilo_bitacora())
+            fatalerror("No se pudo crear el hilo de la bitácora.\n");
+    }
+    
+    crear_reactores();
+    crear_aceptadores();
+    crear_enlaces();
+
+    if (puerto_admin != 0)
+        crear_hilo_admin();
+
+    crear_hilo_terminacion(&senales);
+
+    printf("Aceptando conexiones con %d hilos (SO_REUSEPORT), con una cola \
+de %d conexiones cada uno.\n", num_aceptadores, largo_cola_efectivo());
+    if (ruta_local != NULL)
+        printf("Aceptando también conexiones locales en %s.\n", ruta_local);
+
+    // El hilo principal es el primer aceptador
+    rutina_hilo_aceptador(&sockets_escucha[0]);
     
     free(salida);
     return 0;
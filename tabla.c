@@ -0,0 +1,324 @@
+/**
+ * @file tabla.c
+ * @author Luis Fernandes 10-10239 <lfernandes@ldc.usb.ve>
+ * @author Rebeca Machado 10-10406 <rebeca@ldc.usb.ve>
+ *
+ * Funciones para el manejo de tablas de hash indexadas por nombre.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/**
+ * \struct celda
+ * \brief Struct que representa un elemento de una tabla.
+ *
+ * Cada celda está en dos listas: la cubeta que le corresponde según el hash
+ * de su clave y la lista de todas las celdas en orden de inserción.
+ */
+
+typedef struct celda {
+
+    /**
+     * @var clave
+     * @brief Nombre con el que se indexa el elemento (no se copia).
+     */
+    char *clave;
+
+    /**
+     * @var hash
+     * @brief Hash de la clave, para no recalcularlo al redimensionar.
+     */
+    unsigned int hash;
+
+    /**
+     * @var elemento
+     * @brief Elemento de la celda.
+     */
+    void *elemento;
+
+    /**
+     * @var sig_cubeta
+     * @brief Siguiente celda de la misma cubeta.
+     */
+    struct celda *sig_cubeta;
+
+    /**
+     * @var anterior
+     * @brief Celda insertada justo antes que esta.
+     */
+    struct celda *anterior;
+
+    /**
+     * @var siguiente
+     * @brief Celda insertada justo después que esta.
+     */
+    struct celda *siguiente;
+
+} celda;
+
+
+/**
+ * \struct tabla
+ * \brief Struct que representa una tabla de hash.
+ */
+
+typedef struct {
+
+    /**
+     * @var cubetas
+     * @brief Arreglo de cubetas (listas de celdas).
+     */
+    celda **cubetas;
+
+    /**
+     * @var num_cubetas
+     * @brief Tamaño del arreglo de cubetas (siempre una potencia de 2).
+     */
+    int num_cubetas;
+
+    /**
+     * @var num_elementos
+     * @brief Cantidad de elementos en la tabla.
+     */
+    int num_elementos;
+
+    /**
+     * @var primera
+     * @brief Celda más antigua de la tabla.
+     */
+    celda *primera;
+
+    /**
+     * @var ultima
+     * @brief Celda más reciente de la tabla.
+     */
+    celda *ultima;
+
+} tabla;
+
+
+/**
+ * hash_cadena
+ *
+ * @brief Calcula el hash de una cadena de caracteres (FNV-1a).
+ * @param s Cadena a la que se le calcula el hash.
+ * @return Hash de la cadena.
+ *
+ */
+
+unsigned int hash_cadena(char *s) {
+    unsigned int h = 2166136261u;
+    while (*s != '\0') {
+        h ^= (unsigned char) *s;
+        h *= 16777619u;
+        s++;
+    }
+    return h;
+}
+
+
+/**
+ * crear_tabla
+ *
+ * @brief Inicializa una tabla.
+ * @param t Tabla a inicializar.
+ * @param num_cubetas Cantidad inicial de cubetas (se redondea a potencia de 2).
+ * @return 0 si se pudo crear, 1 si no se pudo asignar memoria.
+ *
+ */
+
+int crear_tabla(tabla *t, int num_cubetas) {
+    int n = 1;
+    while (n < num_cubetas)
+        n *= 2;
+    t->cubetas = calloc(n, sizeof(celda *));
+    if (t->cubetas == NULL)
+        return 1;
+    t->num_cubetas = n;
+    t->num_elementos = 0;
+    t->primera = NULL;
+    t->ultima = NULL;
+    return 0;
+}
+
+
+/**
+ * redimensionar_tabla
+ *
+ * @brief Cambia la cantidad de cubetas de una tabla.
+ * @param t Tabla a redimensionar.
+ * @param num_cubetas Cantidad nueva de cubetas (se redondea a potencia de 2).
+ * @return 0 si se pudo redimensionar, 1 si no se pudo asignar memoria.
+ *
+ * Las celdas no se copian: solo se reparten entre las cubetas nuevas usando
+ * el hash guardado en cada una. El orden de inserción no cambia.
+ */
+
+int redimensionar_tabla(tabla *t, int num_cubetas) {
+    int n = 1;
+    unsigned int i;
+    celda **nuevas;
+    celda *aux;
+
+    while (n < num_cubetas)
+        n *= 2;
+
+    nuevas = calloc(n, sizeof(celda *));
+    if (nuevas == NULL)
+        return 1;
+
+    for (aux = t->primera; aux != NULL; aux = aux->siguiente) {
+        i = aux->hash & (n - 1);
+        aux->sig_cubeta = nuevas[i];
+        nuevas[i] = aux;
+    }
+
+    free(t->cubetas);
+    t->cubetas = nuevas;
+    t->num_cubetas = n;
+    return 0;
+}
+
+
+/**
+ * buscar_tabla
+ *
+ * @brief Encuentra el elemento de una clave y lo devuelve.
+ * @param t Tabla en la que se busca.
+ * @param clave Clave a buscar.
+ * @return El elemento asociado a la clave, o NULL si no está.
+ *
+ */
+
+void *buscar_tabla(tabla *t, char *clave) {
+    unsigned int h = hash_cadena(clave);
+    celda *aux = t->cubetas[h & (t->num_cubetas - 1)];
+
+    while (aux != NULL) {
+        if (aux->hash == h && !strcmp(aux->clave, clave))
+            return aux->elemento;
+        aux = aux->sig_cubeta;
+    }
+    return NULL;
+}
+
+
+/**
+ * insertar_tabla
+ *
+ * @brief Agrega un elemento a la tabla si su clave no existe.
+ * @param t Tabla a la que se agrega el elemento.
+ * @param clave Clave del elemento. Debe vivir mientras el elemento esté en la
+ *              tabla, ya que no se copia.
+ * @param elem Elemento a agregar.
+ * @return 0 si se agregó, 1 si la clave ya existía, -1 si no hay memoria.
+ *
+ * Cuando la cantidad de elementos supera la de cubetas, la tabla se duplica.
+ */
+
+int insertar_tabla(tabla *t, char *clave, void *elem) {
+    unsigned int h = hash_cadena(clave);
+    unsigned int i = h & (t->num_cubetas - 1);
+    celda *aux = t->cubetas[i];
+
+    while (aux != NULL) {
+        if (aux->hash == h && !strcmp(aux->clave, clave))
+            return 1;
+        aux = aux->sig_cubeta;
+    }
+
+    celda *nueva = malloc(sizeof(celda));
+    if (nueva == NULL)
+        return -1;
+
+    nueva->clave = clave;
+    nueva->hash = h;
+    nueva->elemento = elem;
+    nueva->sig_cubeta = t->cubetas[i];
+    t->cubetas[i] = nueva;
+
+    nueva->siguiente = NULL;
+    nueva->anterior = t->ultima;
+    if (t->ultima != NULL)
+        t->ultima->siguiente = nueva;
+    else
+        t->primera = nueva;
+    t->ultima = nueva;
+
+    t->num_elementos++;
+    if (t->num_elementos > t->num_cubetas)
+        redimensionar_tabla(t, t->num_cubetas * 2);
+    return 0;
+}
+
+
+/**
+ * eliminar_tabla
+ *
+ * @brief Elimina una clave de la tabla.
+ * @param t Tabla de la que se elimina.
+ * @param clave Clave a eliminar.
+ * @return El elemento que estaba asociado a la clave, o NULL si no estaba.
+ *
+ * Solo se libera la celda; el elemento (y su clave) quedan a cargo de quien
+ * llama a la función.
+ */
+
+void *eliminar_tabla(tabla *t, char *clave) {
+    unsigned int h = hash_cadena(clave);
+    celda **ref = &t->cubetas[h & (t->num_cubetas - 1)];
+    celda *aux;
+    void *elem;
+
+    while (*ref != NULL) {
+        aux = *ref;
+        if (aux->hash == h && !strcmp(aux->clave, clave)) {
+            *ref = aux->sig_cubeta;
+
+            if (aux->anterior != NULL)
+                aux->anterior->siguiente = aux->siguiente;
+            else
+                t->primera = aux->siguiente;
+            if (aux->siguiente != NULL)
+                aux->siguiente->anterior = aux->anterior;
+            else
+                t->ultima = aux->anterior;
+
+            elem = aux->elemento;
+            free(aux);
+            t->num_elementos--;
+            return elem;
+        }
+        ref = &aux->sig_cubeta;
+    }
+    return NULL;
+}
+
+
+/**
+ * destruir_tabla
+ *
+ * @brief Libera las celdas y las cubetas de una tabla.
+ * @param t Tabla a destruir.
+ *
+ * Los elementos no se liberan.
+ */
+
+void destruir_tabla(tabla *t) {
+    celda *aux, *aux2;
+    aux = t->primera;
+    while (aux != NULL) {
+        aux2 = aux->siguiente;
+        free(aux);
+        aux = aux2;
+    }
+    free(t->cubetas);
+    t->cubetas = NULL;
+    t->num_cubetas = 0;
+    t->num_elementos = 0;
+    t->primera = NULL;
+    t->ultima = NULL;
+}